@@ -0,0 +1,20 @@
+# Turn a binary file into a C++ source defining a byte array with its content
+#
+# Usage: cmake -DINPUT=<file> -DOUTPUT=<source> -DNAMESPACE=<ns> -P embed_file.cmake
+
+file(READ "${INPUT}" content HEX)
+string(LENGTH "${content}" hexLength)
+math(EXPR size "${hexLength} / 2")
+
+string(REGEX REPLACE "([0-9a-f][0-9a-f])" "0x\\1," bytes "${content}")
+
+file(WRITE "${OUTPUT}"
+    "// Generated from ${INPUT}, do not edit\n"
+    "#include <cstddef>\n"
+    "\n"
+    "namespace ${NAMESPACE}\n"
+    "{\n"
+    "    alignas(4) extern const unsigned char BITCODE[] = { ${bytes} };\n"
+    "    extern const std::size_t BITCODE_SIZE = ${size};\n"
+    "}\n"
+)
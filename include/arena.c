@@ -0,0 +1,340 @@
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Arena allocator of the dynamic arrays and of the local arrays too big
+ * for the stack.
+ *
+ * Every subprogram with such arrays owns an arena, created by the first
+ * allocation and released as a whole when the subprogram returns, so the
+ * blocks are never freed one by one by the program. Blocks up to the
+ * largest size class are bumped out of 64 KiB chunks, a block left by
+ * setlength goes to the free list of its class and is reused by the next
+ * allocation of the same class. Bigger blocks are allocated with malloc and
+ * kept in a list to be freed with the arena. Released chunks are cached for
+ * the next arenas, so a subprogram called in a loop doesn't go to malloc.
+ * Chunks are small, every active call of a recursive subprogram holds one.
+ *
+ * The arena of the global dynamic arrays is released at the end of main.
+ * With MILA_STATS set the counters are printed to the standard error at
+ * exit. */
+
+#define CHUNK_SIZE (1 << 16)
+
+/* Size classes are the powers of two from 16 B to 16 KiB */
+#define MIN_CLASS 4
+#define MAX_CLASS 14
+#define CLASSES (MAX_CLASS - MIN_CLASS + 1)
+
+/* Released chunks kept for the next arenas, the others are freed */
+#define CACHED_CHUNKS 256
+
+/* Descriptor of a dynamic array as generated by the compiler */
+struct descriptor {
+    char * data;
+    long length;
+    void ** arena;
+};
+
+/* Before every block, class -1 is a block allocated with malloc */
+struct header {
+    long capacity;
+    long cls;
+};
+
+/* Before the header of a block allocated with malloc */
+struct large {
+    struct large * prev;
+    struct large * next;
+};
+
+struct chunk {
+    struct chunk * next;
+    long unused;
+};
+
+/* Lives at the start of its first chunk */
+struct arena {
+    pthread_mutex_t lock;
+    struct chunk * chunks;
+    char * bump;
+    char * end;
+    void * free[CLASSES];
+    struct large * large;
+};
+
+struct counters {
+    atomic_long arenas;
+    atomic_long chunks;
+    atomic_long cached;
+    atomic_long allocations;
+    atomic_long reused;
+    atomic_long large;
+    atomic_long bytes;
+    atomic_long peak;
+};
+
+/* Arena of the global dynamic arrays */
+void * mila_global_arena = NULL;
+
+static struct chunk * chunk_cache = NULL;
+static int chunk_cache_count = 0;
+static pthread_mutex_t chunk_cache_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static struct counters counters;
+static pthread_once_t stats_once = PTHREAD_ONCE_INIT;
+
+/* Negative length of setlength, reported by the runtime of the program */
+void mila_setlength_error(int length, int line);
+
+static void out_of_memory(void) {
+    fprintf(stderr, "Out of memory\n");
+    exit(1);
+}
+
+/* Bytes taken from malloc, chunks held by arenas and big blocks */
+static void account(long bytes) {
+    long now = atomic_fetch_add(&counters.bytes, bytes) + bytes;
+    long peak = atomic_load(&counters.peak);
+    while (now > peak && !atomic_compare_exchange_weak(&counters.peak, &peak, now)) {
+    }
+}
+
+static void print_stats(void) {
+    fprintf(stderr, "arenas %ld, chunks %ld (cached %ld), allocations %ld (reused %ld, large %ld), peak %ld bytes\n",
+            atomic_load(&counters.arenas), atomic_load(&counters.chunks), atomic_load(&counters.cached),
+            atomic_load(&counters.allocations), atomic_load(&counters.reused), atomic_load(&counters.large),
+            atomic_load(&counters.peak));
+}
+
+static void stats_init(void) {
+    if (getenv("MILA_STATS") != NULL) {
+        atexit(print_stats);
+    }
+}
+
+static struct chunk * chunk_get(void) {
+    struct chunk * c = NULL;
+    pthread_mutex_lock(&chunk_cache_lock);
+    if (chunk_cache != NULL) {
+        c = chunk_cache;
+        chunk_cache = c->next;
+        chunk_cache_count--;
+    }
+    pthread_mutex_unlock(&chunk_cache_lock);
+
+    if (c != NULL) {
+        atomic_fetch_add(&counters.cached, 1);
+    } else if ((c = malloc(CHUNK_SIZE)) == NULL) {
+        out_of_memory();
+    }
+    atomic_fetch_add(&counters.chunks, 1);
+    account(CHUNK_SIZE);
+    c->next = NULL;
+    return c;
+}
+
+static void chunk_put(struct chunk * c) {
+    account(-CHUNK_SIZE);
+    pthread_mutex_lock(&chunk_cache_lock);
+    if (chunk_cache_count < CACHED_CHUNKS) {
+        c->next = chunk_cache;
+        chunk_cache = c;
+        chunk_cache_count++;
+        c = NULL;
+    }
+    pthread_mutex_unlock(&chunk_cache_lock);
+    free(c);
+}
+
+/* Arena of the slot, created by the first thread getting here */
+static struct arena * arena_of(void ** slot) {
+    struct arena * a = __atomic_load_n(slot, __ATOMIC_ACQUIRE);
+    if (a != NULL) {
+        return a;
+    }
+
+    pthread_once(&stats_once, stats_init);
+    struct chunk * c = chunk_get();
+    a = (struct arena *) (c + 1);
+    pthread_mutex_init(&a->lock, NULL);
+    a->chunks = c;
+    a->bump = (char *) c + ((sizeof(struct chunk) + sizeof(struct arena) + 15) & ~(size_t) 15);
+    a->end = (char *) c + CHUNK_SIZE;
+    memset(a->free, 0, sizeof(a->free));
+    a->large = NULL;
+
+    void * expected = NULL;
+    if (!__atomic_compare_exchange_n(slot, &expected, a, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+        pthread_mutex_destroy(&a->lock);
+        chunk_put(c);
+        return expected;
+    }
+    atomic_fetch_add(&counters.arenas, 1);
+    return a;
+}
+
+/* Smallest size class of the bytes, CLASSES when there is none */
+static int class_of(long bytes) {
+    int k = MIN_CLASS;
+    while (k <= MAX_CLASS && (1L << k) < bytes) {
+        k++;
+    }
+    return k - MIN_CLASS;
+}
+
+/* Block of at least the bytes, the arena is locked */
+static char * arena_take(struct arena * a, long bytes) {
+    atomic_fetch_add(&counters.allocations, 1);
+    int cls = class_of(bytes);
+    struct header * h;
+
+    if (cls == CLASSES) {
+        struct large * l = malloc(sizeof(struct large) + sizeof(struct header) + (size_t) bytes);
+        if (l == NULL) {
+            out_of_memory();
+        }
+        atomic_fetch_add(&counters.large, 1);
+        account(bytes);
+        l->prev = NULL;
+        l->next = a->large;
+        if (a->large != NULL) {
+            a->large->prev = l;
+        }
+        a->large = l;
+        h = (struct header *) (l + 1);
+        h->capacity = bytes;
+        h->cls = -1;
+        return (char *) (h + 1);
+    }
+
+    if (a->free[cls] != NULL) {
+        atomic_fetch_add(&counters.reused, 1);
+        char * data = a->free[cls];
+        a->free[cls] = *(void **) data;
+        return data;
+    }
+
+    long capacity = 1L << (cls + MIN_CLASS);
+    long needed = (long) sizeof(struct header) + capacity;
+    if (a->end - a->bump < needed) {
+        struct chunk * c = chunk_get();
+        c->next = a->chunks;
+        a->chunks = c;
+        a->bump = (char *) (c + 1);
+        a->end = (char *) c + CHUNK_SIZE;
+    }
+
+    h = (struct header *) a->bump;
+    a->bump += needed;
+    h->capacity = capacity;
+    h->cls = cls;
+    return (char *) (h + 1);
+}
+
+/* Return a block before the arena is released, the arena is locked */
+static void arena_give(struct arena * a, char * data) {
+    struct header * h = (struct header *) data - 1;
+    if (h->cls >= 0) {
+        *(void **) data = a->free[h->cls];
+        a->free[h->cls] = data;
+        return;
+    }
+
+    struct large * l = (struct large *) h - 1;
+    if (l->prev != NULL) {
+        l->prev->next = l->next;
+    } else {
+        a->large = l->next;
+    }
+    if (l->next != NULL) {
+        l->next->prev = l->prev;
+    }
+    account(-h->capacity);
+    free(l);
+}
+
+/* Block of the size valid until the arena of the slot is released */
+void * mila_arena_alloc(void ** slot, long size) {
+    struct arena * a = arena_of(slot);
+    pthread_mutex_lock(&a->lock);
+    char * data = arena_take(a, size);
+    pthread_mutex_unlock(&a->lock);
+    return data;
+}
+
+/* Resize the elements of a dynamic array of elements of the size, the
+ * first ones are kept and the new ones are zero. A block of the same class,
+ * or a big block at most twice the size, is resized in place */
+void mila_setlength(void * array, int length, int size, int line) {
+    struct descriptor * d = array;
+    if (length < 0) {
+        mila_setlength_error(length, line);
+    }
+
+    long bytes = (long) length * size;
+    long kept = (d->length < length ? d->length : length) * size;
+    if (d->data != NULL) {
+        struct header * h = (struct header *) d->data - 1;
+        int cls = class_of(bytes);
+        if (bytes > 0 && (h->cls >= 0 ? cls == h->cls : cls == CLASSES && bytes <= h->capacity && bytes > h->capacity / 2)) {
+            memset(d->data + kept, 0, (size_t) (bytes - kept));
+            d->length = length;
+            return;
+        }
+    }
+
+    struct arena * a = arena_of(d->arena);
+    pthread_mutex_lock(&a->lock);
+    char * data = bytes > 0 ? arena_take(a, bytes) : NULL;
+    if (data != NULL) {
+        if (kept > 0) {
+            memcpy(data, d->data, (size_t) kept);
+        }
+        memset(data + kept, 0, (size_t) (bytes - kept));
+    }
+    if (d->data != NULL) {
+        arena_give(a, d->data);
+    }
+    pthread_mutex_unlock(&a->lock);
+
+    d->data = data;
+    d->length = length;
+}
+
+/* Free everything allocated in the arena of the slot, which becomes empty */
+void mila_arena_release(void ** slot) {
+    struct arena * a = __atomic_exchange_n(slot, NULL, __ATOMIC_ACQ_REL);
+    if (a == NULL) {
+        return;
+    }
+
+    for (struct large * l = a->large; l != NULL;) {
+        struct large * next = l->next;
+        account(-((struct header *) (l + 1))->capacity);
+        free(l);
+        l = next;
+    }
+
+    pthread_mutex_destroy(&a->lock);
+    for (struct chunk * c = a->chunks; c != NULL;) {
+        struct chunk * next = c->next;
+        chunk_put(c);
+        c = next;
+    }
+}
+
+/* Counters of the arenas since the start, the peak is of the bytes held */
+int mila_arena_stats(long * arenas, long * chunks, long * cached, long * allocations,
+                     long * reused, long * large, long * peak) {
+    *arenas = atomic_load(&counters.arenas);
+    *chunks = atomic_load(&counters.chunks);
+    *cached = atomic_load(&counters.cached);
+    *allocations = atomic_load(&counters.allocations);
+    *reused = atomic_load(&counters.reused);
+    *large = atomic_load(&counters.large);
+    *peak = atomic_load(&counters.peak);
+    return 1;
+}
@@ -1,14 +1,227 @@
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+/* unistd.h can't be included, its write clashes with the Mila write */
+ssize_t read(int fd, void * buf, size_t count);
+
+/* Output is collected into one big buffer and written out with a single
+ * stdio call once it fills up, before waiting for input and at exit. */
+#define OUT_BUFFER_SIZE (1 << 20)
+
+/* Longest printed integer is "-2147483648\n" */
+#define MAX_INT_LENGTH 12
+
+static char out_buffer[OUT_BUFFER_SIZE];
+static size_t out_length = 0;
+
+/* Every pair of decimal digits 00 - 99, so two digits are emitted at once */
+static const char DIGIT_PAIRS[201] =
+    "00010203040506070809"
+    "10111213141516171819"
+    "20212223242526272829"
+    "30313233343536373839"
+    "40414243444546474849"
+    "50515253545556575859"
+    "60616263646566676869"
+    "70717273747576777879"
+    "80818283848586878889"
+    "90919293949596979899";
+
+/* One stdio call per whole buffer, the symbol `write` is taken by the Mila runtime */
+static void out_flush(void) {
+    if (out_length > 0) {
+        fwrite(out_buffer, 1, out_length, stdout);
+        fflush(stdout);
+        out_length = 0;
+    }
+}
+
+__attribute__((destructor))
+static void out_flush_at_exit(void) {
+    out_flush();
+}
+
+/* Convert x to decimal, writing it backwards before end, returns the start */
+static char * int_to_dec(int x, char * end) {
+    unsigned int u = x < 0 ? 0u - (unsigned int) x : (unsigned int) x;
+    char * p = end;
+
+    while (u >= 100) {
+        unsigned int pair = (u % 100) * 2;
+        u /= 100;
+        *--p = DIGIT_PAIRS[pair + 1];
+        *--p = DIGIT_PAIRS[pair];
+    }
+
+    if (u >= 10) {
+        *--p = DIGIT_PAIRS[u * 2 + 1];
+        *--p = DIGIT_PAIRS[u * 2];
+    } else {
+        *--p = (char) ('0' + u);
+    }
+
+    if (x < 0) {
+        *--p = '-';
+    }
+
+    return p;
+}
+
+static void out_int(int x, int newline) {
+    char tmp[MAX_INT_LENGTH];
+    char * end = tmp + sizeof(tmp);
+
+    if (newline) {
+        *--end = '\n';
+    }
+    char * start = int_to_dec(x, end);
+    size_t len = (size_t) (tmp + sizeof(tmp) - start);
+
+    if (out_length + len > OUT_BUFFER_SIZE) {
+        out_flush();
+    }
+    memcpy(out_buffer + out_length, start, len);
+    out_length += len;
+}
+
+/* Input is read in big blocks, or the whole of it is mapped into memory
+ * when stdin is a regular file. */
+#define IN_BUFFER_SIZE (1 << 20)
+
+static char in_buffer[IN_BUFFER_SIZE];
+static const char * in_pos = NULL;
+static const char * in_end = NULL;
+static int in_mapped = 0;
+static int in_eof = 0;
+
+static void in_init(void) {
+    struct stat st;
+    int fd = fileno(stdin);
+
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+        off_t offset = ftello(stdin);
+        if (offset < 0) {
+            offset = 0;
+        }
+
+        void * data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data != MAP_FAILED) {
+            madvise(data, st.st_size, MADV_SEQUENTIAL);
+            in_pos = (const char *) data + offset;
+            in_end = (const char *) data + st.st_size;
+            in_mapped = 1;
+            return;
+        }
+    }
+
+    in_pos = in_end = in_buffer;
+}
+
+/* Returns 0 when there is no more input */
+static int in_refill(void) {
+    if (in_pos == NULL) {
+        in_init();
+        if (in_pos < in_end) {
+            return 1;
+        }
+    }
+
+    if (in_mapped || in_eof) {
+        return 0;
+    }
+
+    /* Interactive prompts have to be visible before waiting for input */
+    out_flush();
+
+    /* read returns what is available, so terminals and pipes don't block
+     * until the whole block is filled */
+    ssize_t n = read(fileno(stdin), in_buffer, IN_BUFFER_SIZE);
+    if (n <= 0) {
+        in_eof = 1;
+        return 0;
+    }
+
+    in_pos = in_buffer;
+    in_end = in_buffer + n;
+    return 1;
+}
+
+/* Next character or EOF */
+static inline int in_get(void) {
+    if (in_pos == in_end && ! in_refill()) {
+        return EOF;
+    }
+    return (unsigned char) *in_pos++;
+}
+
+/* Read one integer, skipping leading whitespace, returns 0 on no integer */
+static int in_int(int * x) {
+    int c;
+    do {
+        c = in_get();
+    } while (c == ' ' || c == '\n' || c == '\t' || c == '\r' || c == '\v' || c == '\f');
+
+    int negative = 0;
+    if (c == '-' || c == '+') {
+        negative = c == '-';
+        c = in_get();
+    }
+
+    if (c < '0' || c > '9') {
+        return 0;
+    }
+
+    unsigned int value = 0;
+    while (c >= '0' && c <= '9') {
+        value = value * 10 + (unsigned int) (c - '0');
+        c = in_get();
+    }
+
+    /* Give back the character that ended the number */
+    if (c != EOF) {
+        in_pos--;
+    }
+
+    *x = negative ? (int) (0u - value) : (int) value;
+    return 1;
+}
 
 int writeln(int x) {
-    printf("%d\n", x);
+    out_int(x, 1);
     return 0;
 }
 int write(int x) {
-    printf("%d", x);
+    out_int(x, 0);
     return 0;
 }
 int readln(int *x) {
-    scanf("%d", x);
+    in_int(x);
     return 0;
 }
+
+/* Failed bounds check of a program compiled with --bounds-check, the
+ * output so far is written out before the error */
+void mila_bounds_error(int index, int low, int high, int line) {
+    out_flush();
+    fprintf(stderr, "Index %d out of bounds %d..%d on line %d\n", index, low, high, line);
+    exit(1);
+}
+
+/* Copy of an array or a slice of a different length, checked like the
+ * indexes */
+void mila_length_error(int got, int expected, int line) {
+    out_flush();
+    fprintf(stderr, "Copy of %d elements into %d on line %d\n", got, expected, line);
+    exit(1);
+}
+
+/* Negative length given to setlength of a dynamic array */
+void mila_setlength_error(int length, int line) {
+    out_flush();
+    fprintf(stderr, "Negative length %d on line %d\n", length, line);
+    exit(1);
+}
@@ -0,0 +1,516 @@
+#include <limits.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/sysinfo.h>
+
+/* Work stealing runtime of the parallel for loops and spawned calls.
+ *
+ * Every worker owns a Chase-Lev deque of tasks: the owner pushes and takes
+ * at the bottom, the others steal from the top. A loop starts as a single
+ * range task that is split lazily, the worker running a range keeps its lower
+ * half and pushes the upper one, so idle workers steal the biggest pieces.
+ * The thread calling the loop is one of the workers and helps until all
+ * iterations are done.
+ *
+ * A spawned call is pushed as a task counted by the frame of the spawning
+ * subprogram, sync runs and steals other tasks until the count drops to zero.
+ * Spawns nested deeper than the cutoff are called right away, the tasks near
+ * the root of the recursion are big enough to be worth stealing.
+ *
+ * The number of workers is MILA_WORKERS, or the number of processors. The
+ * spawn depth cutoff is MILA_SPAWN_DEPTH. With MILA_STATS set the counters of
+ * the workers are printed to the standard error at exit. */
+
+/* Iterations lo to hi (inclusive) of an outlined loop body, the private
+ * values of the reduced variables start and end in partial */
+typedef void (*mila_body)(void ** env, int lo, int hi, int * partial);
+
+enum { REDUCE_SUM, REDUCE_MIN, REDUCE_MAX };
+
+#define MAX_WORKERS 256
+
+/* Power of two, a full deque runs the task instead of pushing it */
+#define DEQUE_SIZE 4096
+
+/* Pieces each worker gets of a loop on average, more balance the load better */
+#define PIECES_PER_WORKER 8
+
+/* Spawn levels past the ones needed to give every worker a task, the default cutoff */
+#define SPAWN_SLACK 8
+
+/* Tasks waiting in the deque of a worker that spawns serially, there is enough to steal */
+#define SPAWN_BACKLOG 4
+
+/* Outlined spawned call, it unpacks the arguments from the data */
+typedef void (*mila_thunk)(void * data);
+
+struct task {
+    void (*run)(struct task *);
+};
+
+struct deque {
+    _Alignas(64) atomic_long top;
+    _Alignas(64) atomic_long bottom;
+    _Atomic(struct task *) buffer[DEQUE_SIZE];
+};
+
+/* Written only by the owner, atomic so they can be read at exit */
+struct counters {
+    atomic_long tasks;
+    atomic_long steals;
+    atomic_long spawns;
+    atomic_long inlined;
+};
+
+struct worker {
+    struct deque deque;
+    unsigned int seed;
+
+    /* Spawn depth of the task running on the worker */
+    int depth;
+
+    struct counters counters;
+};
+
+static struct worker * workers = NULL;
+static int worker_count = 1;
+static int spawn_cutoff = 0;
+static pthread_once_t pool_once = PTHREAD_ONCE_INIT;
+
+/* Worker of the current thread, the thread starting the pool is the first one */
+static _Thread_local struct worker * self = NULL;
+
+/* Loops and spawned tasks in progress, idle workers sleep while there are none */
+static atomic_long active = 0;
+static pthread_mutex_t sleep_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t sleep_cond = PTHREAD_COND_INITIALIZER;
+
+static void activate(void) {
+    if (atomic_fetch_add(&active, 1) == 0) {
+        pthread_mutex_lock(&sleep_lock);
+        pthread_cond_broadcast(&sleep_cond);
+        pthread_mutex_unlock(&sleep_lock);
+    }
+}
+
+static void deactivate(void) {
+    atomic_fetch_sub(&active, 1);
+}
+
+static void bump(atomic_long * counter) {
+    atomic_store_explicit(counter, atomic_load_explicit(counter, memory_order_relaxed) + 1, memory_order_relaxed);
+}
+
+static int push(struct deque * d, struct task * t) {
+    long b = atomic_load_explicit(&d->bottom, memory_order_relaxed);
+    long top = atomic_load_explicit(&d->top, memory_order_acquire);
+    if (b - top >= DEQUE_SIZE) {
+        return 0;
+    }
+
+    atomic_store_explicit(&d->buffer[b & (DEQUE_SIZE - 1)], t, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    atomic_store_explicit(&d->bottom, b + 1, memory_order_relaxed);
+    return 1;
+}
+
+static struct task * take(struct deque * d) {
+    long b = atomic_load_explicit(&d->bottom, memory_order_relaxed) - 1;
+    atomic_store_explicit(&d->bottom, b, memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst);
+    long top = atomic_load_explicit(&d->top, memory_order_relaxed);
+
+    if (top > b) {
+        atomic_store_explicit(&d->bottom, b + 1, memory_order_relaxed);
+        return NULL;
+    }
+
+    struct task * t = atomic_load_explicit(&d->buffer[b & (DEQUE_SIZE - 1)], memory_order_relaxed);
+    if (top == b) {
+        /* Last task, racing with the thieves for it */
+        if (!atomic_compare_exchange_strong_explicit(&d->top, &top, top + 1,
+                memory_order_seq_cst, memory_order_relaxed)) {
+            t = NULL;
+        }
+        atomic_store_explicit(&d->bottom, b + 1, memory_order_relaxed);
+    }
+    return t;
+}
+
+static struct task * steal(struct deque * d) {
+    long top = atomic_load_explicit(&d->top, memory_order_acquire);
+    atomic_thread_fence(memory_order_seq_cst);
+    long b = atomic_load_explicit(&d->bottom, memory_order_acquire);
+    if (top >= b) {
+        return NULL;
+    }
+
+    struct task * t = atomic_load_explicit(&d->buffer[top & (DEQUE_SIZE - 1)], memory_order_relaxed);
+    if (!atomic_compare_exchange_strong_explicit(&d->top, &top, top + 1,
+            memory_order_seq_cst, memory_order_relaxed)) {
+        return NULL;
+    }
+    return t;
+}
+
+/* Tasks in the deque, exact only for the owner */
+static long backlog(struct deque * d) {
+    return atomic_load_explicit(&d->bottom, memory_order_relaxed)
+         - atomic_load_explicit(&d->top, memory_order_relaxed);
+}
+
+/* Own task, or a stolen one from randomly chosen victims */
+static struct task * find_task(void) {
+    struct task * t = take(&self->deque);
+    if (t != NULL || worker_count == 1) {
+        return t;
+    }
+
+    for (int attempt = 0; attempt < 2 * worker_count; attempt++) {
+        self->seed = self->seed * 1103515245u + 12345u;
+        struct worker * victim = &workers[(self->seed >> 16) % (unsigned int) worker_count];
+        if (victim != self && (t = steal(&victim->deque)) != NULL) {
+            bump(&self->counters.steals);
+            return t;
+        }
+    }
+    return NULL;
+}
+
+static void run_task(struct task * t) {
+    bump(&self->counters.tasks);
+    t->run(t);
+}
+
+static void * worker_main(void * arg) {
+    self = arg;
+    for (;;) {
+        struct task * t = find_task();
+        if (t != NULL) {
+            run_task(t);
+            continue;
+        }
+
+        if (atomic_load(&active) > 0) {
+            sched_yield();
+            continue;
+        }
+
+        pthread_mutex_lock(&sleep_lock);
+        while (atomic_load(&active) == 0) {
+            pthread_cond_wait(&sleep_cond, &sleep_lock);
+        }
+        pthread_mutex_unlock(&sleep_lock);
+    }
+    return NULL;
+}
+
+static void print_stats(void) {
+    long total[4] = { 0, 0, 0, 0 };
+    for (int i = 0; i < worker_count; i++) {
+        const struct counters * c = &workers[i].counters;
+        long row[4] = { atomic_load(&c->tasks), atomic_load(&c->steals),
+                        atomic_load(&c->spawns), atomic_load(&c->inlined) };
+        fprintf(stderr, "worker %3d: tasks %10ld, steals %10ld, spawns %10ld, inlined %10ld\n",
+                i, row[0], row[1], row[2], row[3]);
+        for (int k = 0; k < 4; k++) {
+            total[k] += row[k];
+        }
+    }
+    fprintf(stderr, "total     : tasks %10ld, steals %10ld, spawns %10ld, inlined %10ld\n",
+            total[0], total[1], total[2], total[3]);
+}
+
+static void pool_init(void) {
+    const char * env = getenv("MILA_WORKERS");
+    worker_count = env != NULL ? atoi(env) : get_nprocs();
+    if (worker_count < 1) {
+        worker_count = 1;
+    }
+    if (worker_count > MAX_WORKERS) {
+        worker_count = MAX_WORKERS;
+    }
+
+    /* Enough levels for a task per worker, and some more to balance the load */
+    const char * depth = getenv("MILA_SPAWN_DEPTH");
+    int levels = 0;
+    while ((1 << levels) < worker_count) {
+        levels++;
+    }
+    spawn_cutoff = depth != NULL ? atoi(depth) : levels + SPAWN_SLACK;
+
+    workers = calloc((size_t) worker_count, sizeof(struct worker));
+    if (workers == NULL) {
+        worker_count = 1;
+        return;
+    }
+
+    for (int i = 0; i < worker_count; i++) {
+        workers[i].seed = 2654435761u * (unsigned int) (i + 1);
+    }
+    self = &workers[0];
+
+    if (getenv("MILA_STATS") != NULL) {
+        atexit(print_stats);
+    }
+
+    for (int i = 1; i < worker_count; i++) {
+        pthread_t thread;
+        pthread_attr_t attr;
+        pthread_attr_init(&attr);
+        pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+        if (pthread_create(&thread, &attr, worker_main, &workers[i]) != 0) {
+            worker_count = i;
+        }
+        pthread_attr_destroy(&attr);
+    }
+}
+
+/* Number of workers running the parallel loops and spawned calls */
+int mila_workers(void) {
+    pthread_once(&pool_once, pool_init);
+    return worker_count;
+}
+
+/* Counters of a worker, 0 if there is no such worker */
+int mila_worker_stats(int worker, long * tasks, long * steals, long * spawns, long * inlined) {
+    pthread_once(&pool_once, pool_init);
+    if (worker < 0 || worker >= worker_count || workers == NULL) {
+        return 0;
+    }
+
+    const struct counters * c = &workers[worker].counters;
+    *tasks = atomic_load(&c->tasks);
+    *steals = atomic_load(&c->steals);
+    *spawns = atomic_load(&c->spawns);
+    *inlined = atomic_load(&c->inlined);
+    return 1;
+}
+
+/* Run or steal tasks until the counter drops to zero */
+static void help_until_done(atomic_long * remaining) {
+    while (atomic_load_explicit(remaining, memory_order_acquire) > 0) {
+        struct task * t = find_task();
+        if (t != NULL) {
+            run_task(t);
+        } else {
+            sched_yield();
+        }
+    }
+}
+
+/* Parallel loops */
+
+struct loop {
+    mila_body body;
+    void ** env;
+    int count;
+    const int * ops;
+
+    /* Ranges up to this many iterations aren't split */
+    long grain;
+
+    pthread_mutex_t lock;
+    int * results;
+
+    /* Iterations not done yet, the loop is over at zero */
+    atomic_long remaining;
+};
+
+struct range {
+    struct task task;
+    struct loop * loop;
+    int lo;
+    int hi;
+};
+
+static int identity(int op) {
+    switch (op) {
+    case REDUCE_MIN:
+        return INT_MAX;
+    case REDUCE_MAX:
+        return INT_MIN;
+    default:
+        return 0;
+    }
+}
+
+static int combine(int op, int a, int b) {
+    switch (op) {
+    case REDUCE_MIN:
+        return a < b ? a : b;
+    case REDUCE_MAX:
+        return a > b ? a : b;
+    default:
+        return (int) ((unsigned int) a + (unsigned int) b);
+    }
+}
+
+static void run_iterations(struct loop * loop, int lo, int hi) {
+    int partial[loop->count + 1];
+    for (int k = 0; k < loop->count; k++) {
+        partial[k] = identity(loop->ops[k]);
+    }
+
+    loop->body(loop->env, lo, hi, partial);
+
+    if (loop->count > 0) {
+        pthread_mutex_lock(&loop->lock);
+        for (int k = 0; k < loop->count; k++) {
+            loop->results[k] = combine(loop->ops[k], loop->results[k], partial[k]);
+        }
+        pthread_mutex_unlock(&loop->lock);
+    }
+
+    /* Last access to the loop, its caller may return right after */
+    atomic_fetch_sub_explicit(&loop->remaining, (long) hi - lo + 1, memory_order_release);
+}
+
+static void run_range(struct task * t) {
+    struct range * r = (struct range *) t;
+    struct loop * loop = r->loop;
+    int lo = r->lo;
+    int hi = r->hi;
+    free(r);
+
+    /* Lazy splitting, the upper halves are left for the thieves */
+    while ((long) hi - lo + 1 > loop->grain) {
+        int mid = (int) (lo + ((long) hi - lo) / 2);
+
+        struct range * upper = malloc(sizeof(struct range));
+        if (upper == NULL) {
+            break;
+        }
+        *upper = (struct range) { { run_range }, loop, mid + 1, hi };
+        if (!push(&self->deque, &upper->task)) {
+            free(upper);
+            break;
+        }
+        hi = mid;
+    }
+
+    run_iterations(loop, lo, hi);
+}
+
+void mila_parallel_for(mila_body body, void ** env, int lo, int hi, int count, const int * ops, int * results) {
+    if (lo > hi) {
+        return;
+    }
+
+    pthread_once(&pool_once, pool_init);
+
+    struct loop loop = { body, env, count, ops, 1, PTHREAD_MUTEX_INITIALIZER, results, 0 };
+    long n = (long) hi - lo + 1;
+    atomic_store(&loop.remaining, n);
+
+    /* Only the thread that started the pool and the workers can take part */
+    if (worker_count == 1 || self == NULL) {
+        run_iterations(&loop, lo, hi);
+        return;
+    }
+
+    loop.grain = n / (PIECES_PER_WORKER * worker_count);
+    if (loop.grain < 1) {
+        loop.grain = 1;
+    }
+
+    struct range * root = malloc(sizeof(struct range));
+    if (root == NULL) {
+        run_iterations(&loop, lo, hi);
+        return;
+    }
+    *root = (struct range) { { run_range }, &loop, lo, hi };
+
+    activate();
+    bump(&self->counters.tasks);
+    run_range(&root->task);
+
+    /* Helping with any work, including other loops, until this one is done */
+    help_until_done(&loop.remaining);
+
+    deactivate();
+    pthread_mutex_destroy(&loop.lock);
+}
+
+/* Spawned calls */
+
+struct spawned {
+    struct task task;
+    mila_thunk thunk;
+
+    /* Pending spawns of the frame that spawned the call */
+    atomic_long * frame;
+    int depth;
+
+    /* Copy of the arguments, aligned for any of them */
+    _Alignas(16) unsigned char data[];
+};
+
+static void run_spawned(struct task * t) {
+    struct spawned * s = (struct spawned *) t;
+    atomic_long * frame = s->frame;
+
+    int depth = self->depth;
+    self->depth = s->depth;
+    s->thunk(s->data);
+    self->depth = depth;
+    free(s);
+
+    /* Publishes the result to the sync of the frame */
+    atomic_fetch_sub_explicit(frame, 1, memory_order_release);
+    deactivate();
+}
+
+/* Call the thunk, possibly on another worker, before the next sync of the frame.
+ * The data is copied, the caller may reuse it right away */
+void mila_spawn(atomic_long * frame, mila_thunk thunk, void * data, long size) {
+    pthread_once(&pool_once, pool_init);
+
+    /* Serial when there is no one to steal it, it is too small to be worth it,
+     * or the worker has enough tasks waiting for the thieves already */
+    if (worker_count == 1 || self == NULL || self->depth >= spawn_cutoff
+            || backlog(&self->deque) >= SPAWN_BACKLOG) {
+        if (self != NULL) {
+            bump(&self->counters.inlined);
+            self->depth++;
+        }
+        thunk(data);
+        if (self != NULL) {
+            self->depth--;
+        }
+        return;
+    }
+
+    struct spawned * s = malloc(sizeof(struct spawned) + (size_t) size);
+    if (s == NULL) {
+        bump(&self->counters.inlined);
+        thunk(data);
+        return;
+    }
+    s->task.run = run_spawned;
+    s->thunk = thunk;
+    s->frame = frame;
+    s->depth = self->depth + 1;
+    memcpy(s->data, data, (size_t) size);
+
+    atomic_fetch_add_explicit(frame, 1, memory_order_relaxed);
+    activate();
+    if (!push(&self->deque, &s->task)) {
+        /* Full deque, the task is run here like a stolen one */
+        run_task(&s->task);
+        return;
+    }
+    bump(&self->counters.spawns);
+}
+
+/* Wait for all calls spawned by the frame, working on other tasks meanwhile */
+void mila_sync(atomic_long * frame) {
+    if (atomic_load_explicit(frame, memory_order_acquire) == 0) {
+        return;
+    }
+    help_until_done(frame);
+}
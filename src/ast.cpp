@@ -32,6 +32,36 @@ namespace ast
             return "-";
         case UnaryOperator::OPERATOR::NOT:
             return "NOT";
+        case UnaryOperator::OPERATOR::CARD:
+            return "CARD";
+        default:
+            return "?";
+        }
+    }
+
+    std::string to_string ( ArrayReduction::OPERATOR op ){
+        switch (op) {
+        case ArrayReduction::OPERATOR::SUM:
+            return "SUM";
+        case ArrayReduction::OPERATOR::MIN:
+            return "MIN";
+        case ArrayReduction::OPERATOR::MAX:
+            return "MAX";
+        case ArrayReduction::OPERATOR::LENGTH:
+            return "LENGTH";
+        default:
+            return "?";
+        }
+    }
+
+    std::string to_string ( Variable::MODE mode ){
+        switch (mode) {
+        case Variable::MODE::VALUE:
+            return "VALUE";
+        case Variable::MODE::VAR:
+            return "VAR";
+        case Variable::MODE::CONST:
+            return "CONST";
         default:
             return "?";
         }
@@ -73,6 +103,8 @@ namespace ast
             return "OR";
         case BinaryOperator::OPERATOR::XOR:
             return "XOR";
+        case BinaryOperator::OPERATOR::IN:
+            return "IN";
         default:
             return "?";
         }
@@ -96,20 +128,33 @@ namespace ast
                 }
             },
             [level] (const ptr<Array>& arr) -> std::string{
-                return line ( "ARRAY:", level )
+                return line ( arr->packed ? "PACKED ARRAY:" : "ARRAY:", level )
                     + line ( "Of:", level + 1)
                     + to_string( arr->elementType, level+ 2)
                     + line ( "Low:", level + 1)
                     + to_string(arr->lowBound, level+2)
                     + line ( "High:", level + 1)
                     + to_string(arr->highBound, level+2);
+            },
+            [level] (const ptr<DynamicArray>& arr) -> std::string{
+                return line ( "DYNAMIC ARRAY:", level )
+                    + line ( "Of:", level + 1)
+                    + to_string( arr->elementType, level+ 2);
+            },
+            [level] (const ptr<Set>& set) -> std::string{
+                return line ( "SET:", level )
+                    + line ( "Low:", level + 1)
+                    + to_string(set->lowBound, level+2)
+                    + line ( "High:", level + 1)
+                    + to_string(set->highBound, level+2);
             }
         );
     }
 
     std::string to_string ( const Variable& var, size_t level )
     {
-        return line("VARIABLE:<'" + var.name + "'>", level )
+        auto mode = var.mode == Variable::MODE::VALUE ? "" : " " + to_string( var.mode );
+        return line("VARIABLE:<'" + var.name + "'>" + mode, level )
             + line("Type", level + 1)
             + to_string( var.type, level+2 );
     }
@@ -131,6 +176,15 @@ namespace ast
 
     /*****************************************************************/
 
+    std::string to_string ( const ArraySlice& slice, size_t level )
+    {
+        return line("SLICE <" + slice.array + ">", level)
+            + line("Low:", level+1)
+            + to_string(slice.low, level+2)
+            + line("High:", level+1)
+            + to_string(slice.high, level+2);
+    }
+
     std::string to_string ( const Expression& expr, size_t level )
     {
         return wrap( expr ).visit(
@@ -142,11 +196,28 @@ namespace ast
             },
             [level]( ptr<ArrayAccess> arr ){
                 return line("ARRAY_ACCESS <" + arr->array + ">", level)
-                    + to_string(arr->value, level+1);
+                    + to_string(arr->indexes, level+1);
+            },
+            [level]( ptr<ArraySlice> slice ){
+                return to_string(*slice, level);
+            },
+            [level]( ptr<ArrayReduction> red ){
+                return line("REDUCTION <'" + to_string(red->op) + "'>", level)
+                    + to_string(red->array, level+1);
             },
             [level] (ptr<SubprogramCall> sub){
                 return to_string(*sub, level);
             },
+            [level] ( ptr<SetConstructor> set ){
+                std::string acc = line("SET", level);
+                for ( const auto& e : set->elements ){
+                    acc += to_string(e.first, level+1);
+                    if ( e.last.has_value() ){
+                        acc += line("To:", level+1) + to_string(e.last.value(), level+2);
+                    }
+                }
+                return acc;
+            },
             [level] ( ptr<UnaryOperator> unary ){
                 return line("UNARY <'" + to_string(unary->op) + "'>", level)
                     + to_string(unary->expression, level+1);
@@ -170,10 +241,20 @@ namespace ast
                 return line("ASSIGNEMENT <" + ass.variable + ">", level)
                     + to_string( ass.value, level+1 );
             },
+            [level] ( const SliceAssignment& slice_ass ){
+                return line("SLICE ASSIGNEMENT", level)
+                    + to_string(slice_ass.slice, level+1)
+                    + line("Value:", level+1)
+                    + to_string(slice_ass.value, level+2);
+            },
+            [level] ( const SetLength& set_len ){
+                return line("SET LENGTH <" + set_len.array.identifier + ">", level)
+                    + to_string(set_len.length, level+1);
+            },
             [level] ( const ArrayAssignment& arr_ass ){
                 return line("ARRAY ASSIGNEMENT <" + arr_ass.array + ">", level)
                     + line("At:", level+1)
-                    + to_string(arr_ass.position, level+2)
+                    + to_string(arr_ass.indexes, level+2)
                     + line("Value:", level+1)
                     + to_string(arr_ass.value, level+2);
             },
@@ -186,6 +267,14 @@ namespace ast
             [level]( const BreakStatement& ) -> std::string {
                 return line("BREAK", level);
             },
+            [level]( const Spawn& spawn ){
+                std::string into = spawn.variable.has_value() ? " INTO <" + spawn.variable.value() + ">" : "";
+                return line("SPAWN <" + spawn.call.functionName + ">" + into, level)
+                    + to_string(spawn.call.arguments, level+1);
+            },
+            [level]( const SyncStatement& ) -> std::string {
+                return line("SYNC", level);
+            },
             [level] ( ptr<Block> block ){
                 return line("BLOCK:", level)
                     + to_string(block->statements, level+1);
@@ -225,7 +314,26 @@ namespace ast
                         break;
                 }
 
-                return line(std::string("FOR:") + "<" + for_->loopVariable + ">", level)
+                std::string reductions {};
+                if ( for_->parallel.has_value() ){
+                    for ( const auto& r : for_->parallel->reductions ){
+                        switch ( r.op ){
+                            case Reduction::OPERATOR::SUM:
+                                reductions += line( "Reduce: <SUM> <" + r.variable + ">", level+1 );
+                                break;
+                            case Reduction::OPERATOR::MIN:
+                                reductions += line( "Reduce: <MIN> <" + r.variable + ">", level+1 );
+                                break;
+                            case Reduction::OPERATOR::MAX:
+                                reductions += line( "Reduce: <MAX> <" + r.variable + ">", level+1 );
+                                break;
+                        }
+                    }
+                }
+
+                std::string kind = for_->parallel.has_value() ? "PARALLEL FOR:" : "FOR:";
+                return line(kind + "<" + for_->loopVariable + ">", level)
+                    + reductions
                     + line( "Init:", level+1 )
                     + to_string( for_->initialization, level+2 )
                     + line( "Dir: <" + dir_str + ">", level+1 )
@@ -288,5 +396,252 @@ namespace ast
             + to_string ( make_ptr<Block>(program.code), 1 );
     }
 
-}
+    /*****************************************************************/
+
+    template <typename T>
+    size_t node_count ( const Many<T>& many )
+    {
+        size_t acc = 0;
+
+        for ( const auto& i : many ){
+            acc += node_count( i );
+        }
+
+        return acc;
+    }
+
+    size_t node_count ( const Variable& var )
+    {
+        return 1 + node_count( var.type );
+    }
+
+    size_t node_count ( const Block& block )
+    {
+        return 1 + node_count( block.statements );
+    }
+
+    size_t node_count ( const Type& type )
+    {
+        return wrap( type ).visit(
+            []( const SimpleType& ) -> size_t {
+                return 1;
+            },
+            []( ptr<Array> arr ){
+                return 1 + node_count( arr->lowBound )
+                    + node_count( arr->highBound )
+                    + node_count( arr->elementType );
+            },
+            []( ptr<DynamicArray> arr ){
+                return 1 + node_count( arr->elementType );
+            },
+            []( ptr<Set> set ){
+                return 1 + node_count( set->lowBound ) + node_count( set->highBound );
+            }
+        );
+    }
+
+    size_t node_count ( const Expression& expr )
+    {
+        return wrap( expr ).visit(
+            []( const VariableAccess& ) -> size_t {
+                return 1;
+            },
+            []( const ConstantExpression& ) -> size_t {
+                return 1;
+            },
+            []( ptr<ArrayAccess> arr ){
+                return 1 + node_count( arr->indexes );
+            },
+            []( ptr<ArraySlice> slice ){
+                return 1 + node_count( slice->low ) + node_count( slice->high );
+            },
+            []( ptr<ArrayReduction> red ){
+                return 1 + node_count( red->array );
+            },
+            []( ptr<SubprogramCall> sub ){
+                return 1 + node_count( sub->arguments );
+            },
+            []( ptr<SetConstructor> set ){
+                size_t count = 1;
+                for ( const auto& e : set->elements ){
+                    count += node_count( e.first ) + ( e.last.has_value() ? node_count( e.last.value() ) : 0 );
+                }
+                return count;
+            },
+            []( ptr<UnaryOperator> unary ){
+                return 1 + node_count( unary->expression );
+            },
+            []( ptr<BinaryOperator> bin ){
+                return 1 + node_count( bin->left ) + node_count( bin->right );
+            }
+        );
+    }
 
+    size_t node_count ( const Statement& stmt )
+    {
+        return wrap( stmt ).visit(
+            []( const SubprogramCall& sub ){
+                return 1 + node_count( sub.arguments );
+            },
+            []( const Assignment& ass ){
+                return 1 + node_count( ass.value );
+            },
+            []( const ArrayAssignment& arr_ass ){
+                return 1 + node_count( arr_ass.indexes ) + node_count( arr_ass.value );
+            },
+            []( const SliceAssignment& slice_ass ){
+                return 2 + node_count( slice_ass.slice.low )
+                    + node_count( slice_ass.slice.high )
+                    + node_count( slice_ass.value );
+            },
+            []( const SetLength& set_len ){
+                return 2 + node_count( set_len.length );
+            },
+            []( const EmptyStatement& ) -> size_t {
+                return 1;
+            },
+            []( const ExitStatement& ) -> size_t {
+                return 1;
+            },
+            []( const BreakStatement& ) -> size_t {
+                return 1;
+            },
+            []( const Spawn& spawn ){
+                return 2 + node_count( spawn.call.arguments );
+            },
+            []( const SyncStatement& ) -> size_t {
+                return 1;
+            },
+            []( ptr<Block> block ){
+                return node_count( *block );
+            },
+            []( ptr<If> if_ ){
+                return 1 + node_count( if_->condition )
+                    + node_count( if_->trueCode )
+                    + ( if_->elseCode.has_value() ? node_count( if_->elseCode.value() ) : 0 );
+            },
+            []( ptr<While> while_ ){
+                return 1 + node_count( while_->condition ) + node_count( while_->code );
+            },
+            []( ptr<For> for_ ){
+                size_t reductions = for_->parallel.has_value() ? for_->parallel->reductions.size() : 0;
+                return 1 + reductions + node_count( for_->initialization )
+                    + node_count( for_->target )
+                    + node_count( for_->code );
+            }
+        );
+    }
+
+    size_t node_count ( const Global& global )
+    {
+        return wrap( global ).visit(
+            []( const ProcedureDecl& decl ){
+                return 1 + node_count( decl.parameters );
+            },
+            []( const FunctionDecl& decl ){
+                return 1 + node_count( decl.parameters ) + node_count( decl.returnType );
+            },
+            []( const Procedure& proc ){
+                return 1 + node_count( proc.parameters )
+                    + node_count( proc.variables )
+                    + node_count( proc.code );
+            },
+            []( const Function& fun ){
+                return 1 + node_count( fun.parameters )
+                    + node_count( fun.returnType )
+                    + node_count( fun.variables )
+                    + node_count( fun.code );
+            },
+            []( const NamedConstant& named ){
+                return 1 + node_count( named.value );
+            },
+            []( const Variable& var ){
+                return node_count( var );
+            }
+        );
+    }
+
+    size_t node_count ( const Program& program )
+    {
+        return 1 + node_count( program.globals ) + node_count( program.code );
+    }
+
+    /*****************************************************************/
+
+    std::optional<Location> location ( const Statement& stmt )
+    {
+        return wrap( stmt ).visit(
+            []( const EmptyStatement& ) -> std::optional<Location> {
+                return std::nullopt;
+            },
+            []( const ptr<Block>& ) -> std::optional<Location> {
+                return std::nullopt;
+            },
+            []<typename T>( const ptr<T>& st ) -> std::optional<Location> {
+                return st->location;
+            },
+            []( const auto& st ) -> std::optional<Location> {
+                return st.location;
+            }
+        );
+    }
+
+    Many<const Array*> dimensions ( const Type& type )
+    {
+        Many<const Array*> dims {};
+        for ( auto t = &type; std::holds_alternative<ptr<Array>>( *t ); t = &dims.back()->elementType ){
+            dims.push_back( std::get<ptr<Array>>( *t ).get() );
+        }
+        return dims;
+    }
+
+    const Type& element_type ( const Type& type )
+    {
+        if ( auto dyn = std::get_if<ptr<DynamicArray>>( &type ) ){
+            return (*dyn)->elementType;
+        }
+
+        auto t = &type;
+        while ( auto arr = std::get_if<ptr<Array>>( t ) ){
+            t = &(*arr)->elementType;
+        }
+        return *t;
+    }
+
+    bool array_type ( const Type& type )
+    {
+        return std::holds_alternative<ptr<Array>>( type ) || std::holds_alternative<ptr<DynamicArray>>( type );
+    }
+
+    bool packed ( const Type& type )
+    {
+        auto arr = std::get_if<ptr<Array>>( &type );
+        return arr != nullptr && (*arr)->packed;
+    }
+
+    Many<const Expression*> values ( const SetConstructor& set )
+    {
+        Many<const Expression*> acc {};
+        for ( const auto& e : set.elements ){
+            acc.push_back( &e.first );
+            if ( e.last.has_value() ){
+                acc.push_back( &e.last.value() );
+            }
+        }
+        return acc;
+    }
+
+    const std::optional<Symbol>* addressable ( const Expression& expr )
+    {
+        if ( auto va = std::get_if<VariableAccess>( &expr ) ){
+            return &va->symbol;
+        }
+
+        auto arr = std::get_if<ptr<ArrayAccess>>( &expr );
+        if ( arr == nullptr || packed( (*arr)->symbol->type.value() ) ){
+            return nullptr;
+        }
+        return &(*arr)->symbol;
+    }
+
+}
@@ -24,6 +24,13 @@ namespace ast
         return std::shared_ptr<T>( new T { args... } );
     }
 
+    /// Position in the source, lines and columns are numbered from 1, 0 is unknown
+    struct Location
+    {
+        size_t line = 0;
+        size_t column = 0;
+    };
+
     /***********************************/
     // Constants
 
@@ -43,12 +50,49 @@ namespace ast
 
     using Constant = std::variant<BooleanConstant, IntegerConstant>;
 
+    /***********************************/
+    // Types, arrays are defined after expressions they use as bounds
+
+    enum class SimpleType
+    {
+        INTEGER, BOOLEAN
+    };
+
+    struct Array;
+    struct DynamicArray;
+    struct Set;
+    using Type = std::variant<SimpleType, ptr<Array>, ptr<DynamicArray>, ptr<Set>>;
+
+    /***********************************/
+    // Symbols
+
+    /// What an identifier refers to, filled in by the semantic analysis
+    struct Symbol
+    {
+        enum class SCOPE
+        {
+            /// Index into Program::globals, past the end is main
+            GLOBAL,
+            /// Index into the subprogram slots: parameters, variables and the result
+            LOCAL,
+            /// Index into sema::builtins()
+            BUILTIN
+        };
+
+        SCOPE scope;
+        size_t index;
+
+        /// Type of the value, return type of subprograms, nullopt for procedures
+        std::optional<Type> type;
+    };
+
     /***********************************/
     // Expressions
 
     struct VariableAccess
     {
         Identifier identifier;
+        std::optional<Symbol> symbol = std::nullopt;
     };
 
     struct ConstantExpression
@@ -57,33 +101,90 @@ namespace ast
     };
 
     struct ArrayAccess;
+    struct ArraySlice;
+    struct ArrayReduction;
     struct SubprogramCall;
+    struct SetConstructor;
 
     struct UnaryOperator;
     struct BinaryOperator;
 
     using Expression = std::variant<
         VariableAccess, ConstantExpression,
-        ptr<ArrayAccess>, ptr<SubprogramCall>,
+        ptr<ArrayAccess>, ptr<ArraySlice>, ptr<ArrayReduction>,
+        ptr<SubprogramCall>, ptr<SetConstructor>,
         ptr<UnaryOperator>, ptr<BinaryOperator>>;
 
+    /// Element of an array, one index per dimension
     struct ArrayAccess
     {
         Identifier array;
-        Expression value;
+        Many<Expression> indexes;
+        std::optional<Symbol> symbol = std::nullopt;
+    };
+
+    /// `A[l..h]`, the elements l to h of the first dimension of an array, with all their later dimensions
+    struct ArraySlice
+    {
+        Identifier array;
+        Expression low;
+        Expression high;
+        std::optional<Symbol> symbol = std::nullopt;
+    };
+
+    /**
+     * `sum(A)`, `min(A)` or `max(A)` of all elements of an integer array
+     * or a slice of it, or `length(A)` of any array. The parser gives a
+     * call, the semantic analysis replaces it unless the name is declared
+     * by the program. An empty slice sums to 0, its min is maxint and its
+     * max is -maxint - 1
+     */
+    struct ArrayReduction
+    {
+        enum class OPERATOR
+        {
+            SUM, MIN, MAX,
+            /// Number of elements of the first dimension
+            LENGTH
+        };
+
+        OPERATOR op;
+
+        /// VariableAccess of the array or ptr<ArraySlice>
+        Expression array;
     };
 
     struct SubprogramCall
     {
         Identifier functionName;
         Many<Expression> arguments;
+        Location location {};
+        std::optional<Symbol> symbol = std::nullopt;
+    };
+
+    /// Single value or a range `first..last` of a set constructor
+    struct SetElement
+    {
+        Expression first;
+        std::optional<Expression> last = std::nullopt;
+    };
+
+    /// `[a, b..c]`, the set of the listed values
+    struct SetConstructor
+    {
+        Many<SetElement> elements;
+
+        /// Set type of the value, given by the context of the constructor during the semantic analysis
+        std::optional<Type> type = std::nullopt;
     };
 
     struct UnaryOperator
     {
         enum class OPERATOR
         {
-            PLUS, MINUS, NOT
+            PLUS, MINUS, NOT,
+            /// Number of elements of a set
+            CARD
         };
 
         OPERATOR op;
@@ -98,7 +199,9 @@ namespace ast
             LESS_EQ, LESS, MORE_EQ, MORE,
             PLUS, MINUS, TIMES, DIVISION,
             INTEGER_DIVISION, MODULO,
-            AND, OR, XOR
+            AND, OR, XOR,
+            /// Membership of an integer in a set
+            IN
         };
 
         OPERATOR op;
@@ -113,24 +216,75 @@ namespace ast
     {
         Identifier variable;
         Expression value;
+        Location location {};
+        std::optional<Symbol> symbol = std::nullopt;
     };
 
     struct ArrayAssignment
     {
         Identifier array;
-        Expression position;
+        Many<Expression> indexes;
+        Expression value;
+        Location location {};
+        std::optional<Symbol> symbol = std::nullopt;
+    };
+
+    /**
+     * `A[l..h] := e`, copy of a slice or a whole array of the same length
+     * and element type, or a fill of the slice by an element value. Whole
+     * arrays are assigned in the same ways by an Assignment
+     */
+    struct SliceAssignment
+    {
+        ArraySlice slice;
         Expression value;
+        Location location {};
+    };
+
+    /**
+     * `setlength(A, n)` of a dynamic array, its first elements are kept
+     * and the new ones are zero. The parser gives a call, the semantic
+     * analysis replaces it unless the name is declared by the program
+     */
+    struct SetLength
+    {
+        VariableAccess array;
+        Expression length;
+        Location location {};
     };
 
     struct ExitStatement
-    {};
+    {
+        Location location {};
+    };
 
     struct BreakStatement
-    {};
+    {
+        Location location {};
+    };
 
     struct EmptyStatement
     {};
 
+    /// `spawn` call, it may run concurrently with the caller until the next `sync`
+    struct Spawn
+    {
+        SubprogramCall call;
+
+        /// Variable receiving the result of a spawned function, nullopt for procedures
+        std::optional<Identifier> variable;
+        Location location {};
+
+        /// Symbol of the variable
+        std::optional<Symbol> symbol = std::nullopt;
+    };
+
+    /// Waits for all calls spawned by the running subprogram
+    struct SyncStatement
+    {
+        Location location {};
+    };
+
     struct Block;
     struct If;
     struct While;
@@ -138,8 +292,9 @@ namespace ast
 
     using Statement = std::variant<
         SubprogramCall,
-        Assignment, ArrayAssignment,
+        Assignment, ArrayAssignment, SliceAssignment, SetLength,
         ExitStatement, BreakStatement, EmptyStatement,
+        Spawn, SyncStatement,
         ptr<Block>, ptr<If>, ptr<While>, ptr<For>>;
 
     struct Block
@@ -152,15 +307,39 @@ namespace ast
         Expression condition;
         Statement trueCode;
         std::optional<Statement> elseCode;
+        Location location {};
     };
 
     struct While
     {
         Expression condition;
         Statement code;
+        Location location {};
+    };
+
+    /// Private copies of a variable in a parallel for are combined into it at the end
+    struct Reduction
+    {
+        enum class OPERATOR
+        {
+            SUM, MIN, MAX
+        };
+
+        OPERATOR op;
+        Identifier variable;
+        std::optional<Symbol> symbol = std::nullopt;
+    };
+
+    /// Iterations of a `parallel for` may run concurrently on the runtime's workers
+    struct Parallel
+    {
+        Many<Reduction> reductions;
     };
 
-    // `for` loopVariable `:=` initialization direction target `do` code
+    // [`parallel`] `for` loopVariable `:=` initialization direction target [`reduce` op variable, ...] `do` code
+    /// After the loop the variable holds the first value that fails the test, bound + 1 (bound - 1
+    /// for downto) or the start when the body never runs, break leaves it at the value of its iteration.
+    /// The body of a parallel for has a private copy of the variable, which it can't change
     struct For
     {
         enum class DIRECTION
@@ -173,24 +352,55 @@ namespace ast
         DIRECTION direction;
         Expression target;
         Statement code;
+        Location location {};
+
+        /// Symbol of the loop variable
+        std::optional<Symbol> symbol = std::nullopt;
+
+        /// Set for a parallel for, nullopt for a serial one
+        std::optional<Parallel> parallel = std::nullopt;
+
+        /**
+         * The body of a serial for may change the variable, by an assignment,
+         * as a var argument or in a called subprogram. The next iteration
+         * then continues from the value the variable has after the body
+         */
+        bool written = false;
     };
 
     /***********************************/
     // Types
-    enum class SimpleType
+
+    /// `array [a..b, c..d] of T` is the same as `array [a..b] of array [c..d] of T`,
+    /// it is stored as a single block in row-major order
+    struct Array
     {
-        INTEGER, BOOLEAN
+    public:
+        Expression lowBound;
+        Expression highBound;
+        Type elementType;
+
+        /// `packed array of boolean`, elements are single bits of 64 bit words
+        bool packed = false;
     };
 
-    struct Array;
-    using Type = std::variant<SimpleType, ptr<Array>>;
+    /**
+     * `array of T`, indexed from 0 to its length - 1. The elements are
+     * allocated by `setlength` in the arena of the subprogram declaring
+     * the variable, which is released when the subprogram returns
+     */
+    struct DynamicArray
+    {
+    public:
+        Type elementType;
+    };
 
-    struct Array
+    /// `set of a..b`, a bitset of the integers in the range
+    struct Set
     {
     public:
         Expression lowBound;
         Expression highBound;
-        Type elementType;
     };
 
     /***********************************/
@@ -198,8 +408,21 @@ namespace ast
 
     struct Variable
     {
+        /// How a parameter is passed, variables are VALUE
+        enum class MODE
+        {
+            /// A copy of the argument
+            VALUE,
+            /// `var`, the address of the argument, which is a variable the subprogram may assign
+            VAR,
+            /// `const`, the address of the argument, which the subprogram doesn't modify
+            CONST
+        };
+
         Identifier name;
         Type type;
+        Location location {};
+        MODE mode = MODE::VALUE;
     };
 
     struct NamedConstant
@@ -231,6 +454,7 @@ namespace ast
 
         Many<Variable> variables;
         Block code;
+        Location location {};
     };
 
     struct Function
@@ -241,6 +465,7 @@ namespace ast
 
         Many<Variable> variables;
         Block code;
+        Location location {};
     };
 
     /***********************************/
@@ -257,6 +482,7 @@ namespace ast
         Identifier name;
         Many<Global> globals;
         Block code;
+        Location location {};
     };
     /// @}
 
@@ -274,6 +500,42 @@ namespace ast
     std::string to_string ( const Program& program );
     /// @}
 
+    /**
+     * @brief \defgroup CountAst Number of AST nodes, used for compile time statistics
+     * @{
+     */
+    size_t node_count ( const Type& type );
+    size_t node_count ( const Expression& expr );
+    size_t node_count ( const Statement& stmt );
+    size_t node_count ( const Global& global );
+    size_t node_count ( const Program& program );
+    /// @}
+
+    /// Location of a statement, nullopt for blocks and empty statements
+    std::optional<Location> location ( const Statement& stmt );
+
+    /// Dimensions of an array type, outermost first, empty for simple types
+    Many<const Array*> dimensions ( const Type& type );
+
+    /// Type of the elements of a multidimensional or a dynamic array, the type itself for simple types
+    const Type& element_type ( const Type& type );
+
+    /// Whether a type is an array, with bounds or dynamic
+    bool array_type ( const Type& type );
+
+    /// Whether a type is a packed array
+    bool packed ( const Type& type );
+
+    /// Bounds of all elements of a set constructor in order, single values once
+    Many<const Expression*> values ( const SetConstructor& set );
+
+    /**
+     * Symbol of the variable an analyzed expression is stored in, a whole
+     * variable or an element of an array that isn't packed, nullptr for
+     * values that have no address
+     */
+    const std::optional<Symbol>* addressable ( const Expression& expr );
+
 }
 
 #endif // AST_HPP
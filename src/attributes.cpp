@@ -0,0 +1,466 @@
+#include "attributes.hpp"
+#include "sema.hpp"
+#include "variant_helpers.hpp"
+#include <algorithm>
+#include <map>
+#include <set>
+
+namespace attributes
+{
+    /// Effects of a single body, calls of other subprograms aside
+    struct Effects
+    {
+        /// Reads or writes global variables, or what var and const parameters refer to
+        bool reads = false;
+        bool writes = false;
+
+        /// Accesses global variables
+        bool globals = false;
+
+        /// Calls the runtime
+        bool io = false;
+
+        /// Has a while loop, which may not terminate
+        bool loops = false;
+
+        /// Divides or accesses an array, which may trap or be undefined
+        bool traps = false;
+
+        /// Indexes of the first declarations of the called subprograms
+        std::set<size_t> callees {};
+    };
+
+    /// Walks a body collecting its effects
+    class EffectsVisitor
+    {
+    private:
+        const Program& m_Program;
+
+        /// Array accesses are checked, calling the runtime when out of bounds
+        bool m_CheckedArrays;
+
+        /// Slots of the var and const parameters of the body
+        std::set<size_t> m_References {};
+
+    public:
+        Effects m_Effects {};
+
+        EffectsVisitor ( const Program& program, bool checkedArrays, const Many<Variable>& parameters )
+        : m_Program { program }
+        , m_CheckedArrays { checkedArrays }
+        {
+            for ( size_t i = 0; i < parameters.size(); ++i ){
+                if ( parameters[i].mode != Variable::MODE::VALUE ){
+                    m_References.insert( i );
+                }
+            }
+        }
+
+        /// Local variables, arrays too big for the stack are allocated by the runtime, which exits when out of memory
+        void locals ( const Many<Variable>& variables, unsigned stackArrays )
+        {
+            for ( const auto& v : variables ){
+                if ( std::holds_alternative<ptr<Array>>( v.type ) && sema::array_size( m_Program, v.type ) > stackArrays ){
+                    m_Effects.io = true;
+                }
+            }
+        }
+
+        /// Global variable (not a constant or a subprogram) a symbol refers to
+        bool global_variable ( const std::optional<Symbol>& symbol ) const
+        {
+            return symbol.has_value()
+                && symbol->scope == Symbol::SCOPE::GLOBAL
+                && symbol->index < m_Program.globals.size()
+                && std::holds_alternative<Variable>( m_Program.globals[symbol->index] );
+        }
+
+        /// Memory outside of the locals of the body, a global variable or what a var or const parameter refers to,
+        /// accesses of global variables are recorded so it has to be evaluated first
+        bool shared ( const std::optional<Symbol>& symbol )
+        {
+            if ( global_variable( symbol ) ){
+                m_Effects.globals = true;
+                return true;
+            }
+            return symbol.has_value() && symbol->scope == Symbol::SCOPE::LOCAL && m_References.count( symbol->index ) > 0;
+        }
+
+        void call ( const SubprogramCall& sub )
+        {
+            if ( sub.symbol.has_value() && sub.symbol->scope == Symbol::SCOPE::GLOBAL ){
+                m_Effects.callees.insert( sub.symbol->index );
+            }
+            else {
+                m_Effects.io = true;
+            }
+
+            for ( const auto& a : sub.arguments ){
+                expr( a );
+            }
+        }
+
+        void expr ( const Expression& e )
+        {
+            wrap( e ).visit(
+                [this]( const VariableAccess& va ){
+                    m_Effects.reads = shared( va.symbol ) || m_Effects.reads;
+                },
+                []( const ConstantExpression& ){},
+                [this]( const ptr<ArrayAccess>& arr ){
+                    m_Effects.reads = shared( arr->symbol ) || m_Effects.reads;
+                    m_Effects.traps = true;
+                    m_Effects.io = m_Effects.io || m_CheckedArrays;
+                    for ( const auto& i : arr->indexes ){
+                        expr( i );
+                    }
+                },
+                [this]( const ptr<ArraySlice>& sl ){
+                    m_Effects.reads = shared( sl->symbol ) || m_Effects.reads;
+                    m_Effects.io = m_Effects.io || m_CheckedArrays;
+                    m_Effects.traps = m_Effects.traps || m_CheckedArrays;
+                    expr( sl->low );
+                    expr( sl->high );
+                },
+                [this]( const ptr<ArrayReduction>& red ){
+                    expr( red->array );
+                },
+                [this]( const ptr<SubprogramCall>& sub ){
+                    call( *sub );
+                },
+                [this]( const ptr<SetConstructor>& set ){
+                    for ( auto v : values( *set ) ){
+                        expr( *v );
+                    }
+                },
+                [this]( const ptr<UnaryOperator>& un ){
+                    expr( un->expression );
+                },
+                [this]( const ptr<BinaryOperator>& bin ){
+                    switch ( bin->op ) {
+                    case BinaryOperator::OPERATOR::DIVISION:
+                    case BinaryOperator::OPERATOR::INTEGER_DIVISION:
+                    case BinaryOperator::OPERATOR::MODULO:
+                        m_Effects.traps = true;
+                        break;
+                    default:
+                        break;
+                    }
+
+                    expr( bin->left );
+                    expr( bin->right );
+                }
+            );
+        }
+
+        void stat ( const Statement& s )
+        {
+            wrap( s ).visit(
+                [this]( const SubprogramCall& sub ){
+                    call( sub );
+                },
+                [this]( const Assignment& as ){
+                    m_Effects.writes = shared( as.symbol ) || m_Effects.writes;
+                    expr( as.value );
+                },
+                [this]( const ArrayAssignment& as ){
+                    m_Effects.writes = shared( as.symbol ) || m_Effects.writes;
+                    m_Effects.traps = true;
+                    m_Effects.io = m_Effects.io || m_CheckedArrays;
+                    for ( const auto& i : as.indexes ){
+                        expr( i );
+                    }
+                    expr( as.value );
+                },
+                [this]( const SliceAssignment& as ){
+                    m_Effects.writes = shared( as.slice.symbol ) || m_Effects.writes;
+                    m_Effects.io = m_Effects.io || m_CheckedArrays;
+                    m_Effects.traps = m_Effects.traps || m_CheckedArrays;
+                    expr( as.slice.low );
+                    expr( as.slice.high );
+                    expr( as.value );
+                },
+                [this]( const SetLength& sl ){
+                    // The elements are allocated by the runtime, which exits on negative lengths
+                    m_Effects.io = true;
+                    m_Effects.writes = shared( sl.array.symbol ) || m_Effects.writes;
+                    expr( sl.length );
+                },
+                []( const ExitStatement& ){},
+                []( const BreakStatement& ){},
+                []( const EmptyStatement& ){},
+                [this]( const Spawn& sp ){
+                    // Spawned calls and syncs go through the runtime
+                    m_Effects.io = true;
+                    m_Effects.writes = shared( sp.symbol ) || m_Effects.writes;
+                    call( sp.call );
+                },
+                [this]( const SyncStatement& ){
+                    m_Effects.io = true;
+                },
+                [this]( const ptr<Block>& bl ){
+                    for ( const auto& st : bl->statements ){
+                        stat( st );
+                    }
+                },
+                [this]( const ptr<If>& if_ ){
+                    expr( if_->condition );
+                    stat( if_->trueCode );
+                    if ( if_->elseCode.has_value() ){
+                        stat( if_->elseCode.value() );
+                    }
+                },
+                [this]( const ptr<While>& wh ){
+                    m_Effects.loops = true;
+                    expr( wh->condition );
+                    stat( wh->code );
+                },
+                [this]( const ptr<For>& fo ){
+                    // Counted loops terminate unless the body changes the variable,
+                    // parallel ones are run by the runtime
+                    m_Effects.loops = m_Effects.loops || fo->written;
+                    m_Effects.writes = shared( fo->symbol ) || m_Effects.writes;
+                    m_Effects.io = m_Effects.io || fo->parallel.has_value();
+                    expr( fo->initialization );
+                    expr( fo->target );
+                    stat( fo->code );
+                }
+            );
+        }
+    };
+
+    /// Tarjan's strongly connected components, emitted callees first
+    class Components
+    {
+    private:
+        const std::map<size_t, Effects>& m_Graph;
+
+        std::map<size_t, size_t> m_Index {};
+        std::map<size_t, size_t> m_Low {};
+        std::set<size_t> m_OnStack {};
+        std::vector<size_t> m_Stack {};
+        size_t m_Next = 0;
+
+    public:
+        std::vector<std::vector<size_t>> m_Components {};
+
+        Components ( const std::map<size_t, Effects>& graph )
+        : m_Graph { graph }
+        {
+            for ( const auto& [node, _] : m_Graph ){
+                if ( m_Index.count( node ) == 0 ){
+                    visit( node );
+                }
+            }
+        }
+
+    private:
+        void visit ( size_t node )
+        {
+            m_Index[node] = m_Low[node] = m_Next++;
+            m_Stack.push_back( node );
+            m_OnStack.insert( node );
+
+            for ( auto callee : m_Graph.at( node ).callees ){
+                if ( m_Index.count( callee ) == 0 ){
+                    visit( callee );
+                    m_Low[node] = std::min( m_Low[node], m_Low[callee] );
+                }
+                else if ( m_OnStack.count( callee ) > 0 ){
+                    m_Low[node] = std::min( m_Low[node], m_Index[callee] );
+                }
+            }
+
+            if ( m_Low[node] != m_Index[node] ){
+                return;
+            }
+
+            std::vector<size_t> component {};
+            size_t member;
+            do {
+                member = m_Stack.back();
+                m_Stack.pop_back();
+                m_OnStack.erase( member );
+                component.push_back( member );
+            } while ( member != node );
+
+            m_Components.push_back( component );
+        }
+    };
+
+    Table infer ( const Program& program, bool checkedArrays, unsigned stackArrays )
+    {
+        // Subprograms are identified by their first declaration, as by the symbols
+        std::map<Identifier, size_t> first {};
+        std::map<size_t, size_t> declaration {};
+        for ( size_t i = 0; i < program.globals.size(); ++i )
+        {
+            const auto& g = program.globals[i];
+            if ( std::holds_alternative<NamedConstant>( g ) || std::holds_alternative<Variable>( g ) ){
+                continue;
+            }
+
+            auto name = std::visit( []( const auto& decl ){ return decl.name; }, g );
+            declaration[i] = first.insert({ name, i }).first->second;
+        }
+
+        // Effects of the bodies, main is never called
+        std::map<size_t, Effects> graph {};
+        auto body = [&]( size_t index, const Many<Variable>& parameters, const Many<Variable>& variables, const Block& code ){
+            EffectsVisitor visitor { program, checkedArrays, parameters };
+            visitor.locals( variables, stackArrays );
+            for ( const auto& st : code.statements ){
+                visitor.stat( st );
+            }
+            graph[index] = visitor.m_Effects;
+        };
+
+        for ( size_t i = 0; i < program.globals.size(); ++i )
+        {
+            if ( auto proc = std::get_if<Procedure>( &program.globals[i] ) ){
+                body( declaration[i], proc->parameters, proc->variables, proc->code );
+            }
+            else if ( auto fun = std::get_if<Function>( &program.globals[i] ) ){
+                body( declaration[i], fun->parameters, fun->variables, fun->code );
+            }
+        }
+        body( program.globals.size(), {}, {}, program.code );
+
+        std::map<size_t, Attributes> inferred {};
+        for ( const auto& component : Components( graph ).m_Components )
+        {
+            bool recursive = component.size() > 1
+                || graph[component.front()].callees.count( component.front() ) > 0;
+
+            bool reads = false, writes = false, globals = false, io = false, loops = false, traps = false;
+            bool calleesReturn = true, calleesSpeculatable = true;
+            for ( auto node : component )
+            {
+                const auto& e = graph[node];
+                reads = reads || e.reads;
+                writes = writes || e.writes;
+                globals = globals || e.globals;
+                io = io || e.io;
+                loops = loops || e.loops;
+                traps = traps || e.traps;
+
+                // Callees outside of the component are already done
+                for ( auto callee : e.callees )
+                {
+                    auto c = inferred.find( callee );
+                    if ( c == inferred.end() ){
+                        continue;
+                    }
+
+                    reads = reads || c->second.memory == Attributes::MEMORY::READ;
+                    writes = writes || c->second.memory == Attributes::MEMORY::ANY;
+                    globals = globals || c->second.globals;
+                    calleesReturn = calleesReturn && c->second.willReturn;
+                    calleesSpeculatable = calleesSpeculatable && c->second.speculatable;
+                }
+            }
+
+            Attributes attrs {};
+            attrs.memory = writes || io
+                ? Attributes::MEMORY::ANY
+                : reads ? Attributes::MEMORY::READ : Attributes::MEMORY::NONE;
+            attrs.willReturn = ! recursive && ! loops && ! io && calleesReturn;
+            attrs.noRecurse = ! recursive;
+            attrs.globals = globals;
+            attrs.speculatable = attrs.memory == Attributes::MEMORY::NONE
+                && attrs.willReturn
+                && ! traps
+                && calleesSpeculatable;
+
+            for ( auto node : component ){
+                inferred[node] = attrs;
+            }
+        }
+
+        Table table ( program.globals.size() + 1 );
+        for ( const auto& [index, decl] : declaration ){
+            if ( auto i = inferred.find( decl ); i != inferred.end() ){
+                table[index] = i->second;
+            }
+        }
+        table.back() = inferred[program.globals.size()];
+
+        return table;
+    }
+
+    std::string to_string ( const Attributes& attrs )
+    {
+        std::string acc {};
+        switch ( attrs.memory ) {
+        case Attributes::MEMORY::NONE:
+            acc += "readnone";
+            break;
+        case Attributes::MEMORY::READ:
+            acc += "readonly";
+            break;
+        case Attributes::MEMORY::ANY:
+            acc += "memory";
+            break;
+        }
+
+        if ( attrs.willReturn ){
+            acc += " willreturn";
+        }
+        if ( attrs.noRecurse ){
+            acc += " norecurse";
+        }
+        if ( attrs.speculatable ){
+            acc += " speculatable";
+        }
+        if ( ! attrs.globals ){
+            acc += " noalias";
+        }
+        return acc;
+    }
+
+    void apply ( llvm::Function& fun, const Attributes& attrs )
+    {
+        fun.addFnAttr( llvm::Attribute::NoUnwind );
+
+        switch ( attrs.memory ) {
+        case Attributes::MEMORY::NONE:
+            fun.addFnAttr( llvm::Attribute::ReadNone );
+            break;
+        case Attributes::MEMORY::READ:
+            fun.addFnAttr( llvm::Attribute::ReadOnly );
+            break;
+        case Attributes::MEMORY::ANY:
+            break;
+        }
+
+        if ( attrs.willReturn ){
+            fun.addFnAttr( llvm::Attribute::WillReturn );
+        }
+        if ( attrs.noRecurse ){
+            fun.addFnAttr( llvm::Attribute::NoRecurse );
+        }
+        if ( attrs.speculatable ){
+            fun.addFnAttr( llvm::Attribute::Speculatable );
+        }
+
+        // Arguments of different var and const parameters never overlap where one is modified
+        if ( ! attrs.globals ){
+            for ( auto& a : fun.args() ){
+                if ( a.getType()->isPointerTy() ){
+                    a.addAttr( llvm::Attribute::NoAlias );
+                }
+            }
+        }
+    }
+
+    void apply_call ( llvm::CallBase& call, const llvm::Function& callee )
+    {
+        // norecurse and speculatable are valid only on functions
+        for ( auto kind : { llvm::Attribute::NoUnwind, llvm::Attribute::ReadNone,
+                            llvm::Attribute::ReadOnly, llvm::Attribute::WillReturn } ){
+            if ( callee.hasFnAttribute( kind ) ){
+                call.addFnAttr( kind );
+            }
+        }
+    }
+}
@@ -0,0 +1,73 @@
+#ifndef ATTRIBUTES_HPP
+#define ATTRIBUTES_HPP
+
+#include "ast.hpp"
+#include <optional>
+#include <string>
+#include <llvm/IR/Function.h>
+#include <llvm/IR/InstrTypes.h>
+
+/// Inference of function attributes from the call graph of the program
+namespace attributes
+{
+    using namespace ast;
+
+    /// What a subprogram is known to do, as far as the optimizer cares
+    struct Attributes
+    {
+        enum class MEMORY
+        {
+            /// Touches only its own locals (readnone)
+            NONE,
+            /// Reads global variables or var and const parameters (readonly)
+            READ,
+            /// Writes global variables or var parameters, or does input and output
+            ANY
+        };
+
+        MEMORY memory = MEMORY::ANY;
+
+        /// Always returns, it has no while loops, recursion or input and output
+        bool willReturn = false;
+
+        /// Is not part of a cycle of the call graph
+        bool noRecurse = false;
+
+        /**
+         * Accesses global variables, itself or in its callees. Otherwise
+         * its var and const parameters refer only to distinct locals of
+         * its callers, so they are noalias
+         */
+        bool globals = true;
+
+        /// Can be executed even when it wasn't called: readnone, always
+        /// returns and can't trap (no division, no array access)
+        bool speculatable = false;
+    };
+
+    /// Attributes by index of Program::globals (main is past the end), nullopt for non subprograms
+    using Table = Many<std::optional<Attributes>>;
+
+    /**
+     * @brief Infer the attributes of all subprograms of an analyzed program
+     *
+     * Effects of each body are collected from the resolved symbols and
+     * propagated over the strongly connected components of the call graph,
+     * callees first. Forward declarations get the attributes of their definition.
+     * Checked array accesses may exit the program, like the runtime calls,
+     * and so may the allocations of local arrays bigger than stackArrays
+     * bytes, which are made by the runtime.
+     */
+    Table infer ( const Program& program, bool checkedArrays = false, unsigned stackArrays = 65536 );
+
+    /// Readable form of the attributes, used in the cache keys
+    std::string to_string ( const Attributes& attrs );
+
+    /// Add the attributes to a function, all Mila subprograms are nounwind
+    void apply ( llvm::Function& fun, const Attributes& attrs );
+
+    /// Copy the attributes that are valid on a call site from the callee to the call
+    void apply_call ( llvm::CallBase& call, const llvm::Function& callee );
+}
+
+#endif // ATTRIBUTES_HPP
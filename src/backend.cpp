@@ -0,0 +1,115 @@
+#include "backend.hpp"
+#include <llvm/CodeGen/ParallelCG.h>
+#include <llvm/IR/LegacyPassManager.h>
+#include <llvm/MC/SubtargetFeature.h>
+#include <llvm/MC/TargetRegistry.h>
+#include <llvm/Object/ArchiveWriter.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/Host.h>
+#include <llvm/Support/TargetSelect.h>
+#include <llvm/Support/raw_ostream.h>
+#include <mutex>
+#include <stdexcept>
+
+namespace backend
+{
+    llvm::CodeGenOpt::Level codegen_level ( unsigned optLevel )
+    {
+        switch ( optLevel ) {
+        case 0:
+            return llvm::CodeGenOpt::None;
+        case 1:
+            return llvm::CodeGenOpt::Less;
+        case 2:
+            return llvm::CodeGenOpt::Default;
+        default:
+            return llvm::CodeGenOpt::Aggressive;
+        }
+    }
+
+    std::unique_ptr<llvm::TargetMachine> target_machine ( const std::string& triple, unsigned optLevel )
+    {
+        static std::once_flag initialized {};
+        std::call_once( initialized, [](){
+            llvm::InitializeNativeTarget();
+            llvm::InitializeNativeTargetAsmPrinter();
+        } );
+
+        std::string err {};
+        auto target = llvm::TargetRegistry::lookupTarget( triple, err );
+        if ( target == nullptr ){
+            throw std::runtime_error( "Unsupported target " + triple + ": " + err );
+        }
+
+        llvm::SubtargetFeatures features {};
+        llvm::StringMap<bool> hostFeatures {};
+        if ( llvm::sys::getHostCPUFeatures( hostFeatures ) ){
+            for ( const auto& f : hostFeatures ){
+                features.AddFeature( f.first(), f.second );
+            }
+        }
+
+        // PIC, so the objects can be linked into position independent executables
+        return std::unique_ptr<llvm::TargetMachine>( target->createTargetMachine(
+            triple,
+            llvm::sys::getHostCPUName(),
+            features.getString(),
+            llvm::TargetOptions{},
+            llvm::Reloc::PIC_,
+            llvm::None,
+            codegen_level( optLevel )
+        ) );
+    }
+
+    void emit_object ( llvm::Module& module, const std::string& path, unsigned partitions, unsigned optLevel )
+    {
+        auto triple = module.getTargetTriple();
+
+        if ( partitions <= 1 )
+        {
+            std::error_code ec {};
+            llvm::raw_fd_ostream out { path, ec, llvm::sys::fs::OF_None };
+            if ( ec ){
+                throw std::runtime_error( "Can't open " + path + ": " + ec.message() );
+            }
+
+            auto tm = target_machine( triple, optLevel );
+            llvm::legacy::PassManager pm {};
+            if ( tm->addPassesToEmitFile( pm, out, nullptr, llvm::CGFT_ObjectFile ) ){
+                throw std::runtime_error( "Target can't emit object files" );
+            }
+            pm.run( module );
+            return;
+        }
+
+        std::vector<llvm::SmallString<0>> objects ( partitions );
+        std::vector<std::unique_ptr<llvm::raw_svector_ostream>> streams {};
+        std::vector<llvm::raw_pwrite_stream*> outs {};
+        for ( auto& o : objects ){
+            streams.push_back( std::make_unique<llvm::raw_svector_ostream>( o ) );
+            outs.push_back( streams.back().get() );
+        }
+
+        // Each partition is generated in its own context on a thread pool
+        llvm::splitCodeGen( module, outs, {},
+            [&triple, optLevel](){
+                return target_machine( triple, optLevel );
+            }
+        );
+
+        // Partitions are linked into one archive, linking main pulls in the rest
+        std::vector<std::string> names {};
+        std::vector<llvm::NewArchiveMember> members {};
+        for ( size_t i = 0; i < objects.size(); ++i ){
+            names.push_back( "part" + std::to_string( i ) + ".o" );
+        }
+        for ( size_t i = 0; i < objects.size(); ++i ){
+            members.emplace_back( llvm::MemoryBufferRef( objects[i].str(), names[i] ) );
+        }
+
+        auto err = llvm::writeArchive( path, members, true, llvm::object::Archive::K_GNU, true, false );
+        if ( err ){
+            throw std::runtime_error( "Can't write " + path + ": " + llvm::toString( std::move( err ) ) );
+        }
+    }
+}
@@ -0,0 +1,32 @@
+#ifndef BACKEND_HPP
+#define BACKEND_HPP
+
+#include <llvm/IR/Module.h>
+#include <llvm/Target/TargetMachine.h>
+#include <memory>
+#include <string>
+
+/// Native code generation
+namespace backend
+{
+    /// Create a target machine for the given triple on the host CPU
+    std::unique_ptr<llvm::TargetMachine> target_machine ( const std::string& triple, unsigned optLevel );
+
+    /**
+     * @brief Generate native code of the module into an object file
+     *
+     * With more than one partition the module is split by SplitModule and the
+     * instruction selection and object emission of each partition runs on its
+     * own thread. The output is then an archive with one object per partition.
+     * The module is changed on the way: a single partition is lowered in place
+     * and splitting gives its local symbols external linkage and unique names.
+     *
+     * @param module Module to generate, it isn't meant to be used afterwards
+     * @param path Output file
+     * @param partitions Number of partitions
+     * @param optLevel Code generation optimization level (0 - 3)
+     */
+    void emit_object ( llvm::Module& module, const std::string& path, unsigned partitions, unsigned optLevel );
+}
+
+#endif // BACKEND_HPP
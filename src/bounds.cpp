@@ -0,0 +1,442 @@
+#include "bounds.hpp"
+#include "sema.hpp"
+#include "variant_helpers.hpp"
+#include <algorithm>
+#include <cstdint>
+#include <set>
+#include <sstream>
+#include <vector>
+
+namespace bounds
+{
+    std::string to_string ( const Stats& stats )
+    {
+        std::stringstream out {};
+        out << "Bounds checks: " << stats.indexes << " indexes"
+            << ", eliminated: " << stats.eliminated
+            << ", hoisted: " << stats.hoisted
+            << ", checked: " << stats.indexes - stats.eliminated - stats.hoisted;
+        return out.str();
+    }
+
+    Check Analysis::check ( const void* access, size_t dimension ) const
+    {
+        auto c = checks.find( { access, dimension } );
+        return c == checks.end() ? Check{} : c->second;
+    }
+
+    std::optional<Guard> Analysis::guard ( const For* loop ) const
+    {
+        auto g = guards.find( loop );
+        if ( g == guards.end() ){
+            return std::nullopt;
+        }
+        return g->second;
+    }
+
+/******************************************************************/
+
+    /// Inclusive range of values, integers wrap around so it never leaves 32 bits
+    struct Interval
+    {
+        long long low;
+        long long high;
+    };
+
+    constexpr Interval ANY { INT32_MIN, INT32_MAX };
+
+    /// Interval of an exact result, any value when it would wrap around
+    Interval wrapped ( long long low, long long high )
+    {
+        if ( low < INT32_MIN || high > INT32_MAX ){
+            return ANY;
+        }
+        return Interval{ low, high };
+    }
+
+    /// Symbols identify the variables
+    using Key = std::pair<Symbol::SCOPE, size_t>;
+
+    Key key ( const Symbol& symbol )
+    {
+        return { symbol.scope, symbol.index };
+    }
+
+    /// Walks the program, computing the ranges of the indexes of all array accesses
+    class Ranges
+    {
+    private:
+        const Program& m_Program;
+
+        /// Ranges of the variables of the enclosing loops
+        std::map<Key, Interval> m_Variables {};
+
+        /// Enclosing loops whose variables have a range, innermost last
+        struct Loop
+        {
+            const For* loop;
+            Key variable;
+
+            /// Accesses can be hoisted to a guard, serial loops only
+            bool hoistable;
+        };
+        std::vector<Loop> m_Loops {};
+
+    public:
+        Analysis m_Analysis {};
+
+        /// Slots of the var and const parameters of the subprogram being walked
+        std::set<size_t> m_References {};
+
+        Ranges ( const Program& program )
+        : m_Program { program }
+        {}
+
+        Interval range ( const Expression& e ) const
+        {
+            if ( auto c = sema::constant_value( m_Program, e ); c.has_value() ){
+                return wrapped( c.value(), c.value() );
+            }
+
+            return wrap( e ).visit(
+                [this]( const VariableAccess& va ) -> Interval {
+                    if ( ! va.symbol.has_value() ){
+                        return ANY;
+                    }
+                    auto v = m_Variables.find( key( va.symbol.value() ) );
+                    return v == m_Variables.end() ? ANY : v->second;
+                },
+                []( const ConstantExpression& ) -> Interval {
+                    return ANY;
+                },
+                []( const ptr<ArrayAccess>& ) -> Interval {
+                    return ANY;
+                },
+                []( const ptr<ArraySlice>& ) -> Interval {
+                    return ANY;
+                },
+                []( const ptr<ArrayReduction>& ) -> Interval {
+                    return ANY;
+                },
+                []( const ptr<SubprogramCall>& ) -> Interval {
+                    return ANY;
+                },
+                []( const ptr<SetConstructor>& ) -> Interval {
+                    return ANY;
+                },
+                [this]( const ptr<UnaryOperator>& un ) -> Interval {
+                    auto r = range( un->expression );
+                    switch ( un->op ) {
+                    case UnaryOperator::OPERATOR::PLUS:
+                        return r;
+                    case UnaryOperator::OPERATOR::MINUS:
+                        return wrapped( -r.high, -r.low );
+                    case UnaryOperator::OPERATOR::NOT:
+                    case UnaryOperator::OPERATOR::CARD:
+                        return ANY;
+                    }
+                    return ANY;
+                },
+                [this]( const ptr<BinaryOperator>& bin ) -> Interval {
+                    return binary( *bin );
+                }
+            );
+        }
+
+        Interval binary ( const BinaryOperator& bin ) const
+        {
+            auto l = range( bin.left );
+            auto r = range( bin.right );
+            auto divisor = sema::constant_value( m_Program, bin.right );
+
+            switch ( bin.op ) {
+            case BinaryOperator::OPERATOR::PLUS:
+                return wrapped( l.low + r.low, l.high + r.high );
+
+            case BinaryOperator::OPERATOR::MINUS:
+                return wrapped( l.low - r.high, l.high - r.low );
+
+            case BinaryOperator::OPERATOR::TIMES: {
+                // Corners of 32-bit intervals fit into 64 bits
+                auto corners = { l.low * r.low, l.low * r.high, l.high * r.low, l.high * r.high };
+                return wrapped( std::min( corners ), std::max( corners ) );
+            }
+
+            case BinaryOperator::OPERATOR::DIVISION:
+            case BinaryOperator::OPERATOR::INTEGER_DIVISION:
+                // Division truncating towards zero is monotonic in the dividend
+                if ( divisor.has_value() && divisor.value() > 0 ){
+                    return Interval{ l.low / divisor.value(), l.high / divisor.value() };
+                }
+                return ANY;
+
+            case BinaryOperator::OPERATOR::MODULO:
+                // The remainder has the sign of the dividend
+                if ( divisor.has_value() && divisor.value() > 0 ){
+                    auto d = divisor.value() - 1;
+                    return Interval{ l.low < 0 ? -d : 0, l.high > 0 ? std::min( d, l.high ) : 0 };
+                }
+                return ANY;
+
+            default:
+                return ANY;
+            }
+        }
+
+        /// Variable and constant offset of an index of the form `v + c`, `c + v` or `v - c`
+        std::optional<std::pair<Key, long long>> affine ( const Expression& e ) const
+        {
+            if ( auto va = std::get_if<VariableAccess>( &e ); va != nullptr && va->symbol.has_value() ){
+                return std::pair{ key( va->symbol.value() ), 0ll };
+            }
+
+            auto bin = std::get_if<ptr<BinaryOperator>>( &e );
+            if ( bin == nullptr ){
+                return std::nullopt;
+            }
+
+            bool plus = (*bin)->op == BinaryOperator::OPERATOR::PLUS;
+            bool minus = (*bin)->op == BinaryOperator::OPERATOR::MINUS;
+            if ( ! plus && ! minus ){
+                return std::nullopt;
+            }
+
+            if ( auto c = sema::constant_value( m_Program, (*bin)->right ); c.has_value() ){
+                auto inner = affine( (*bin)->left );
+                if ( inner.has_value() ){
+                    inner->second += plus ? c.value() : -c.value();
+                }
+                return inner;
+            }
+
+            if ( auto c = sema::constant_value( m_Program, (*bin)->left ); plus && c.has_value() ){
+                auto inner = affine( (*bin)->right );
+                if ( inner.has_value() ){
+                    inner->second += c.value();
+                }
+                return inner;
+            }
+
+            return std::nullopt;
+        }
+
+        void access ( const void* node, const std::optional<Symbol>& symbol, const Many<Expression>& indexes )
+        {
+            if ( ! symbol.has_value() || ! symbol->type.has_value() ){
+                return;
+            }
+
+            // Lengths of dynamic arrays are known only at run time, their indexes are always checked
+            if ( std::holds_alternative<ptr<DynamicArray>>( symbol->type.value() ) ){
+                m_Analysis.stats.indexes += indexes.size();
+                return;
+            }
+
+            auto dims = dimensions( symbol->type.value() );
+            for ( size_t d = 0; d < dims.size() && d < indexes.size(); ++d ){
+                index( { node, d }, *dims[d], indexes[d] );
+            }
+        }
+
+        void index ( std::pair<const void*, size_t> key, const Array& arr, const Expression& index )
+        {
+            auto& stats = m_Analysis.stats;
+            stats.indexes++;
+
+            auto low = sema::constant_value( m_Program, arr.lowBound ).value();
+            auto high = sema::constant_value( m_Program, arr.highBound ).value();
+
+            auto r = range( index );
+            if ( r.low >= low && r.high <= high ){
+                m_Analysis.checks[key] = Check{ Check::KIND::ELIMINATED };
+                stats.eliminated++;
+                return;
+            }
+
+            // `i + c` is in bounds for i in low - c .. high - c
+            auto form = affine( index );
+            if ( ! form.has_value() ){
+                return;
+            }
+
+            auto loop = std::find_if( m_Loops.rbegin(), m_Loops.rend(), [&]( const Loop& l ){
+                return l.variable == form->first;
+            } );
+            if ( loop == m_Loops.rend() || ! loop->hoistable ){
+                return;
+            }
+
+            auto& guard = m_Analysis.guards.try_emplace( loop->loop, Guard{ INT32_MIN, INT32_MAX } ).first->second;
+            guard.low = std::max( guard.low, low - form->second );
+            guard.high = std::min( guard.high, high - form->second );
+
+            m_Analysis.checks[key] = Check{ Check::KIND::HOISTED, loop->loop };
+            stats.hoisted++;
+        }
+
+        void expr ( const Expression& e )
+        {
+            wrap( e ).visit(
+                []( const VariableAccess& ){},
+                []( const ConstantExpression& ){},
+                [this]( const ptr<ArrayAccess>& arr ){
+                    access( arr.get(), arr->symbol, arr->indexes );
+                    for ( const auto& i : arr->indexes ){
+                        expr( i );
+                    }
+                },
+                [this]( const ptr<ArraySlice>& sl ){
+                    // Slices are checked as a whole
+                    expr( sl->low );
+                    expr( sl->high );
+                },
+                [this]( const ptr<ArrayReduction>& red ){
+                    expr( red->array );
+                },
+                [this]( const ptr<SubprogramCall>& sub ){
+                    for ( const auto& a : sub->arguments ){
+                        expr( a );
+                    }
+                },
+                [this]( const ptr<SetConstructor>& set ){
+                    for ( auto v : values( *set ) ){
+                        expr( *v );
+                    }
+                },
+                [this]( const ptr<UnaryOperator>& un ){
+                    expr( un->expression );
+                },
+                [this]( const ptr<BinaryOperator>& bin ){
+                    expr( bin->left );
+                    expr( bin->right );
+                }
+            );
+        }
+
+        // The statements are visited in place, the accesses are identified by their addresses
+        void stat ( const Statement& s )
+        {
+            std::visit( overloaded {
+                [this]( const SubprogramCall& sub ){
+                    for ( const auto& a : sub.arguments ){
+                        expr( a );
+                    }
+                },
+                [this]( const Assignment& as ){
+                    expr( as.value );
+                },
+                [this]( const ArrayAssignment& as ){
+                    access( &as, as.symbol, as.indexes );
+                    for ( const auto& i : as.indexes ){
+                        expr( i );
+                    }
+                    expr( as.value );
+                },
+                [this]( const SliceAssignment& as ){
+                    expr( as.slice.low );
+                    expr( as.slice.high );
+                    expr( as.value );
+                },
+                [this]( const SetLength& sl ){
+                    expr( sl.length );
+                },
+                [this]( const Spawn& sp ){
+                    for ( const auto& a : sp.call.arguments ){
+                        expr( a );
+                    }
+                },
+                []( const ExitStatement& ){},
+                []( const BreakStatement& ){},
+                []( const EmptyStatement& ){},
+                []( const SyncStatement& ){},
+                [this]( const ptr<Block>& bl ){
+                    for ( const auto& st : bl->statements ){
+                        stat( st );
+                    }
+                },
+                [this]( const ptr<If>& if_ ){
+                    expr( if_->condition );
+                    stat( if_->trueCode );
+                    if ( if_->elseCode.has_value() ){
+                        stat( if_->elseCode.value() );
+                    }
+                },
+                [this]( const ptr<While>& wh ){
+                    expr( wh->condition );
+                    stat( wh->code );
+                },
+                [this]( const ptr<For>& fo ){
+                    loop( *fo );
+                }
+            }, s );
+        }
+
+        void loop ( const For& fo )
+        {
+            expr( fo.initialization );
+            expr( fo.target );
+
+            // The variable goes from the start to the bound, unless the body changes it
+            if ( ! fo.symbol.has_value() || sema::modifies( m_Program, fo.symbol.value(), m_References, fo.code ) ){
+                stat( fo.code );
+                return;
+            }
+
+            auto init = range( fo.initialization );
+            auto target = range( fo.target );
+            auto variable = fo.direction == For::DIRECTION::TO
+                ? Interval{ init.low, target.high }
+                : Interval{ target.low, init.high };
+
+            auto k = key( fo.symbol.value() );
+            auto outer = m_Variables.find( k );
+            std::optional<Interval> shadowed = outer == m_Variables.end()
+                ? std::nullopt
+                : std::optional{ outer->second };
+
+            m_Variables[k] = variable;
+            m_Loops.push_back( Loop{ &fo, k, ! fo.parallel.has_value() } );
+            stat( fo.code );
+            m_Loops.pop_back();
+
+            if ( shadowed.has_value() ){
+                m_Variables[k] = shadowed.value();
+            }
+            else {
+                m_Variables.erase( k );
+            }
+        }
+    };
+
+    Analysis analyze ( const Program& program )
+    {
+        Ranges ranges { program };
+        auto subprogram = [&ranges]( const Many<Variable>& parameters, const Block& code ){
+            ranges.m_References.clear();
+            for ( size_t i = 0; i < parameters.size(); ++i ){
+                if ( parameters[i].mode != Variable::MODE::VALUE ){
+                    ranges.m_References.insert( i );
+                }
+            }
+            for ( const auto& st : code.statements ){
+                ranges.stat( st );
+            }
+        };
+
+        for ( const auto& g : program.globals ){
+            if ( auto proc = std::get_if<Procedure>( &g ) ){
+                subprogram( proc->parameters, proc->code );
+            }
+            else if ( auto fun = std::get_if<Function>( &g ) ){
+                subprogram( fun->parameters, fun->code );
+            }
+        }
+
+        ranges.m_References.clear();
+        for ( const auto& st : program.code.statements ){
+            ranges.stat( st );
+        }
+
+        return ranges.m_Analysis;
+    }
+}
@@ -0,0 +1,83 @@
+#ifndef BOUNDS_HPP
+#define BOUNDS_HPP
+
+#include "ast.hpp"
+#include <map>
+#include <optional>
+#include <string>
+
+/// Value range analysis deciding which bounds checks of array accesses are needed
+namespace bounds
+{
+    using namespace ast;
+
+    /// What is done with the bounds check of a single index of an array access
+    struct Check
+    {
+        enum class KIND
+        {
+            /// The index may be out of bounds, it is checked on every access
+            NEEDED,
+            /// The index is always in bounds
+            ELIMINATED,
+            /// The index is in bounds when the guard of the loop holds
+            HOISTED
+        };
+
+        KIND kind = KIND::NEEDED;
+
+        /// Loop whose guard covers the access, nullptr unless HOISTED
+        const For* loop = nullptr;
+    };
+
+    /**
+     * Range of the loop variable for which all hoisted accesses of the loop
+     * are in bounds. The loop is versioned, without the checks when the
+     * variable stays in the range, with them otherwise.
+     */
+    struct Guard
+    {
+        long long low;
+        long long high;
+    };
+
+    /// Counts of the indexes of array accesses in the source by what happens to their checks
+    struct Stats
+    {
+        size_t indexes = 0;
+        size_t eliminated = 0;
+        size_t hoisted = 0;
+    };
+
+    /// Return a human readable summary of the statistics
+    std::string to_string ( const Stats& stats );
+
+    struct Analysis
+    {
+        /// Checks by the ArrayAccess or ArrayAssignment node and the dimension, those that aren't here are NEEDED
+        std::map<std::pair<const void*, size_t>, Check> checks;
+
+        /// Guards of the loops with hoisted checks
+        std::map<const For*, Guard> guards;
+
+        Stats stats;
+
+        /// Check of an index of an access
+        Check check ( const void* access, size_t dimension ) const;
+
+        /// Guard of a loop, nullopt when it has no hoisted checks
+        std::optional<Guard> guard ( const For* loop ) const;
+    };
+
+    /**
+     * @brief Decide the bounds checks of all array accesses of an analyzed program
+     *
+     * Loop variables that aren't modified by the body of their for loop stay
+     * between its start and bound, integer intervals of the indexes are
+     * computed from them and compared with the declared bounds. Indexes of the
+     * form `i + c` of a serial loop that can't be proven get a guard instead.
+     */
+    Analysis analyze ( const Program& program );
+}
+
+#endif // BOUNDS_HPP
@@ -0,0 +1,549 @@
+#include "cache.hpp"
+#include "ast.hpp"
+#include "debug_info.hpp"
+#include "variant_helpers.hpp"
+#include <algorithm>
+#include <fstream>
+#include <iterator>
+#include <sstream>
+#include <stdexcept>
+#include <unistd.h>
+#include <llvm/Bitcode/BitcodeWriter.h>
+#include <llvm/Config/llvm-config.h>
+#include <llvm/IRReader/IRReader.h>
+#include <llvm/Linker/Linker.h>
+#include <llvm/Passes/PassBuilder.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/SourceMgr.h>
+#include <llvm/Support/raw_ostream.h>
+#include <llvm/Transforms/Utils/Cloning.h>
+
+namespace cache
+{
+    /// Bump when the layout of the cache files or the keys change
+    constexpr const char * FORMAT = "MILA-CACHE-1";
+
+    /// 64-bit FNV-1a, stable between runs and platforms unlike std::hash
+    class Hasher
+    {
+    private:
+        std::uint64_t m_Value = 0xcbf29ce484222325ULL;
+
+    public:
+        /// Add a string, terminated so that concatenations don't collide
+        void add ( const std::string& str )
+        {
+            for ( unsigned char ch : str ){
+                m_Value ^= ch;
+                m_Value *= 0x100000001b3ULL;
+            }
+
+            m_Value ^= 0xff;
+            m_Value *= 0x100000001b3ULL;
+        }
+
+        std::uint64_t value () const
+        {
+            return m_Value;
+        }
+    };
+
+/******************************************************************/
+
+    /// @name Collecting identifiers referenced by the code
+    /// @{
+    void collect ( const Expression& expr, std::set<Identifier>& out );
+    void collect ( const Statement& stmt, std::set<Identifier>& out );
+
+    void collect ( const Type& type, std::set<Identifier>& out )
+    {
+        if ( auto arr = std::get_if<ptr<Array>>( &type ) ){
+            collect( (*arr)->lowBound, out );
+            collect( (*arr)->highBound, out );
+            collect( (*arr)->elementType, out );
+        }
+        else if ( auto dyn = std::get_if<ptr<DynamicArray>>( &type ) ){
+            collect( (*dyn)->elementType, out );
+        }
+        else if ( auto set = std::get_if<ptr<Set>>( &type ) ){
+            collect( (*set)->lowBound, out );
+            collect( (*set)->highBound, out );
+        }
+    }
+
+    void collect ( const Expression& expr, std::set<Identifier>& out )
+    {
+        wrap( expr ).visit(
+            [&out]( const VariableAccess& va ){
+                out.insert( va.identifier );
+            },
+            []( const ConstantExpression& ){},
+            [&out]( const ptr<ArrayAccess>& arr ){
+                out.insert( arr->array );
+                for ( const auto& i : arr->indexes ){
+                    collect( i, out );
+                }
+            },
+            [&out]( const ptr<ArraySlice>& sl ){
+                out.insert( sl->array );
+                collect( sl->low, out );
+                collect( sl->high, out );
+            },
+            [&out]( const ptr<ArrayReduction>& red ){
+                collect( red->array, out );
+            },
+            [&out]( const ptr<SubprogramCall>& sub ){
+                out.insert( sub->functionName );
+                for ( const auto& a : sub->arguments ){
+                    collect( a, out );
+                }
+            },
+            [&out]( const ptr<SetConstructor>& set ){
+                for ( auto v : values( *set ) ){
+                    collect( *v, out );
+                }
+            },
+            [&out]( const ptr<UnaryOperator>& un ){
+                collect( un->expression, out );
+            },
+            [&out]( const ptr<BinaryOperator>& bin ){
+                collect( bin->left, out );
+                collect( bin->right, out );
+            }
+        );
+    }
+
+    void collect ( const Statement& stmt, std::set<Identifier>& out )
+    {
+        wrap( stmt ).visit(
+            [&out]( const SubprogramCall& sub ){
+                out.insert( sub.functionName );
+                for ( const auto& a : sub.arguments ){
+                    collect( a, out );
+                }
+            },
+            [&out]( const Assignment& as ){
+                out.insert( as.variable );
+                collect( as.value, out );
+            },
+            [&out]( const ArrayAssignment& as ){
+                out.insert( as.array );
+                for ( const auto& i : as.indexes ){
+                    collect( i, out );
+                }
+                collect( as.value, out );
+            },
+            [&out]( const SliceAssignment& as ){
+                out.insert( as.slice.array );
+                collect( as.slice.low, out );
+                collect( as.slice.high, out );
+                collect( as.value, out );
+            },
+            [&out]( const SetLength& sl ){
+                out.insert( sl.array.identifier );
+                collect( sl.length, out );
+            },
+            []( const ExitStatement& ){},
+            []( const BreakStatement& ){},
+            []( const EmptyStatement& ){},
+            [&out]( const Spawn& sp ){
+                if ( sp.variable.has_value() ){
+                    out.insert( sp.variable.value() );
+                }
+                out.insert( sp.call.functionName );
+                for ( const auto& a : sp.call.arguments ){
+                    collect( a, out );
+                }
+            },
+            []( const SyncStatement& ){},
+            [&out]( const ptr<Block>& bl ){
+                for ( const auto& st : bl->statements ){
+                    collect( st, out );
+                }
+            },
+            [&out]( const ptr<If>& if_ ){
+                collect( if_->condition, out );
+                collect( if_->trueCode, out );
+                if ( if_->elseCode.has_value() ){
+                    collect( if_->elseCode.value(), out );
+                }
+            },
+            [&out]( const ptr<While>& wh ){
+                collect( wh->condition, out );
+                collect( wh->code, out );
+            },
+            [&out]( const ptr<For>& fo ){
+                out.insert( fo->loopVariable );
+                if ( fo->parallel.has_value() ){
+                    for ( const auto& r : fo->parallel->reductions ){
+                        out.insert( r.variable );
+                    }
+                }
+                collect( fo->initialization, out );
+                collect( fo->target, out );
+                collect( fo->code, out );
+            }
+        );
+    }
+    /// @}
+
+    /// @name Collecting source positions of the statements
+    /// @{
+    std::string to_string ( const Location& location )
+    {
+        return std::to_string( location.line ) + ":" + std::to_string( location.column ) + " ";
+    }
+
+    void positions ( const Statement& stmt, std::string& out )
+    {
+        if ( auto loc = ast::location( stmt ); loc.has_value() ){
+            out += to_string( loc.value() );
+        }
+
+        wrap( stmt ).visit(
+            [&out]( const ptr<Block>& bl ){
+                for ( const auto& st : bl->statements ){
+                    positions( st, out );
+                }
+            },
+            [&out]( const ptr<If>& if_ ){
+                positions( if_->trueCode, out );
+                if ( if_->elseCode.has_value() ){
+                    positions( if_->elseCode.value(), out );
+                }
+            },
+            [&out]( const ptr<While>& wh ){
+                positions( wh->code, out );
+            },
+            [&out]( const ptr<For>& fo ){
+                positions( fo->code, out );
+            },
+            []( const auto& ){}
+        );
+    }
+    /// @}
+
+    /// Signature of a subprogram, the part other subprograms depend on
+    std::string signature (
+        const Identifier& name,
+        const Many<Variable>& parameters,
+        const std::optional<Type>& retType )
+    {
+        std::string acc = "SUBPROGRAM <" + name + ">\n";
+        for ( const auto& p : parameters ){
+            acc += to_string( p, 1 );
+        }
+
+        if ( retType.has_value() ){
+            acc += "RETURNS\n" + to_string( retType.value(), 1 );
+        }
+
+        return acc;
+    }
+
+/******************************************************************/
+
+    std::string to_string ( const Stats& stats )
+    {
+        std::ostringstream str {};
+        str << "Function cache: "
+            << stats.hits << " hits, "
+            << stats.misses << " misses, "
+            << "saved " << stats.saved.count() / 1000.0 << " ms, "
+            << "spent " << stats.spent.count() / 1000.0 << " ms";
+
+        return str.str();
+    }
+
+/******************************************************************/
+
+    FunctionCache::FunctionCache ( const std::filesystem::path& directory, const std::string& flags, bool positions )
+    : m_Directory { directory }
+    , m_Flags { flags }
+    , m_Positions { positions }
+    {
+        std::filesystem::create_directories( m_Directory );
+    }
+
+    std::filesystem::path FunctionCache::path ( std::uint64_t key ) const
+    {
+        std::ostringstream name {};
+        name << std::hex << key << ".bc";
+        return m_Directory / name.str();
+    }
+
+    void FunctionCache::prepare ( const Program& program, const attributes::Table* attrs )
+    {
+        for ( size_t i = 0; i < program.globals.size(); ++i )
+        {
+            const auto& g = program.globals[i];
+            std::set<Identifier> deps {};
+
+            auto [ name, interface ] = wrap( g ).visit(
+                [&deps]( const ProcedureDecl& p ){
+                    for ( const auto& v : p.parameters ){
+                        collect( v.type, deps );
+                    }
+                    return std::pair { p.name, signature( p.name, p.parameters, std::nullopt ) };
+                },
+                [&deps]( const Procedure& p ){
+                    for ( const auto& v : p.parameters ){
+                        collect( v.type, deps );
+                    }
+                    return std::pair { p.name, signature( p.name, p.parameters, std::nullopt ) };
+                },
+                [&deps]( const FunctionDecl& f ){
+                    for ( const auto& v : f.parameters ){
+                        collect( v.type, deps );
+                    }
+                    collect( f.returnType, deps );
+                    return std::pair { f.name, signature( f.name, f.parameters, f.returnType ) };
+                },
+                [&deps]( const Function& f ){
+                    for ( const auto& v : f.parameters ){
+                        collect( v.type, deps );
+                    }
+                    collect( f.returnType, deps );
+                    return std::pair { f.name, signature( f.name, f.parameters, f.returnType ) };
+                },
+                [&deps]( const NamedConstant& c ){
+                    collect( c.value, deps );
+                    return std::pair { c.name, to_string( c, 0 ) };
+                },
+                [&deps]( const Variable& v ){
+                    collect( v.type, deps );
+                    return std::pair { v.name, to_string( v, 0 ) };
+                }
+            );
+
+            if ( attrs != nullptr && attrs->at( i ).has_value() ){
+                interface += " " + attributes::to_string( attrs->at( i ).value() );
+            }
+
+            m_Interfaces[name] = interface;
+            m_InterfaceDeps[name].merge( deps );
+        }
+    }
+
+    std::uint64_t FunctionCache::key (
+        const Identifier& name,
+        const Many<Variable>& parameters,
+        const Many<Variable>& variables,
+        const std::optional<Type>& retType,
+        const Block& code,
+        const Location& location ) const
+    {
+        // Everything the body and the signature reference
+        std::set<Identifier> refs {};
+        for ( const auto& v : parameters ){
+            collect( v.type, refs );
+        }
+        for ( const auto& v : variables ){
+            collect( v.type, refs );
+        }
+        if ( retType.has_value() ){
+            collect( retType.value(), refs );
+        }
+        for ( const auto& st : code.statements ){
+            collect( st, refs );
+        }
+
+        // Closure over interfaces referencing other globals (constants in array bounds etc.)
+        std::vector<Identifier> work ( refs.begin(), refs.end() );
+        while ( ! work.empty() )
+        {
+            auto id = work.back();
+            work.pop_back();
+
+            auto deps = m_InterfaceDeps.find( id );
+            if ( deps == m_InterfaceDeps.end() ){
+                continue;
+            }
+
+            for ( const auto& d : deps->second ){
+                if ( refs.insert( d ).second ){
+                    work.push_back( d );
+                }
+            }
+        }
+
+        Hasher h {};
+        h.add( FORMAT );
+        h.add( LLVM_VERSION_STRING );
+        h.add( m_Flags );
+        h.add( signature( name, parameters, retType ) );
+
+        for ( const auto& v : variables ){
+            h.add( to_string( v, 0 ) );
+        }
+        h.add( to_string( make_ptr<Block>( code ), 0 ) );
+
+        // Moving the code around the file changes its debug information
+        if ( m_Positions ){
+            std::string acc = to_string( location );
+            for ( const auto& v : parameters ){
+                acc += to_string( v.location );
+            }
+            for ( const auto& v : variables ){
+                acc += to_string( v.location );
+            }
+            positions( make_ptr<Block>( code ), acc );
+            h.add( acc );
+        }
+
+        // Ordered set, so the order is stable. Locals shadowing globals are
+        // hashed as well, which only costs a needless miss.
+        for ( const auto& r : refs ){
+            auto i = m_Interfaces.find( r );
+            if ( i != m_Interfaces.end() ){
+                h.add( i->second );
+            }
+        }
+
+        return h.value();
+    }
+
+    bool FunctionCache::lookup ( std::uint64_t key, const Identifier& name )
+    {
+        std::ifstream file ( path( key ), std::ios_base::binary );
+        if ( ! file ){
+            return false;
+        }
+
+        // "<FORMAT> <cost in microseconds>\n<bitcode>"
+        std::string format {};
+        long long cost = 0;
+        file >> format >> cost;
+        if ( ! file || format != FORMAT || file.get() != '\n' ){
+            return false;
+        }
+
+        std::string bitcode { std::istreambuf_iterator<char>( file ), std::istreambuf_iterator<char>() };
+
+        std::lock_guard lock { m_Mutex };
+        m_Stats.hits++;
+        m_Stats.saved += std::chrono::microseconds( cost );
+        m_Hits.push_back( { key, name, std::chrono::microseconds( cost ), std::move( bitcode ) } );
+        return true;
+    }
+
+    void FunctionCache::miss ( std::uint64_t key, const Identifier& name, std::chrono::microseconds cost )
+    {
+        std::lock_guard lock { m_Mutex };
+        m_Stats.misses++;
+        m_Misses.push_back( { key, name, cost, {} } );
+    }
+
+/******************************************************************/
+
+    /// Link a module serialized as bitcode into the module
+    void link_bitcode ( llvm::Module& module, const std::string& bitcode, const Identifier& name )
+    {
+        llvm::SMDiagnostic diag {};
+        auto part = llvm::parseIR(
+            llvm::MemoryBufferRef( bitcode, name ),
+            diag,
+            module.getContext()
+        );
+
+        if ( part == nullptr ){
+            throw std::runtime_error( "Failed to link cached subprogram " + name );
+        }
+
+        // Every part carries the unit of its module, which would pile up with each one linked
+        debug::share_unit( *part, module );
+        if ( llvm::Linker::linkModules( module, std::move( part ) ) ){
+            throw std::runtime_error( "Failed to link cached subprogram " + name );
+        }
+    }
+
+    /// Run the function simplification pipeline over a single function
+    void optimize_function ( llvm::Function& fun, llvm::OptimizationLevel level )
+    {
+        llvm::LoopAnalysisManager lam {};
+        llvm::FunctionAnalysisManager fam {};
+        llvm::CGSCCAnalysisManager cgam {};
+        llvm::ModuleAnalysisManager mam {};
+
+        llvm::PassBuilder pb {};
+        pb.registerModuleAnalyses( mam );
+        pb.registerCGSCCAnalyses( cgam );
+        pb.registerFunctionAnalyses( fam );
+        pb.registerLoopAnalyses( lam );
+        pb.crossRegisterProxies( lam, fam, cgam, mam );
+
+        auto fpm = pb.buildFunctionSimplificationPipeline( level, llvm::ThinOrFullLTOPhase::None );
+        fpm.run( fun, fam );
+    }
+
+    void FunctionCache::finish ( llvm::Module& module, std::optional<llvm::OptimizationLevel> level )
+    {
+        for ( const auto& hit : m_Hits ){
+            link_bitcode( module, hit.bitcode, hit.name );
+        }
+
+        for ( const auto& miss : m_Misses )
+        {
+            auto start = std::chrono::steady_clock::now();
+            auto fun = module.getFunction( miss.name );
+
+            // Bodies outlined from the subprogram (parallel loops) are named after it
+            std::vector<llvm::Function*> outlined {};
+            for ( auto& f : module.functions() ){
+                if ( f.getName().startswith( miss.name + "." ) ){
+                    outlined.push_back( &f );
+                }
+            }
+
+            // Module with only this subprogram defined, everything else is declared
+            llvm::ValueToValueMapTy vmap {};
+            auto part = llvm::CloneModule( module, vmap,
+                [fun, &outlined]( const llvm::GlobalValue* gv ){
+                    return gv == fun || std::find( outlined.begin(), outlined.end(), gv ) != outlined.end();
+                }
+            );
+
+            if ( level.has_value() ){
+                optimize_function( *part->getFunction( miss.name ), level.value() );
+            }
+
+            std::string bitcode {};
+            llvm::raw_string_ostream bitcodeStream { bitcode };
+            llvm::WriteBitcodeToFile( *part, bitcodeStream );
+            bitcodeStream.flush();
+
+            // Replace the body with the optimized one, so hits and misses end up the same
+            fun->deleteBody();
+            for ( auto f : outlined ){
+                f->eraseFromParent();
+            }
+            link_bitcode( module, bitcode, miss.name );
+
+            auto cost = miss.cost + std::chrono::duration_cast<std::chrono::microseconds>(
+                std::chrono::steady_clock::now() - start );
+            m_Stats.spent += cost;
+
+            // Written to a temporary first, so concurrent compilations never see half a file
+            auto file = path( miss.key );
+            auto tmp = file;
+            tmp += ".tmp" + std::to_string( ::getpid() );
+            {
+                std::ofstream out ( tmp, std::ios_base::binary | std::ios_base::trunc );
+                out << FORMAT << ' ' << cost.count() << '\n' << bitcode;
+                if ( ! out ){
+                    throw std::runtime_error( "Failed to write cache file " + tmp.string() );
+                }
+            }
+            std::filesystem::rename( tmp, file );
+        }
+
+        m_Hits.clear();
+        m_Misses.clear();
+    }
+
+    Stats FunctionCache::stats ()
+    {
+        std::lock_guard lock { m_Mutex };
+        return m_Stats;
+    }
+}
@@ -0,0 +1,122 @@
+#ifndef CACHE_HPP
+#define CACHE_HPP
+
+#include "ast.hpp"
+#include "attributes.hpp"
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <set>
+#include <string>
+#include <vector>
+#include <llvm/IR/Module.h>
+#include <llvm/Passes/OptimizationLevel.h>
+
+namespace cache
+{
+    using namespace ast;
+
+    /// Statistics of the cache usage
+    struct Stats
+    {
+        size_t hits = 0;
+        size_t misses = 0;
+
+        /// Time it took to generate the subprograms that were hit when they were missed
+        std::chrono::microseconds saved { 0 };
+
+        /// Time spent generating and optimizing the missed subprograms
+        std::chrono::microseconds spent { 0 };
+    };
+
+    /// Return a human readable summary of the statistics
+    std::string to_string ( const Stats& stats );
+
+    /**
+     * @brief Persistent on-disk cache of optimized IR of single subprograms
+     *
+     * A subprogram is keyed by a stable hash of its body, the interfaces of the
+     * globals it depends on (subprogram signatures, constants and variables)
+     * and the compiler flags. Hits are only declared while generating the code
+     * and their cached IR is linked in by finish(), misses are generated,
+     * optimized on their own and stored.
+     */
+    class FunctionCache
+    {
+    private:
+        /// A hit or a miss of a single subprogram
+        struct Entry
+        {
+            std::uint64_t key;
+            Identifier name;
+            std::chrono::microseconds cost;
+            std::string bitcode;
+        };
+
+        /// Directory holding the cached subprograms
+        std::filesystem::path m_Directory;
+
+        /// Compiler flags affecting the generated code
+        std::string m_Flags;
+
+        /// Source positions are part of the key, the code carries debug information
+        bool m_Positions;
+
+        /// Interface description of each global of the program
+        std::map<Identifier, std::string> m_Interfaces;
+
+        /// Globals that are referenced by each global's interface
+        std::map<Identifier, std::set<Identifier>> m_InterfaceDeps;
+
+        /// Guards the hits, misses and statistics, code is generated on multiple threads
+        std::mutex m_Mutex;
+
+        std::vector<Entry> m_Hits;
+        std::vector<Entry> m_Misses;
+        Stats m_Stats;
+
+        /// Path of the cache file of given key
+        std::filesystem::path path ( std::uint64_t key ) const;
+
+    public:
+        FunctionCache ( const std::filesystem::path& directory, const std::string& flags, bool positions = false );
+
+        /**
+         * Collect interfaces of the program globals, has to be called before key().
+         * Inferred attributes of the subprograms are part of their interface,
+         * the callers' code depends on them
+         */
+        void prepare ( const Program& program, const attributes::Table* attrs = nullptr );
+
+        /// Compute the key of a subprogram
+        std::uint64_t key (
+            const Identifier& name,
+            const Many<Variable>& parameters,
+            const Many<Variable>& variables,
+            const std::optional<Type>& retType,
+            const Block& code,
+            const Location& location
+        ) const;
+
+        /// Look up a subprogram, returning true on hit, which is remembered for finish()
+        bool lookup ( std::uint64_t key, const Identifier& name );
+
+        /// Record a generated subprogram and the time its generation took
+        void miss ( std::uint64_t key, const Identifier& name, std::chrono::microseconds cost );
+
+        /**
+         * Link the hits into the module, optimize the misses on the given level
+         * (nullopt for no optimization), store them and replace their bodies
+         * with the optimized ones
+         */
+        void finish ( llvm::Module& module, std::optional<llvm::OptimizationLevel> level );
+
+        /// Get the usage statistics
+        Stats stats ();
+    };
+}
+
+#endif // CACHE_HPP
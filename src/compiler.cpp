@@ -1,50 +1,55 @@
 #include "compiler.hpp"
 #include "ast.hpp"
+#include "backend.hpp"
+#include "runtime.hpp"
+#include "sema.hpp"
 #include "variant_helpers.hpp"
 #include <bits/ranges_algo.h>
+#include <llvm/Bitcode/BitcodeWriter.h>
 #include <llvm/IR/BasicBlock.h>
+#include <llvm/IR/MDBuilder.h>
+#include <llvm/IR/PassTimingInfo.h>
+#include <llvm/IRReader/IRReader.h>
+#include <llvm/Linker/Linker.h>
+#include <llvm/Passes/PassBuilder.h>
+#include <llvm/Passes/StandardInstrumentations.h>
+#include <llvm/Support/Host.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/SourceMgr.h>
+#include <llvm/Support/raw_ostream.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <exception>
+#include <filesystem>
+#include <functional>
+#include <map>
 #include <math.h>
 #include <optional>
 #include <stdexcept>
+#include <thread>
 
 namespace compiler
 {
-    std::optional<llvm::Value*> DeclarationMap::find ( const std::string& ident ) const
-    {
-        auto i = m_Data.find( ident );
-        if ( i != m_Data.end() ){
-            return i->second;
-        }
-
-        return std::nullopt;
-    }
-
-    void DeclarationMap::add ( const std::string& ident, llvm::Value* val )
-    {
-        auto i = m_Data.find( ident );
-        if ( i == m_Data.end() ){
-            m_Data.insert({ ident, val });
-        }
-
-        throw std::runtime_error( "Redefinition of " + ident );
-    }
 /******************************************************************/
 
     llvm::Constant* ConstantVisitor::operator() ( const VariableAccess& name )
     {
-        auto glob = m_Module.getNamedGlobal(name.identifier);
-        if ( glob == nullptr ){
+        if ( ! name.symbol.has_value() || name.symbol->scope != Symbol::SCOPE::GLOBAL ){
             throw std::runtime_error( "Usage of undeclared " + name.identifier );
         }
 
-        if ( ! glob->isConstant() ){
+        auto glob = llvm::dyn_cast<llvm::GlobalVariable>( m_Globals.globals[name.symbol->index] );
+        if ( glob == nullptr || ! glob->isConstant() ){
             throw std::runtime_error( "Usage of variable "
                 + name.identifier
                 + " as a constant"
             );
         }
 
-        return glob;
+        // The value itself, so constants can be defined by other constants
+        return glob->getInitializer();
     }
 
     llvm::Constant* ConstantVisitor::operator() ( const ConstantExpression& c)
@@ -57,11 +62,26 @@ namespace compiler
         throw std::runtime_error( "Usage of array access as constant value." );
     }
 
+    llvm::Constant* ConstantVisitor::operator() ( const ptr<ArraySlice>& )
+    {
+        throw std::runtime_error( "Usage of array slice as constant value." );
+    }
+
+    llvm::Constant* ConstantVisitor::operator() ( const ptr<ArrayReduction>& )
+    {
+        throw std::runtime_error( "Usage of array reduction as constant value." );
+    }
+
     llvm::Constant* ConstantVisitor::operator() ( const ptr<SubprogramCall>& )
     {
         throw std::runtime_error( "Usage of subprogram call as constant value." );
     }
 
+    llvm::Constant* ConstantVisitor::operator() ( const ptr<SetConstructor>& )
+    {
+        throw std::runtime_error( "Usage of set constructor as constant value." );
+    }
+
     llvm::Constant* ConstantVisitor::operator() ( const ptr<UnaryOperator>& un )
     {
         auto val = compile_cexpr( un->expression );
@@ -74,7 +94,11 @@ namespace compiler
 
         case UnaryOperator::OPERATOR::NOT:
             return llvm::ConstantExpr::getNot(val);
+
+        case UnaryOperator::OPERATOR::CARD:
+            break;
         }
+        throw std::runtime_error( "Usage of set cardinality as constant value." );
     }
 
     llvm::Constant* ConstantVisitor::operator() ( const ptr<BinaryOperator>& bin )
@@ -125,7 +149,11 @@ namespace compiler
 
             case BinaryOperator::OPERATOR::XOR:
                 return llvm::ConstantExpr::getXor(lhs, rhs);
+
+            case BinaryOperator::OPERATOR::IN:
+                break;
         }
+        throw std::runtime_error( "Usage of set membership as constant value." );
     }
 
 /******************************************************************/
@@ -158,347 +186,1980 @@ namespace compiler
         }
     }
 
-    llvm::Type* ConstantVisitor::operator() ( const ptr<Array>& )
-    {
-        throw std::runtime_error( "TODO" );
-    }
-
-/******************************************************************/
-
-    llvm::Value* ExprVisitor::local_or_global ( const std::string& name )
+    llvm::Type* ConstantVisitor::operator() ( const ptr<Array>& arr )
     {
-        auto loc = m_Locals.find(name);
-        if ( loc.has_value() ){
-            return loc.value();
+        // Elements from the low bounds on, the bounds were checked by the semantic analysis.
+        // More dimensions are flattened into a single row-major block
+        uint64_t count = 1;
+        for ( auto dim : dimensions( arr ) ){
+            count *= constant_int( dim->highBound ) - constant_int( dim->lowBound ) + 1;
         }
 
-        auto glob = m_Module.getNamedGlobal(name);
-        if ( glob == nullptr ){
-            throw std::runtime_error( "Usage of undeclared " + name );
+        // Packed elements are the bits of 64-bit words, from the lowest one
+        if ( arr->packed ){
+            return llvm::ArrayType::get( m_Builder.getInt64Ty(), ( count + 63 ) / 64 );
         }
-
-        return glob;
+        return llvm::ArrayType::get( compile_t( element_type( arr ) ), count );
     }
 
-/******************************************************************/
-
-    llvm::Value* ExprVisitor::operator() ( const VariableAccess& va )
+    llvm::Type* ConstantVisitor::operator() ( const ptr<DynamicArray>& arr )
     {
-        auto val = local_or_global(va.identifier);
-        return m_Builder.CreateLoad( m_Builder.getInt32Ty(), val, va.identifier );
+        // Descriptor with the elements, their number and the slot of the arena owning them
+        auto bytePtr = m_Builder.getInt8PtrTy();
+        return llvm::StructType::get( m_Context, {
+            compile_t( arr->elementType )->getPointerTo(),
+            m_Builder.getInt64Ty(),
+            bytePtr->getPointerTo()
+        } );
     }
 
-    llvm::Value* ExprVisitor::operator() ( const ConstantExpression& c )
+    llvm::Type* ConstantVisitor::operator() ( const ptr<Set>& set )
     {
-        return compile_const ( c.value );
+        // Bit k of the words is the value low + k, the operations work on all words at once
+        auto count = constant_int( set->highBound ) - constant_int( set->lowBound ) + 1;
+        return llvm::FixedVectorType::get( m_Builder.getInt64Ty(), ( count + 63 ) / 64 );
     }
 
-    llvm::Value* ExprVisitor::operator() ( const ptr<ArrayAccess>& )
+    long long ConstantVisitor::constant_int ( const Expression& expr )
     {
-        throw std::runtime_error( "TODO" );
+        auto value = llvm::dyn_cast<llvm::ConstantInt>( compile_cexpr( expr ) );
+        if ( value == nullptr ){
+            throw std::runtime_error( "Expected a constant integer" );
+        }
+        return value->getSExtValue();
     }
 
-    // TODO writeln
-    llvm::Value* ExprVisitor::operator() ( const ptr<SubprogramCall>& sub )
+/******************************************************************/
+
+    void ArrayScopes::add ( llvm::Instruction* access, const Symbol& array )
     {
-        std::vector<llvm::Value*> args {};
-        args.reserve(sub->arguments.size());
-        for ( const auto& p : sub->arguments ){
-            args.push_back( compile_expr( p ) );
+        if ( array.scope == Symbol::SCOPE::LOCAL && m_References.count( array.index ) > 0 ){
+            return;
         }
-
-        return m_Builder.CreateCall(m_Module.getFunction(sub->functionName), args, sub->functionName);
+        m_Accesses.push_back({ access, { array.scope, array.index } });
     }
 
-    llvm::Value* ExprVisitor::operator() ( const ptr<UnaryOperator>& un )
+    void ArrayScopes::annotate ( llvm::LLVMContext& context, const std::string& name ) const
     {
-        auto val = compile_expr( un->expression );
-        switch ( un->op ){
-        case UnaryOperator::OPERATOR::PLUS:
-            return val;
+        std::map<std::pair<Symbol::SCOPE, size_t>, llvm::MDNode*> scopes {};
+        for ( const auto& [access, array] : m_Accesses ){
+            scopes.emplace( array, nullptr );
+        }
 
-        case UnaryOperator::OPERATOR::MINUS:
-            return m_Builder.CreateNeg( val );
+        // A single array has no other to be told apart from
+        if ( scopes.size() < 2 ){
+            return;
+        }
 
-        case UnaryOperator::OPERATOR::NOT:
-            return m_Builder.CreateNot(val);
+        llvm::MDBuilder md { context };
+        auto domain = md.createAnonymousAliasScopeDomain( name + ".arrays" );
+        for ( auto& [array, scope] : scopes ){
+            scope = md.createAnonymousAliasScope( domain );
         }
-    }
 
-    llvm::Value* ExprVisitor::operator() ( const ptr<BinaryOperator>& bin )
-    {
-        auto lhs = compile_expr( bin->left );
-        auto rhs = compile_expr( bin->right );
+        // Own scope and the scopes of all the other arrays, by array
+        std::map<std::pair<Symbol::SCOPE, size_t>, std::pair<llvm::MDNode*, llvm::MDNode*>> lists {};
+        for ( const auto& [array, scope] : scopes ){
+            std::vector<llvm::Metadata*> others {};
+            for ( const auto& [other, otherScope] : scopes ){
+                if ( other != array ){
+                    others.push_back( otherScope );
+                }
+            }
+            lists[array] = { llvm::MDNode::get( context, { scope } ), llvm::MDNode::get( context, others ) };
+        }
 
-        switch ( bin->op ){
-            case BinaryOperator::OPERATOR::EQ:
-                return m_Builder.CreateICmpEQ(lhs, rhs);
+        for ( const auto& [access, array] : m_Accesses ){
+            access->setMetadata( llvm::LLVMContext::MD_alias_scope, lists[array].first );
+            access->setMetadata( llvm::LLVMContext::MD_noalias, lists[array].second );
+        }
+    }
 
-            case BinaryOperator::OPERATOR::NOT_EQ:
-                return m_Builder.CreateICmpNE(lhs, rhs);
+/******************************************************************/
 
-            case BinaryOperator::OPERATOR::LESS_EQ:
-                return m_Builder.CreateICmpSLE(lhs, rhs);
+    /// Create an alloca in the entry block, so loops don't grow the stack
+    llvm::AllocaInst* entry_alloca ( llvm::Function* fun, llvm::Type* type, unsigned count, const std::string& name )
+    {
+        auto& entry = fun->getEntryBlock();
+        llvm::IRBuilder<> builder { &entry, entry.getFirstInsertionPt() };
+        return builder.CreateAlloca( type, builder.getInt32( count ), name );
+    }
 
-            case BinaryOperator::OPERATOR::LESS:
-                return m_Builder.CreateICmpSLT(lhs, rhs);
+    llvm::Value* ExprVisitor::address ( const std::optional<Symbol>& symbol )
+    {
+        if ( ! symbol.has_value() ){
+            throw std::runtime_error( "Usage of unresolved identifier" );
+        }
 
-            case BinaryOperator::OPERATOR::MORE_EQ:
-                return m_Builder.CreateICmpSGE(lhs, rhs);
+        switch ( symbol->scope ) {
+        case Symbol::SCOPE::LOCAL:
+            return m_Locals[symbol->index];
 
-            case BinaryOperator::OPERATOR::MORE:
-                return m_Builder.CreateICmpSGT(lhs, rhs);
+        case Symbol::SCOPE::GLOBAL:
+            return m_Globals.globals[symbol->index];
 
-            case BinaryOperator::OPERATOR::PLUS:
-                return m_Builder.CreateAdd(lhs, rhs);
+        case Symbol::SCOPE::BUILTIN:
+            break;
+        }
 
-            case BinaryOperator::OPERATOR::MINUS:
-                return m_Builder.CreateSub(lhs, rhs);
+        throw std::runtime_error( "Usage of a subprogram as a variable" );
+    }
 
-            case BinaryOperator::OPERATOR::TIMES:
-                return m_Builder.CreateMul(lhs, rhs);
+    /// Integer value of a literal or a named constant, nullopt for anything else
+    std::optional<long long> known_constant ( const ConstantVisitor& visitor, const Expression& expr )
+    {
+        if ( auto c = std::get_if<ConstantExpression>( &expr ) ){
+            if ( auto i = std::get_if<IntegerConstant>( &c->value ) ){
+                return i->value;
+            }
+            return std::nullopt;
+        }
 
-            case BinaryOperator::OPERATOR::DIVISION:
-            case BinaryOperator::OPERATOR::INTEGER_DIVISION:
-                return m_Builder.CreateSDiv(lhs, rhs);
+        if ( auto va = std::get_if<VariableAccess>( &expr );
+            va != nullptr && va->symbol.has_value() && va->symbol->scope == Symbol::SCOPE::GLOBAL )
+        {
+            auto glob = llvm::dyn_cast_or_null<llvm::GlobalVariable>( visitor.m_Globals.globals[va->symbol->index] );
+            if ( glob != nullptr && glob->isConstant() ){
+                if ( auto value = llvm::dyn_cast<llvm::ConstantInt>( glob->getInitializer() ) ){
+                    return value->getSExtValue();
+                }
+            }
+        }
 
-            case BinaryOperator::OPERATOR::MODULO:
-                return m_Builder.CreateSRem(lhs, rhs);
+        return std::nullopt;
+    }
 
-            case BinaryOperator::OPERATOR::AND:
-                return m_Builder.CreateAnd(lhs, rhs);
+    /// Split an index into its variable part and a constant offset, `J - 1` into J and -1
+    std::pair<std::optional<Expression>, long long> split_index ( const ConstantVisitor& visitor, const Expression& index )
+    {
+        if ( auto c = known_constant( visitor, index ); c.has_value() ){
+            return { std::nullopt, c.value() };
+        }
 
-            case BinaryOperator::OPERATOR::OR:
-                return m_Builder.CreateOr(lhs, rhs);
+        auto bin = std::get_if<ptr<BinaryOperator>>( &index );
+        if ( bin == nullptr ){
+            return { index, 0 };
+        }
 
-            case BinaryOperator::OPERATOR::XOR:
-                return m_Builder.CreateXor(lhs, rhs);
+        bool plus = (*bin)->op == BinaryOperator::OPERATOR::PLUS;
+        bool minus = (*bin)->op == BinaryOperator::OPERATOR::MINUS;
+        if ( plus || minus ){
+            if ( auto right = known_constant( visitor, (*bin)->right ); right.has_value() ){
+                auto [variable, offset] = split_index( visitor, (*bin)->left );
+                return { variable, plus ? offset + right.value() : offset - right.value() };
+            }
+        }
+        if ( plus ){
+            if ( auto left = known_constant( visitor, (*bin)->left ); left.has_value() ){
+                auto [variable, offset] = split_index( visitor, (*bin)->right );
+                return { variable, offset + left.value() };
+            }
         }
-    }
 
-/******************************************************************/
+        return { index, 0 };
+    }
 
-    // TODO redundant
-    void SubprogramVisitor::operator() ( const SubprogramCall& sub )
+    llvm::Value* ExprVisitor::position (
+        const std::optional<Symbol>& array,
+        const Many<Expression>& indexes,
+        const void* access )
     {
-        std::vector<llvm::Value*> args;
-
-        for ( const auto& a : sub.arguments ){
-            args.push_back( compile_expr( a ) );
+        // Dynamic arrays are indexed from 0, their checks are never eliminated
+        if ( std::holds_alternative<ptr<DynamicArray>>( array->type.value() ) ){
+            auto index = m_Builder.CreateSExt( compile_expr( indexes.front() ), m_Builder.getInt64Ty() );
+            if ( m_Bounds != nullptr ){
+                bounds_check( index, 0, descriptor( array ).second );
+            }
+            return index;
         }
 
-        m_Builder.CreateCall(m_Module.getFunction(sub.functionName), args, sub.functionName);
-    }
+        auto dims = dimensions( array->type.value() );
 
-    void SubprogramVisitor::operator() ( const Assignment& assign )
-    {
-        auto val = compile_expr( assign.value );
+        // Row-major, the stride of a dimension is the number of elements of the later ones
+        std::vector<long long> counts ( dims.size() ), strides ( dims.size() );
+        long long stride = 1;
+        for ( size_t d = dims.size(); d-- > 0; ){
+            counts[d] = constant_int( dims[d]->highBound ) - constant_int( dims[d]->lowBound ) + 1;
+            strides[d] = stride;
+            stride *= counts[d];
+        }
 
-        // 'function_name := val' => assign return value
-        if ( m_ReturnAddress.has_value() && m_Name == assign.variable )
+        // `X[J - 1, 2]` with X from 1, 1 to .., 1 .. 5 is the element (J - 2) * 5 + 1
+        // of the LLVM array, all constants end up in a single offset.
+        // Computed in 64 bits, so the offset can't overflow
+        auto int64 = m_Builder.getInt64Ty();
+        long long offset = 0;
+        llvm::Value* position = nullptr;
+        for ( size_t d = 0; d < dims.size(); ++d )
         {
-            m_Builder.CreateStore(val, m_ReturnAddress.value());
+            auto low = constant_int( dims[d]->lowBound );
+            auto [variable, constant] = split_index( *this, indexes[d] );
+            constant -= low;
+            offset += constant * strides[d];
+
+            llvm::Value* value = nullptr;
+            if ( variable.has_value() ){
+                value = m_Builder.CreateSExt( compile_expr( variable.value() ), int64 );
+                auto scaled = strides[d] == 1 ? value : m_Builder.CreateNSWMul( value, m_Builder.getInt64( strides[d] ) );
+                position = position == nullptr ? scaled : m_Builder.CreateNSWAdd( position, scaled );
+            }
+
+            if ( m_Bounds == nullptr ){
+                continue;
+            }
+
+            auto check = m_Bounds->check( access, d );
+            bool needed = check.kind == bounds::Check::KIND::NEEDED
+                || ( check.kind == bounds::Check::KIND::HOISTED && m_Guarded.count( check.loop ) == 0 );
+            if ( needed ){
+                llvm::Value* index = llvm::ConstantInt::get( int64, constant, true );
+                if ( value != nullptr ){
+                    index = constant == 0 ? value : m_Builder.CreateNSWAdd( value, index );
+                }
+                bounds_check( index, low, m_Builder.getInt64( counts[d] ) );
+            }
         }
-        else
-        {
-            auto ptr = local_or_global( assign.variable );
-            m_Builder.CreateStore(val, ptr);
+
+        auto constant = llvm::ConstantInt::get( int64, offset, true );
+        if ( position == nullptr ){
+            return constant;
         }
+        if ( offset != 0 ){
+            return m_Builder.CreateNSWAdd( position, constant );
+        }
+        return position;
     }
 
-    void SubprogramVisitor::operator() ( const ArrayAssignment& )
+    llvm::Value* ExprVisitor::element (
+        const std::optional<Symbol>& array,
+        const Many<Expression>& indexes,
+        const std::string& name,
+        const void* access )
     {
-        throw std::runtime_error( "TODO" );
+        auto at = position( array, indexes, access );
+        const auto& type = array->type.value();
+        if ( std::holds_alternative<ptr<DynamicArray>>( type ) ){
+            return m_Builder.CreateInBoundsGEP( compile_t( element_type( type ) ), descriptor( array ).first, at, name );
+        }
+        return m_Builder.CreateInBoundsGEP( compile_t( type ), address( array ), { m_Builder.getInt64( 0 ), at }, name );
     }
 
-    void SubprogramVisitor::operator() ( const ExitStatement& )
+    std::pair<llvm::Value*, llvm::Value*> ExprVisitor::packed_element (
+        const std::optional<Symbol>& array,
+        const Many<Expression>& indexes,
+        const std::string& name,
+        const void* access )
     {
-        if ( m_ReturnAddress.has_value() )
-        {
-            throw std::runtime_error( "Exit used outside of procedure" );
-        }
-
-        m_Builder.CreateBr( m_ReturnBlock );
+        auto base = address( array );
+        auto at = position( array, indexes, access );
 
-        auto bb = llvm::BasicBlock::Create(m_Context, "afterExit", m_Builder.GetInsertBlock()->getParent());
-        m_Builder.SetInsertPoint(bb);
+        // Positions in bounds aren't negative
+        auto word = m_Builder.CreateInBoundsGEP( compile_t( array->type.value() ), base,
+            { m_Builder.getInt64( 0 ), m_Builder.CreateLShr( at, 6 ) }, name );
+        return { word, m_Builder.CreateAnd( at, 63 ) };
     }
 
-    void SubprogramVisitor::operator() ( const BreakStatement& )
+    void ExprVisitor::bounds_check ( llvm::Value* position, long long low, llvm::Value* count )
     {
-        if ( ! m_LoopContinuation.has_value() )
-        {
-            throw std::runtime_error( "Break used outside of loop" );
+        auto parent = m_Builder.GetInsertBlock()->getParent();
+        auto int32 = m_Builder.getInt32Ty();
+
+        // Positions below the low bound are negative, so huge unsigned
+        auto inBounds = m_Builder.CreateICmpULT( position, count, "inBounds" );
+        auto okBB = llvm::BasicBlock::Create( m_Context, "inBounds", parent );
+        auto errorBB = llvm::BasicBlock::Create( m_Context, "outOfBounds", parent );
+        m_Builder.CreateCondBr( inBounds, okBB, errorBB,
+            llvm::MDBuilder( m_Context ).createBranchWeights( 1 << 20, 1 ) );
+
+        // `void mila_bounds_error(i32 index, i32 low, i32 high, i32 line)` exits the program
+        m_Builder.SetInsertPoint( errorBB );
+        auto errorType = llvm::FunctionType::get( m_Builder.getVoidTy(), { int32, int32, int32, int32 }, false );
+        auto error = m_Module.getOrInsertFunction( "mila_bounds_error", errorType );
+        if ( auto fun = llvm::dyn_cast<llvm::Function>( error.getCallee() ) ){
+            fun->addFnAttr( llvm::Attribute::NoReturn );
+            fun->addFnAttr( llvm::Attribute::NoUnwind );
+            fun->addFnAttr( llvm::Attribute::Cold );
         }
 
-        m_Builder.CreateBr( m_LoopContinuation.value() );
-
-        auto bb = llvm::BasicBlock::Create(m_Context, "afterBreak", m_Builder.GetInsertBlock()->getParent());
-        m_Builder.SetInsertPoint(bb);
+        auto index = m_Builder.CreateTrunc( m_Builder.CreateAdd( position, m_Builder.getInt64( low ) ), int32 );
+        auto call = m_Builder.CreateCall( error, {
+            index,
+            m_Builder.getInt32( low ),
+            m_Builder.CreateTrunc( m_Builder.CreateAdd( count, m_Builder.getInt64( low - 1 ) ), int32 ),
+            m_Builder.getInt32( m_Location.line )
+        } );
+        call->setDoesNotReturn();
+        m_Builder.CreateUnreachable();
+
+        m_Builder.SetInsertPoint( okBB );
     }
 
-    void SubprogramVisitor::operator() ( const EmptyStatement& )
+    std::pair<llvm::Value*, llvm::Value*> ExprVisitor::descriptor ( const std::optional<Symbol>& array )
     {
-        return;
+        // The descriptor belongs to the array like its elements, so it gets their alias scope
+        auto type = llvm::cast<llvm::StructType>( compile_t( array->type.value() ) );
+        auto addr = address( array );
+        auto data = m_Builder.CreateLoad( type->getElementType( 0 ), m_Builder.CreateStructGEP( type, addr, 0 ), "data" );
+        auto length = m_Builder.CreateLoad( m_Builder.getInt64Ty(), m_Builder.CreateStructGEP( type, addr, 1 ), "length" );
+        array_access( data, array );
+        array_access( length, array );
+        return { data, length };
     }
 
-    void SubprogramVisitor::operator() ( const ptr<Block>& bl )
+    Elements ExprVisitor::elements ( const std::optional<Symbol>& array )
     {
-        compile_block(*bl);
+        const auto& type = array->type.value();
+        if ( std::holds_alternative<ptr<DynamicArray>>( type ) ){
+            auto [data, length] = descriptor( array );
+            return { data, length, 1, compile_t( element_type( type ) ) };
+        }
+
+        auto llvmType = llvm::cast<llvm::ArrayType>( compile_t( type ) );
+        auto first = m_Builder.CreateInBoundsGEP( llvmType, address( array ), { m_Builder.getInt64( 0 ), m_Builder.getInt64( 0 ) } );
+        long long count = llvmType->getNumElements();
+
+        const auto& dim = *dimensions( type ).front();
+        if ( dim.packed ){
+            return { first, m_Builder.getInt64( 1 ), count, m_Builder.getInt64Ty() };
+        }
+
+        auto rows = constant_int( dim.highBound ) - constant_int( dim.lowBound ) + 1;
+        return { first, m_Builder.getInt64( rows ), count / rows, llvmType->getElementType() };
     }
 
-    void SubprogramVisitor::operator() ( const ptr<If>& if_ )
+    Elements ExprVisitor::elements ( const ArraySlice& slice )
     {
-        auto parent = m_Builder.GetInsertBlock()->getParent();
+        auto whole = elements( slice.symbol );
+        long long low = 0;
+        auto count = whole.rows;
+        if ( auto dims = dimensions( slice.symbol->type.value() ); ! dims.empty() ){
+            low = constant_int( dims.front()->lowBound );
+        }
 
-        auto trueBB = llvm::BasicBlock::Create(m_Context, "trueBranch", parent);
-        auto falseBB = llvm::BasicBlock::Create(m_Context, "falseBranch", parent);
-        auto continueBB = llvm::BasicBlock::Create( m_Context, "afterIf", parent );
+        auto int64 = m_Builder.getInt64Ty();
+        auto zero = m_Builder.getInt64( 0 );
+        auto from = m_Builder.CreateNSWSub( m_Builder.CreateSExt( compile_expr( slice.low ), int64 ), m_Builder.getInt64( low ) );
+        auto to = m_Builder.CreateNSWSub( m_Builder.CreateSExt( compile_expr( slice.high ), int64 ), m_Builder.getInt64( low ) );
+        auto empty = m_Builder.CreateICmpSLT( to, from, "empty" );
 
-        // conditional jump
-        auto cond = compile_expr(if_->condition);
-        m_Builder.CreateCondBr( cond, trueBB, falseBB );
+        // Both ends of a slice with elements are within the array
+        if ( m_Bounds != nullptr ){
+            bounds_check( m_Builder.CreateSelect( empty, zero, from ), low, count );
+            bounds_check( m_Builder.CreateSelect( empty, zero, to ), low, count );
+        }
 
-        // compile true branch
-        m_Builder.SetInsertPoint( trueBB );
-        compile_stm( if_->trueCode );
-        m_Builder.CreateBr(continueBB);
+        auto rows = m_Builder.CreateNSWAdd( m_Builder.CreateNSWSub( to, from ), m_Builder.getInt64( 1 ) );
+        auto start = m_Builder.CreateNSWMul( m_Builder.CreateSelect( empty, zero, from ), m_Builder.getInt64( whole.stride ) );
+        whole.first = m_Builder.CreateInBoundsGEP( whole.type, whole.first, start, slice.array );
+        whole.rows = m_Builder.CreateSelect( empty, zero, rows, "rows" );
+        return whole;
+    }
 
-        // compile false branch
-        m_Builder.SetInsertPoint( falseBB );
-        if ( if_->elseCode.has_value() )
-        {
-            compile_stm( if_->elseCode.value());
+    Elements ExprVisitor::elements ( const Expression& array )
+    {
+        if ( auto sl = std::get_if<ptr<ArraySlice>>( &array ) ){
+            return elements( **sl );
         }
-        m_Builder.CreateBr(continueBB);
-
-        // switch to continuation
-        m_Builder.SetInsertPoint( continueBB );
+        return elements( std::get<VariableAccess>( array ).symbol );
     }
 
-    void SubprogramVisitor::operator() ( const ptr<While>& wh )
+    /// Array of a whole array or a slice
+    const std::optional<Symbol>& array_symbol ( const Expression& array )
     {
-        compile_loop(wh->condition, wh->code);
+        if ( auto sl = std::get_if<ptr<ArraySlice>>( &array ) ){
+            return (*sl)->symbol;
+        }
+        return std::get<VariableAccess>( array ).symbol;
     }
 
-    void SubprogramVisitor::operator() ( const ptr<For>& fo )
+    /// Whether an expression is a whole array or a slice, whose elements are copied
+    bool array_value ( const Expression& expr )
     {
-        // initialization
-        // `for iterator ...`
-        auto iterator = local_or_global( fo->loopVariable );
-        auto init = compile_expr( fo->initialization );
-        m_Builder.CreateStore( init, iterator );
+        if ( std::holds_alternative<ptr<ArraySlice>>( expr ) ){
+            return true;
+        }
+        auto va = std::get_if<VariableAccess>( &expr );
+        return va != nullptr && array_type( va->symbol->type.value() );
+    }
 
-        // Transform a for loop to while loop
-        // to     => while ( x <= target )
-        // downto =>         x >=
-        ast::Expression loopVar = ast::VariableAccess { fo->loopVariable };
-        ast::Expression cond;
-        switch (fo->direction) {
-        case For::DIRECTION::TO:
-            cond = make_ptr<BinaryOperator>(
-                BinaryOperator::OPERATOR::LESS_EQ, loopVar, fo->target );
-            break;
+    void ExprVisitor::compile_strips (
+        llvm::Value* count,
+        unsigned width,
+        const std::function<void( llvm::Value*, unsigned )>& body,
+        const std::string& name )
+    {
+        auto parent = m_Builder.GetInsertBlock()->getParent();
+        auto int64 = m_Builder.getInt64Ty();
 
-        case For::DIRECTION::DOWNTO:
-            cond = make_ptr<BinaryOperator>(
-                BinaryOperator::OPERATOR::MORE_EQ, loopVar, fo->target );
-            break;
+        // Whole strips up to the multiple of the width, then the rest one by one
+        std::vector<std::pair<llvm::Value*, unsigned>> loops { { m_Builder.CreateAnd( count, -(long long)width ), width } };
+        if ( width > 1 ){
+            loops.emplace_back( count, 1 );
         }
 
-        compile_loop(cond, fo->code);
+        llvm::Value* start = m_Builder.getInt64( 0 );
+        for ( auto [end, step] : loops ){
+            auto bodyBB = llvm::BasicBlock::Create( m_Context, name + "Body", parent );
+            auto continueBB = llvm::BasicBlock::Create( m_Context, "after" + name, parent );
+            auto guardBB = m_Builder.GetInsertBlock();
+            m_Builder.CreateCondBr( m_Builder.CreateICmpSLT( start, end ), bodyBB, continueBB );
+
+            m_Builder.SetInsertPoint( bodyBB );
+            auto position = m_Builder.CreatePHI( int64, 2, name );
+            position->addIncoming( start, guardBB );
+            body( position, step );
+            auto next = m_Builder.CreateNSWAdd( position, m_Builder.getInt64( step ) );
+            position->addIncoming( next, m_Builder.GetInsertBlock() );
+            m_Builder.CreateCondBr( m_Builder.CreateICmpSLT( next, end ), bodyBB, continueBB );
+
+            m_Builder.SetInsertPoint( continueBB );
+            start = end;
+        }
     }
 
-/******************************************************************/
-
-    void SubprogramVisitor::compile_block ( const Block& code )
+    void ExprVisitor::array_access ( llvm::Instruction* access, const std::optional<Symbol>& array )
     {
-        for ( const auto& st : code.statements ){
-            compile_stm( st );
+        if ( m_ArrayScopes != nullptr ){
+            m_ArrayScopes->add( access, array.value() );
         }
     }
 
-    void SubprogramVisitor::compile_loop ( Expression condition, Statement block )
+    llvm::Function* ExprVisitor::callee ( const SubprogramCall& sub )
     {
-        auto parent = m_Builder.GetInsertBlock()->getParent();
+        if ( ! sub.symbol.has_value() || sub.symbol->scope == Symbol::SCOPE::LOCAL ){
+            throw std::runtime_error( "Call of undeclared subprogram " + sub.functionName );
+        }
 
-        auto condBB = llvm::BasicBlock::Create(m_Context, "loopCond", parent);
-        auto bodyBB = llvm::BasicBlock::Create(m_Context, "loopBody", parent);
-        auto continueBB = llvm::BasicBlock::Create(m_Context, "afterLoop", parent);
+        if ( sub.symbol->scope == Symbol::SCOPE::BUILTIN ){
+            return m_Globals.builtins[sub.symbol->index];
+        }
 
-        m_Builder.CreateBr(condBB);
+        return llvm::cast<llvm::Function>( m_Globals.globals[sub.symbol->index] );
+    }
 
-        // compile condition
-        m_Builder.SetInsertPoint( condBB );
-        auto cond = compile_expr( condition );
-        m_Builder.CreateCondBr( cond, bodyBB, continueBB );
+    std::vector<llvm::Value*> ExprVisitor::compile_arguments ( const SubprogramCall& sub, llvm::Function* fun )
+    {
+        std::vector<llvm::Value*> args {};
+        args.reserve( sub.arguments.size() );
+        for ( size_t i = 0; i < sub.arguments.size(); ++i ){
+            if ( ! fun->getArg( i )->getType()->isPointerTy() ){
+                args.push_back( compile_expr( sub.arguments[i] ) );
+                continue;
+            }
 
-        // this is done so nested loops don't break
-        auto prevLoop = m_LoopContinuation;
-        m_LoopContinuation = continueBB;
+            // Var and const parameters take the address of a variable or an element,
+            // other values of const parameters are passed in a temporary
+            const auto& arg = sub.arguments[i];
+            if ( auto va = std::get_if<VariableAccess>( &arg ) ){
+                args.push_back( address( va->symbol ) );
+            }
+            else if ( addressable( arg ) != nullptr ){
+                const auto& arr = std::get<ptr<ArrayAccess>>( arg );
+                args.push_back( element( arr->symbol, arr->indexes, arr->array, arr.get() ) );
+            }
+            else {
+                auto value = compile_expr( arg );
+                auto temporary = entry_alloca( m_Builder.GetInsertBlock()->getParent(), value->getType(), 1, "argument" );
+                m_Builder.CreateStore( value, temporary );
+                args.push_back( temporary );
+            }
+        }
+        return args;
+    }
 
-        // compile body
-        m_Builder.SetInsertPoint( bodyBB );
-        compile_stm( block );
-        m_Builder.CreateBr( condBB );
+    llvm::CallInst* ExprVisitor::compile_call ( const SubprogramCall& sub )
+    {
+        auto fun = callee( sub );
+        auto args = compile_arguments( sub, fun );
 
-        // switch to continuation
-        m_Builder.SetInsertPoint( continueBB );
-        m_LoopContinuation = prevLoop;
+        // Void values can't be named
+        std::string name = fun->getReturnType()->isVoidTy() ? "" : sub.functionName;
+
+        auto call = m_Builder.CreateCall( fun, args, name );
+        call->setCallingConv( fun->getCallingConv() );
+        attributes::apply_call( *call, *fun );
+        return call;
     }
 
 /******************************************************************/
 
-
-    void ProgramVisitor::operator() ( const ProcedureDecl& proc )
+    llvm::Value* ExprVisitor::operator() ( const VariableAccess& va )
     {
-        compile_subprogram_decl(proc.name, proc.parameters, std::nullopt);
+        if ( ! va.symbol.has_value() ){
+            throw std::runtime_error( "Usage of undeclared " + va.identifier );
+        }
+
+        return m_Builder.CreateLoad( compile_t( va.symbol->type.value() ), address( va.symbol ), va.identifier );
     }
 
-    void ProgramVisitor::operator() ( const Procedure& proc )
+    llvm::Value* ExprVisitor::operator() ( const ConstantExpression& c )
     {
-        compile_subprogram(
-            proc.name,
-            proc.parameters,
-            proc.variables,
-            std::nullopt,
-            proc.code
-        );
+        return compile_const ( c.value );
     }
 
-    void ProgramVisitor::operator() ( const FunctionDecl& fun )
+    llvm::Value* ExprVisitor::operator() ( const ptr<ArrayAccess>& arr )
     {
-        compile_subprogram_decl(fun.name, fun.parameters, fun.returnType);
+        if ( packed( arr->symbol->type.value() ) ){
+            auto [word, bit] = packed_element( arr->symbol, arr->indexes, arr->array, arr.get() );
+            auto load = m_Builder.CreateLoad( m_Builder.getInt64Ty(), word, arr->array );
+            array_access( load, arr->symbol );
+            return m_Builder.CreateTrunc( m_Builder.CreateLShr( load, bit ), m_Builder.getInt1Ty(), arr->array );
+        }
+
+        auto addr = element( arr->symbol, arr->indexes, arr->array, arr.get() );
+        const auto& type = element_type( arr->symbol->type.value() );
+
+        auto load = m_Builder.CreateLoad( compile_t( type ), addr, arr->array );
+        array_access( load, arr->symbol );
+        return load;
     }
 
-    void ProgramVisitor::operator() ( const Function& fun )
+    llvm::Value* ExprVisitor::operator() ( const ptr<ArraySlice>& sl )
     {
-        compile_subprogram(
-            fun.name,
-            fun.parameters,
-            fun.variables,
-            fun.returnType,
-            fun.code
-        );
+        throw std::runtime_error( "Usage of slice of " + sl->array + " as a value" );
     }
 
-    void ProgramVisitor::operator() ( const NamedConstant& c )
+    /// Number of integers reduced together by array reductions
+    constexpr unsigned REDUCTION_WIDTH = 8;
+
+    llvm::Value* ExprVisitor::operator() ( const ptr<ArrayReduction>& red )
     {
-        auto val = compile_cexpr( c.value );
-        new llvm::GlobalVariable(
-            m_Module,
-            val->getType(),
+        // Rows of a packed array are its words, so its length comes from the bounds
+        if ( red->op == ArrayReduction::OPERATOR::LENGTH ){
+            auto va = std::get_if<VariableAccess>( &red->array );
+            if ( va != nullptr && std::holds_alternative<ptr<Array>>( va->symbol->type.value() ) ){
+                const auto& dim = *dimensions( va->symbol->type.value() ).front();
+                return m_Builder.getInt32( constant_int( dim.highBound ) - constant_int( dim.lowBound ) + 1 );
+            }
+            return m_Builder.CreateTrunc( elements( red->array ).rows, m_Builder.getInt32Ty(), "length" );
+        }
+
+        auto elems = elements( red->array );
+        const auto& symbol = array_symbol( red->array );
+        auto int32 = m_Builder.getInt32Ty();
+        auto vectorType = llvm::FixedVectorType::get( int32, REDUCTION_WIDTH );
+
+        auto combine = [this, &red]( llvm::Value* a, llvm::Value* b ) -> llvm::Value* {
+            switch ( red->op ) {
+            case ArrayReduction::OPERATOR::SUM:
+                return m_Builder.CreateAdd( a, b );
+            case ArrayReduction::OPERATOR::MIN:
+                return m_Builder.CreateBinaryIntrinsic( llvm::Intrinsic::smin, a, b );
+            case ArrayReduction::OPERATOR::MAX:
+                return m_Builder.CreateBinaryIntrinsic( llvm::Intrinsic::smax, a, b );
+            case ArrayReduction::OPERATOR::LENGTH:
+                break;
+            }
+            throw std::runtime_error( "Unknown reduction" );
+        };
+
+        // Strips are combined lane by lane in a vector, the rest in a scalar
+        int32_t identity = red->op == ArrayReduction::OPERATOR::SUM ? 0
+            : red->op == ArrayReduction::OPERATOR::MIN ? INT32_MAX : INT32_MIN;
+        auto parent = m_Builder.GetInsertBlock()->getParent();
+        auto strips = entry_alloca( parent, vectorType, 1, "strips" );
+        auto rest = entry_alloca( parent, int32, 1, "rest" );
+        m_Builder.CreateStore( m_Builder.CreateVectorSplat( REDUCTION_WIDTH, m_Builder.getInt32( identity ) ), strips );
+        m_Builder.CreateStore( m_Builder.getInt32( identity ), rest );
+
+        auto count = m_Builder.CreateNSWMul( elems.rows, m_Builder.getInt64( elems.stride ) );
+        compile_strips( count, REDUCTION_WIDTH, [&]( llvm::Value* position, unsigned width ){
+            auto type = width == 1 ? static_cast<llvm::Type*>( int32 ) : vectorType;
+            auto accumulator = width == 1 ? rest : strips;
+            auto at = m_Builder.CreateInBoundsGEP( int32, elems.first, position );
+            auto load = m_Builder.CreateAlignedLoad( type, m_Builder.CreatePointerCast( at, type->getPointerTo() ), llvm::Align( 4 ) );
+            array_access( load, symbol );
+            m_Builder.CreateStore( combine( m_Builder.CreateLoad( type, accumulator ), load ), accumulator );
+        }, "reduce" );
+
+        auto lanes = m_Builder.CreateLoad( vectorType, strips );
+        llvm::Value* reduced = nullptr;
+        switch ( red->op ) {
+        case ArrayReduction::OPERATOR::SUM:
+            reduced = m_Builder.CreateAddReduce( lanes );
+            break;
+        case ArrayReduction::OPERATOR::MIN:
+            reduced = m_Builder.CreateIntMinReduce( lanes, true );
+            break;
+        case ArrayReduction::OPERATOR::MAX:
+            reduced = m_Builder.CreateIntMaxReduce( lanes, true );
+            break;
+        case ArrayReduction::OPERATOR::LENGTH:
+            break;
+        }
+        return combine( reduced, m_Builder.CreateLoad( int32, rest ) );
+    }
+
+    llvm::Value* ExprVisitor::operator() ( const ptr<SubprogramCall>& sub )
+    {
+        return compile_call( *sub );
+    }
+
+    llvm::Value* ExprVisitor::operator() ( const ptr<SetConstructor>& set )
+    {
+        return compile_set( *set );
+    }
+
+    llvm::Value* ExprVisitor::compile_set ( const SetConstructor& set )
+    {
+        const auto& type = *std::get<ptr<Set>>( set.type.value() );
+        auto low = constant_int( type.lowBound );
+        auto count = constant_int( type.highBound ) - low + 1;
+        auto vectorType = llvm::cast<llvm::FixedVectorType>( compile_t( set.type.value() ) );
+        auto words = vectorType->getNumElements();
+        auto int64 = m_Builder.getInt64Ty();
+
+        // Constant elements are set in the initial words
+        std::vector<uint64_t> bits ( words, 0 );
+        std::vector<const SetElement*> computed {};
+        for ( const auto& e : set.elements ){
+            auto first = known_constant( *this, e.first );
+            auto last = e.last.has_value() ? known_constant( *this, e.last.value() ) : first;
+            if ( ! first.has_value() || ! last.has_value() ){
+                computed.push_back( &e );
+                continue;
+            }
+
+            for ( auto v = std::max( first.value(), low ); v <= std::min( last.value(), low + count - 1 ); ++v ){
+                bits[( v - low ) / 64] |= 1ull << ( ( v - low ) % 64 );
+            }
+        }
+
+        std::vector<llvm::Constant*> initial {}, starts {}, ends {};
+        for ( unsigned w = 0; w < words; ++w ){
+            initial.push_back( m_Builder.getInt64( bits[w] ) );
+            starts.push_back( m_Builder.getInt64( w * 64 ) );
+            ends.push_back( m_Builder.getInt64( std::min<long long>( w * 64 + 63, count - 1 ) ) );
+        }
+
+        llvm::Value* acc = llvm::ConstantVector::get( initial );
+        auto zero = llvm::Constant::getNullValue( vectorType );
+        for ( auto e : computed )
+        {
+            // Positions in the set, values outside of its type are left out
+            auto first = m_Builder.CreateSub( m_Builder.CreateSExt( compile_expr( e->first ), int64 ), m_Builder.getInt64( low ) );
+            if ( ! e->last.has_value() ){
+                auto inSet = m_Builder.CreateICmpULT( first, m_Builder.getInt64( count ) );
+                auto index = words == 1
+                    ? m_Builder.getInt64( 0 )
+                    : m_Builder.CreateSelect( inSet, m_Builder.CreateLShr( first, 6 ), m_Builder.getInt64( 0 ) );
+                auto bit = m_Builder.CreateShl( m_Builder.getInt64( 1 ), m_Builder.CreateAnd( first, 63 ) );
+                auto word = m_Builder.CreateOr( m_Builder.CreateExtractElement( acc, index ),
+                    m_Builder.CreateSelect( inSet, bit, m_Builder.getInt64( 0 ) ) );
+                acc = m_Builder.CreateInsertElement( acc, word, index );
+                continue;
+            }
+
+            // Every word gets the bits of the range clamped to it, the
+            // shifts of words the range misses are out of range but not selected
+            auto last = m_Builder.CreateSub( m_Builder.CreateSExt( compile_expr( e->last.value() ), int64 ), m_Builder.getInt64( low ) );
+            auto start = llvm::ConstantVector::get( starts );
+            auto from = m_Builder.CreateSub( m_Builder.CreateBinaryIntrinsic( llvm::Intrinsic::smax,
+                m_Builder.CreateVectorSplat( words, first ), start ), start );
+            auto to = m_Builder.CreateSub( m_Builder.CreateBinaryIntrinsic( llvm::Intrinsic::smin,
+                m_Builder.CreateVectorSplat( words, last ), llvm::ConstantVector::get( ends ) ), start );
+
+            auto ones = llvm::Constant::getAllOnesValue( vectorType );
+            auto mask = m_Builder.CreateAnd(
+                m_Builder.CreateShl( ones, from ),
+                m_Builder.CreateLShr( ones, m_Builder.CreateSub( m_Builder.CreateVectorSplat( words, m_Builder.getInt64( 63 ) ), to ) ) );
+            acc = m_Builder.CreateOr( acc, m_Builder.CreateSelect( m_Builder.CreateICmpSLE( from, to ), mask, zero ) );
+        }
+
+        return acc;
+    }
+
+    llvm::Value* ExprVisitor::compile_membership ( llvm::Value* value, llvm::Value* set, const Set& type )
+    {
+        auto int64 = m_Builder.getInt64Ty();
+        auto low = constant_int( type.lowBound );
+        auto count = constant_int( type.highBound ) - low + 1;
+        auto words = llvm::cast<llvm::FixedVectorType>( set->getType() )->getNumElements();
+
+        // Values outside of the type aren't in the set, any word can be read for them
+        auto at = m_Builder.CreateSub( m_Builder.CreateSExt( value, int64 ), m_Builder.getInt64( low ) );
+        auto inType = m_Builder.CreateICmpULT( at, m_Builder.getInt64( count ) );
+        auto index = words == 1
+            ? m_Builder.getInt64( 0 )
+            : m_Builder.CreateSelect( inType, m_Builder.CreateLShr( at, 6 ), m_Builder.getInt64( 0 ) );
+        auto word = m_Builder.CreateExtractElement( set, index );
+        auto bit = m_Builder.CreateTrunc( m_Builder.CreateLShr( word, m_Builder.CreateAnd( at, 63 ) ), m_Builder.getInt1Ty() );
+        return m_Builder.CreateAnd( inType, bit, "in" );
+    }
+
+    /// Type of an expression whose value is a set
+    const Set& set_type ( const Expression& expr )
+    {
+        const Set* set = wrap( expr ).visit(
+            []( const VariableAccess& va ) -> const Set* {
+                return std::get<ptr<Set>>( va.symbol->type.value() ).get();
+            },
+            []( const ptr<ArrayAccess>& arr ) -> const Set* {
+                return std::get<ptr<Set>>( element_type( arr->symbol->type.value() ) ).get();
+            },
+            []( const ptr<SubprogramCall>& sub ) -> const Set* {
+                return std::get<ptr<Set>>( sub->symbol->type.value() ).get();
+            },
+            []( const ptr<SetConstructor>& set ) -> const Set* {
+                return std::get<ptr<Set>>( set->type.value() ).get();
+            },
+            // Both operands of set operators have the same type
+            []( const ptr<BinaryOperator>& bin ) -> const Set* {
+                return &set_type( bin->left );
+            },
+            []( const auto& ) -> const Set* {
+                throw std::runtime_error( "Expected a set" );
+            }
+        );
+        return *set;
+    }
+
+    llvm::Value* ExprVisitor::operator() ( const ptr<UnaryOperator>& un )
+    {
+        auto val = compile_expr( un->expression );
+        switch ( un->op ){
+        case UnaryOperator::OPERATOR::PLUS:
+            return val;
+
+        case UnaryOperator::OPERATOR::MINUS:
+            return m_Builder.CreateNeg( val );
+
+        case UnaryOperator::OPERATOR::NOT:
+            return m_Builder.CreateNot(val);
+
+        case UnaryOperator::OPERATOR::CARD:
+            return m_Builder.CreateTrunc(
+                m_Builder.CreateAddReduce( m_Builder.CreateUnaryIntrinsic( llvm::Intrinsic::ctpop, val ) ),
+                m_Builder.getInt32Ty(), "card" );
+        }
+    }
+
+    llvm::Value* ExprVisitor::operator() ( const ptr<BinaryOperator>& bin )
+    {
+        auto lhs = compile_expr( bin->left );
+        auto rhs = compile_expr( bin->right );
+
+        if ( bin->op == BinaryOperator::OPERATOR::IN ){
+            return compile_membership( lhs, rhs, set_type( bin->right ) );
+        }
+
+        // Sets work on all their words at once
+        if ( lhs->getType()->isVectorTy() ){
+            auto zero = llvm::Constant::getNullValue( lhs->getType() );
+            switch ( bin->op ){
+            case BinaryOperator::OPERATOR::PLUS:
+                return m_Builder.CreateOr( lhs, rhs );
+
+            case BinaryOperator::OPERATOR::TIMES:
+                return m_Builder.CreateAnd( lhs, rhs );
+
+            case BinaryOperator::OPERATOR::MINUS:
+                return m_Builder.CreateAnd( lhs, m_Builder.CreateNot( rhs ) );
+
+            case BinaryOperator::OPERATOR::EQ:
+                return m_Builder.CreateAndReduce( m_Builder.CreateICmpEQ( lhs, rhs ) );
+
+            case BinaryOperator::OPERATOR::NOT_EQ:
+                return m_Builder.CreateOrReduce( m_Builder.CreateICmpNE( lhs, rhs ) );
+
+            // Subset and superset, no element of one is missing from the other
+            case BinaryOperator::OPERATOR::LESS_EQ:
+                return m_Builder.CreateAndReduce( m_Builder.CreateICmpEQ( m_Builder.CreateAnd( lhs, m_Builder.CreateNot( rhs ) ), zero ) );
+
+            case BinaryOperator::OPERATOR::MORE_EQ:
+                return m_Builder.CreateAndReduce( m_Builder.CreateICmpEQ( m_Builder.CreateAnd( rhs, m_Builder.CreateNot( lhs ) ), zero ) );
+
+            default:
+                throw std::runtime_error( "Unsupported operator on sets" );
+            }
+        }
+
+        switch ( bin->op ){
+            case BinaryOperator::OPERATOR::EQ:
+                return m_Builder.CreateICmpEQ(lhs, rhs);
+
+            case BinaryOperator::OPERATOR::NOT_EQ:
+                return m_Builder.CreateICmpNE(lhs, rhs);
+
+            case BinaryOperator::OPERATOR::LESS_EQ:
+                return m_Builder.CreateICmpSLE(lhs, rhs);
+
+            case BinaryOperator::OPERATOR::LESS:
+                return m_Builder.CreateICmpSLT(lhs, rhs);
+
+            case BinaryOperator::OPERATOR::MORE_EQ:
+                return m_Builder.CreateICmpSGE(lhs, rhs);
+
+            case BinaryOperator::OPERATOR::MORE:
+                return m_Builder.CreateICmpSGT(lhs, rhs);
+
+            case BinaryOperator::OPERATOR::PLUS:
+                return m_Builder.CreateAdd(lhs, rhs);
+
+            case BinaryOperator::OPERATOR::MINUS:
+                return m_Builder.CreateSub(lhs, rhs);
+
+            case BinaryOperator::OPERATOR::TIMES:
+                return m_Builder.CreateMul(lhs, rhs);
+
+            case BinaryOperator::OPERATOR::DIVISION:
+            case BinaryOperator::OPERATOR::INTEGER_DIVISION:
+                return m_Builder.CreateSDiv(lhs, rhs);
+
+            case BinaryOperator::OPERATOR::MODULO:
+                return m_Builder.CreateSRem(lhs, rhs);
+
+            case BinaryOperator::OPERATOR::AND:
+                return m_Builder.CreateAnd(lhs, rhs);
+
+            case BinaryOperator::OPERATOR::OR:
+                return m_Builder.CreateOr(lhs, rhs);
+
+            case BinaryOperator::OPERATOR::XOR:
+                return m_Builder.CreateXor(lhs, rhs);
+
+            case BinaryOperator::OPERATOR::IN:
+                break;
+        }
+        throw std::runtime_error( "Unsupported binary operator" );
+    }
+
+/******************************************************************/
+
+    void SubprogramVisitor::operator() ( const SubprogramCall& sub )
+    {
+        // Procedure returning right after calling another one
+        if ( m_Tail && ! m_ReturnAddress.has_value() && compile_tail_call( sub ) ){
+            return;
+        }
+
+        compile_call( sub );
+    }
+
+    void SubprogramVisitor::operator() ( const Assignment& assign )
+    {
+        auto addr = address( assign.symbol );
+
+        // 'function_name := f(...)' followed by the return
+        if ( m_Tail && m_ReturnAddress.has_value() && m_ReturnAddress.value() == addr ){
+            auto sub = std::get_if<ptr<SubprogramCall>>( &assign.value );
+            if ( sub != nullptr && compile_tail_call( **sub ) ){
+                return;
+            }
+        }
+
+        if ( array_type( assign.symbol->type.value() ) ){
+            compile_array_assignment( elements( assign.symbol ), assign.symbol, assign.value );
+            return;
+        }
+
+        // 'function_name := val' stores to the result slot
+        auto val = compile_expr( assign.value );
+        m_Builder.CreateStore(val, addr);
+    }
+
+    void SubprogramVisitor::operator() ( const ArrayAssignment& assign )
+    {
+        if ( packed( assign.symbol->type.value() ) ){
+            auto [word, bit] = packed_element( assign.symbol, assign.indexes, assign.array, &assign );
+            auto value = compile_expr( assign.value );
+            auto int64 = m_Builder.getInt64Ty();
+            auto mask = m_Builder.CreateShl( m_Builder.getInt64( 1 ), bit );
+
+            // Other iterations may store other bits of the word, a known value takes a single operation
+            if ( m_Parallel ){
+                auto constant = llvm::dyn_cast<llvm::ConstantInt>( value );
+                if ( constant == nullptr || constant->isZero() ){
+                    array_access( m_Builder.CreateAtomicRMW( llvm::AtomicRMWInst::And, word, m_Builder.CreateNot( mask ),
+                        llvm::MaybeAlign( 8 ), llvm::AtomicOrdering::Monotonic ), assign.symbol );
+                }
+                if ( constant == nullptr || constant->isOne() ){
+                    auto bits = m_Builder.CreateShl( m_Builder.CreateZExt( value, int64 ), bit );
+                    array_access( m_Builder.CreateAtomicRMW( llvm::AtomicRMWInst::Or, word, bits,
+                        llvm::MaybeAlign( 8 ), llvm::AtomicOrdering::Monotonic ), assign.symbol );
+                }
+                return;
+            }
+
+            auto old = m_Builder.CreateLoad( int64, word, assign.array );
+            array_access( old, assign.symbol );
+            auto bits = m_Builder.CreateShl( m_Builder.CreateZExt( value, int64 ), bit );
+            auto store = m_Builder.CreateStore( m_Builder.CreateOr( m_Builder.CreateAnd( old, m_Builder.CreateNot( mask ) ), bits ), word );
+            array_access( store, assign.symbol );
+            return;
+        }
+
+        auto addr = element( assign.symbol, assign.indexes, assign.array, &assign );
+        auto store = m_Builder.CreateStore( compile_expr( assign.value ), addr );
+        array_access( store, assign.symbol );
+    }
+
+    void SubprogramVisitor::operator() ( const SliceAssignment& assign )
+    {
+        compile_array_assignment( elements( assign.slice ), assign.slice.symbol, assign.value );
+    }
+
+    void SubprogramVisitor::compile_array_assignment ( const Elements& target, const std::optional<Symbol>& array, const Expression& value )
+    {
+        const auto& layout = m_Module.getDataLayout();
+        auto align = layout.getABITypeAlign( target.type );
+        auto rowSize = m_Builder.getInt64( layout.getTypeAllocSize( target.type ).getFixedSize() * target.stride );
+
+        // Copies take the rows of an array, a slice or an array value put in a temporary
+        std::optional<Elements> source {};
+        bool overlaps = false;
+        if ( array_value( value ) ){
+            source = elements( value );
+            const auto& from = array_symbol( value );
+            overlaps = from->scope == array->scope && from->index == array->index;
+        }
+
+        auto val = source.has_value() ? nullptr : compile_expr( value );
+        if ( val != nullptr && val->getType()->isArrayTy() ){
+            auto parent = m_Builder.GetInsertBlock()->getParent();
+            auto temporary = entry_alloca( parent, val->getType(), 1, "value" );
+            m_Builder.CreateStore( val, temporary );
+            auto count = (long long) val->getType()->getArrayNumElements() / target.stride;
+            auto first = m_Builder.CreateInBoundsGEP( val->getType(), temporary, { m_Builder.getInt64( 0 ), m_Builder.getInt64( 0 ) } );
+            source = Elements{ first, m_Builder.getInt64( count ), target.stride, target.type };
+        }
+
+        if ( source.has_value() ){
+            // Lengths known at compile time are checked by the semantic analysis,
+            // the others with the bounds checks, otherwise the shorter one is copied
+            auto rows = target.rows;
+            if ( ! llvm::isa<llvm::ConstantInt>( source->rows ) || ! llvm::isa<llvm::ConstantInt>( target.rows ) ){
+                if ( m_Bounds != nullptr ){
+                    auto parent = m_Builder.GetInsertBlock()->getParent();
+                    auto int32 = m_Builder.getInt32Ty();
+                    auto okBB = llvm::BasicBlock::Create( m_Context, "sameLength", parent );
+                    auto errorBB = llvm::BasicBlock::Create( m_Context, "otherLength", parent );
+                    m_Builder.CreateCondBr( m_Builder.CreateICmpEQ( source->rows, target.rows ), okBB, errorBB,
+                        llvm::MDBuilder( m_Context ).createBranchWeights( 1 << 20, 1 ) );
+
+                    // `void mila_length_error(i32 got, i32 expected, i32 line)` exits the program
+                    m_Builder.SetInsertPoint( errorBB );
+                    auto errorType = llvm::FunctionType::get( m_Builder.getVoidTy(), { int32, int32, int32 }, false );
+                    auto error = m_Module.getOrInsertFunction( "mila_length_error", errorType );
+                    if ( auto fun = llvm::dyn_cast<llvm::Function>( error.getCallee() ) ){
+                        fun->addFnAttr( llvm::Attribute::NoReturn );
+                        fun->addFnAttr( llvm::Attribute::NoUnwind );
+                        fun->addFnAttr( llvm::Attribute::Cold );
+                    }
+                    auto call = m_Builder.CreateCall( error, {
+                        m_Builder.CreateTrunc( source->rows, int32 ),
+                        m_Builder.CreateTrunc( target.rows, int32 ),
+                        m_Builder.getInt32( m_Location.line )
+                    } );
+                    call->setDoesNotReturn();
+                    m_Builder.CreateUnreachable();
+
+                    m_Builder.SetInsertPoint( okBB );
+                }
+                else {
+                    rows = m_Builder.CreateBinaryIntrinsic( llvm::Intrinsic::smin, source->rows, target.rows );
+                }
+            }
+
+            // Slices of the same array may overlap
+            auto size = m_Builder.CreateNSWMul( rows, rowSize );
+            if ( overlaps ){
+                m_Builder.CreateMemMove( target.first, align, source->first, align, size );
+            }
+            else {
+                m_Builder.CreateMemCpy( target.first, align, source->first, align, size );
+            }
+            return;
+        }
+
+        // Fill by an element value, booleans and repeated bytes are set as bytes
+        auto count = m_Builder.CreateNSWMul( target.rows, m_Builder.getInt64( target.stride ) );
+        auto bytes = m_Builder.CreateNSWMul( target.rows, rowSize );
+        auto int8 = m_Builder.getInt8Ty();
+        if ( packed( array->type.value() ) ){
+            m_Builder.CreateMemSet( target.first, m_Builder.CreateSExt( val, int8 ), bytes, align );
+            return;
+        }
+        if ( val->getType()->isIntegerTy( 1 ) ){
+            m_Builder.CreateMemSet( target.first, m_Builder.CreateZExt( val, int8 ), bytes, align );
+            return;
+        }
+        if ( auto c = llvm::dyn_cast<llvm::ConstantInt>( val ); c != nullptr && c->getValue().isSplat( 8 ) ){
+            m_Builder.CreateMemSet( target.first, m_Builder.getInt8( c->getValue().trunc( 8 ).getZExtValue() ), bytes, align );
+            return;
+        }
+
+        // Integers are stored by strips of vectors, sets one by one
+        unsigned width = val->getType()->isIntegerTy() ? REDUCTION_WIDTH : 1;
+        auto strip = width == 1 ? val : m_Builder.CreateVectorSplat( width, val );
+        compile_strips( count, width, [&]( llvm::Value* position, unsigned w ){
+            auto stored = w == 1 ? val : strip;
+            auto at = m_Builder.CreateInBoundsGEP( target.type, target.first, position );
+            auto store = m_Builder.CreateAlignedStore( stored, m_Builder.CreatePointerCast( at, stored->getType()->getPointerTo() ), align );
+            array_access( store, array );
+        }, "fill" );
+    }
+
+    void SubprogramVisitor::operator() ( const SetLength& sl )
+    {
+        // `void mila_setlength(i8* descriptor, i32 length, i32 size, i32 line)` reallocates
+        // the elements in the arena of the descriptor, exiting on a negative length
+        auto int32 = m_Builder.getInt32Ty();
+        auto bytePtr = m_Builder.getInt8PtrTy();
+        auto setType = llvm::FunctionType::get( m_Builder.getVoidTy(), { bytePtr, int32, int32, int32 }, false );
+        auto runtime = m_Module.getOrInsertFunction( "mila_setlength", setType );
+        if ( auto fun = llvm::dyn_cast<llvm::Function>( runtime.getCallee() ) ){
+            fun->addFnAttr( llvm::Attribute::NoUnwind );
+        }
+
+        const auto& type = sl.array.symbol->type.value();
+        auto size = m_Module.getDataLayout().getTypeAllocSize( compile_t( element_type( type ) ) ).getFixedSize();
+        m_Builder.CreateCall( runtime, {
+            m_Builder.CreateBitCast( address( sl.array.symbol ), bytePtr ),
+            compile_expr( sl.length ),
+            m_Builder.getInt32( size ),
+            m_Builder.getInt32( m_Location.line )
+        } );
+    }
+
+    void SubprogramVisitor::operator() ( const ExitStatement& )
+    {
+        m_Builder.CreateBr( m_ReturnBlock );
+
+        auto bb = llvm::BasicBlock::Create(m_Context, "afterExit", m_Builder.GetInsertBlock()->getParent());
+        m_Builder.SetInsertPoint(bb);
+    }
+
+    void SubprogramVisitor::operator() ( const BreakStatement& )
+    {
+        if ( ! m_LoopContinuation.has_value() )
+        {
+            throw std::runtime_error( "Break used outside of loop" );
+        }
+
+        m_Builder.CreateBr( m_LoopContinuation.value() );
+
+        auto bb = llvm::BasicBlock::Create(m_Context, "afterBreak", m_Builder.GetInsertBlock()->getParent());
+        m_Builder.SetInsertPoint(bb);
+    }
+
+    void SubprogramVisitor::operator() ( const EmptyStatement& )
+    {
+        return;
+    }
+
+    void SubprogramVisitor::operator() ( const Spawn& spawn )
+    {
+        if ( m_Frame == nullptr ){
+            throw std::runtime_error( "Spawn of " + spawn.call.functionName + " outside of a subprogram frame" );
+        }
+
+        auto parent = m_Builder.GetInsertBlock()->getParent();
+        auto fun = callee( spawn.call );
+        auto bytePtr = m_Builder.getInt8PtrTy();
+
+        // Arguments are evaluated by the caller, the result is stored by the thunk
+        auto args = compile_arguments( spawn.call, fun );
+        std::vector<llvm::Type*> fields {};
+        for ( auto a : args ){
+            fields.push_back( a->getType() );
+        }
+        if ( spawn.variable.has_value() ){
+            fields.push_back( fun->getReturnType()->getPointerTo() );
+        }
+        auto dataType = llvm::StructType::get( m_Context, fields );
+
+        // `void <subprogram>.spawn(i8* data)`, the prefix keeps it with its subprogram in the cache
+        auto thunkType = llvm::FunctionType::get( m_Builder.getVoidTy(), { bytePtr }, false );
+        auto thunk = llvm::Function::Create( thunkType, llvm::Function::InternalLinkage, parent->getName() + ".spawn", m_Module );
+        thunk->addFnAttr( llvm::Attribute::NoUnwind );
+        thunk->getArg( 0 )->setName( "data" );
+
+        {
+            llvm::IRBuilderBase::InsertPointGuard guard { m_Builder };
+            m_Builder.SetCurrentDebugLocation( llvm::DebugLoc() );
+            m_Builder.SetInsertPoint( llvm::BasicBlock::Create( m_Context, "entry", thunk ) );
+
+            auto data = m_Builder.CreateBitCast( thunk->getArg( 0 ), dataType->getPointerTo() );
+            std::vector<llvm::Value*> unpacked {};
+            for ( size_t i = 0; i < args.size(); ++i ){
+                unpacked.push_back( m_Builder.CreateLoad( fields[i], m_Builder.CreateStructGEP( dataType, data, i ) ) );
+            }
+
+            auto call = m_Builder.CreateCall( fun, unpacked );
+            call->setCallingConv( fun->getCallingConv() );
+            attributes::apply_call( *call, *fun );
+
+            if ( spawn.variable.has_value() ){
+                auto result = m_Builder.CreateLoad( fields.back(), m_Builder.CreateStructGEP( dataType, data, args.size() ) );
+                m_Builder.CreateStore( call, result );
+            }
+            m_Builder.CreateRetVoid();
+        }
+
+        // The runtime copies the data before the call returns, a single slot per spawn serves all its executions
+        auto data = entry_alloca( parent, dataType, 1, "spawnData" );
+        for ( size_t i = 0; i < args.size(); ++i ){
+            m_Builder.CreateStore( args[i], m_Builder.CreateStructGEP( dataType, data, i ) );
+        }
+        if ( spawn.variable.has_value() ){
+            m_Builder.CreateStore( address( spawn.symbol ), m_Builder.CreateStructGEP( dataType, data, args.size() ) );
+        }
+
+        auto int64 = m_Builder.getInt64Ty();
+        auto spawnType = llvm::FunctionType::get( m_Builder.getVoidTy(),
+            { int64->getPointerTo(), thunkType->getPointerTo(), bytePtr, int64 }, false );
+        auto runtime = m_Module.getOrInsertFunction( "mila_spawn", spawnType );
+        m_Builder.CreateCall( runtime, {
+            m_Frame,
+            thunk,
+            m_Builder.CreateBitCast( data, bytePtr ),
+            llvm::ConstantExpr::getSizeOf( dataType )
+        } );
+    }
+
+    void SubprogramVisitor::operator() ( const SyncStatement& )
+    {
+        compile_sync();
+    }
+
+    void SubprogramVisitor::operator() ( const ptr<Block>& bl )
+    {
+        compile_block(*bl);
+    }
+
+    void SubprogramVisitor::operator() ( const ptr<If>& if_ )
+    {
+        auto parent = m_Builder.GetInsertBlock()->getParent();
+
+        auto trueBB = llvm::BasicBlock::Create(m_Context, "trueBranch", parent);
+        auto falseBB = llvm::BasicBlock::Create(m_Context, "falseBranch", parent);
+        auto continueBB = llvm::BasicBlock::Create( m_Context, "afterIf", parent );
+
+        // conditional jump
+        compile_condition( if_->condition, trueBB, falseBB );
+
+        // Both branches are in tail position when the if is
+        bool tail = m_Tail;
+
+        // compile true branch
+        m_Builder.SetInsertPoint( trueBB );
+        compile_stm( if_->trueCode );
+        m_Builder.CreateBr(continueBB);
+
+        // compile false branch
+        m_Builder.SetInsertPoint( falseBB );
+        if ( if_->elseCode.has_value() )
+        {
+            m_Tail = tail;
+            compile_stm( if_->elseCode.value());
+        }
+        m_Builder.CreateBr(continueBB);
+        m_Tail = tail;
+
+        // switch to continuation
+        m_Builder.SetInsertPoint( continueBB );
+    }
+
+    void SubprogramVisitor::operator() ( const ptr<While>& wh )
+    {
+        compile_loop(wh->condition, wh->code);
+    }
+
+    void SubprogramVisitor::operator() ( const ptr<For>& fo )
+    {
+        if ( fo->parallel.has_value() ){
+            compile_parallel_for( *fo );
+            return;
+        }
+
+        if ( m_Nests != nullptr ){
+            if ( auto nest = m_Nests->find( fo.get() ); nest != m_Nests->end() ){
+                compile_loop_nest( *fo, nest->second );
+                return;
+            }
+        }
+
+        if ( m_Bounds != nullptr ){
+            if ( auto guard = m_Bounds->guard( fo.get() ); guard.has_value() ){
+                compile_guarded_for( *fo, guard.value() );
+                return;
+            }
+        }
+
+        // Both the start and the bound are evaluated once, before the loop
+        // `for iterator := init to/downto bound`
+        auto iterator = address( fo->symbol );
+        auto init = compile_expr( fo->initialization );
+        auto bound = compile_expr( fo->target );
+
+        compile_counted_loop( iterator, init, bound, fo->direction == For::DIRECTION::TO, fo->code, fo->loopVariable, fo->written );
+    }
+
+/******************************************************************/
+
+    void SubprogramVisitor::compile_stm ( const Statement& variant )
+    {
+        // Nested statements restore the location of the enclosing one
+        auto previous = m_Builder.getCurrentDebugLocation();
+        auto previousLocation = m_Location;
+        if ( auto loc = ast::location( variant ); loc.has_value() ){
+            m_Location = loc.value();
+            if ( m_DebugScope != nullptr ){
+                m_Builder.SetCurrentDebugLocation(
+                    llvm::DILocation::get( m_Context, loc->line, loc->column, m_DebugScope ) );
+            }
+        }
+
+        std::visit( *this, variant );
+        m_Builder.SetCurrentDebugLocation( previous );
+        m_Location = previousLocation;
+    }
+
+    void SubprogramVisitor::compile_block ( const Block& code )
+    {
+        bool tail = m_Tail;
+
+        for ( size_t i = 0; i < code.statements.size(); ++i )
+        {
+            // The last statement of a block in tail position and any
+            // statement followed by exit are followed only by the return,
+            // empty statements (from `; end`) don't count
+            size_t next = i + 1;
+            while ( next < code.statements.size() && std::holds_alternative<EmptyStatement>( code.statements[next] ) ){
+                ++next;
+            }
+
+            bool last = next == code.statements.size();
+            m_Tail = ( last && tail )
+                || ( ! last && std::holds_alternative<ExitStatement>( code.statements[next] ) );
+
+            compile_stm( code.statements[i] );
+        }
+
+        m_Tail = tail;
+    }
+
+    void SubprogramVisitor::compile_loop ( const Expression& condition, const Statement& block )
+    {
+        auto parent = m_Builder.GetInsertBlock()->getParent();
+
+        auto condBB = llvm::BasicBlock::Create(m_Context, "loopCond", parent);
+        auto bodyBB = llvm::BasicBlock::Create(m_Context, "loopBody", parent);
+        auto continueBB = llvm::BasicBlock::Create(m_Context, "afterLoop", parent);
+
+        m_Builder.CreateBr(condBB);
+
+        // compile condition
+        m_Builder.SetInsertPoint( condBB );
+        compile_condition( condition, bodyBB, continueBB );
+
+        // this is done so nested loops don't break
+        auto prevLoop = m_LoopContinuation;
+        m_LoopContinuation = continueBB;
+
+        // compile body, the loop continues after it
+        bool tail = m_Tail;
+        m_Tail = false;
+        m_Builder.SetInsertPoint( bodyBB );
+        compile_stm( block );
+        m_Builder.CreateBr( condBB );
+        m_Tail = tail;
+
+        // switch to continuation
+        m_Builder.SetInsertPoint( continueBB );
+        m_LoopContinuation = prevLoop;
+    }
+
+    void SubprogramVisitor::compile_counted_loop (
+        llvm::Value* iterator,
+        llvm::Value* init,
+        llvm::Value* bound,
+        bool up,
+        const Statement& code,
+        const std::string& name,
+        bool written )
+    {
+        compile_counted_loop( iterator, init, bound, up, [&](){ compile_stm( code ); }, name, written );
+    }
+
+    void SubprogramVisitor::compile_counted_loop (
+        llvm::Value* iterator,
+        llvm::Value* init,
+        llvm::Value* bound,
+        bool up,
+        const std::function<void()>& body,
+        const std::string& name,
+        bool written )
+    {
+        auto parent = m_Builder.GetInsertBlock()->getParent();
+
+        auto bodyBB = llvm::BasicBlock::Create( m_Context, "forBody", parent );
+        auto latchBB = llvm::BasicBlock::Create( m_Context, "forLatch", parent );
+        auto exitBB = llvm::BasicBlock::Create( m_Context, "forExit", parent );
+        auto continueBB = llvm::BasicBlock::Create( m_Context, "afterFor", parent );
+
+        // Guard, the body runs at least once when entered, otherwise the variable is left at the start
+        m_Builder.CreateStore( init, iterator );
+        auto enter = up
+            ? m_Builder.CreateICmpSLE( init, bound )
+            : m_Builder.CreateICmpSGE( init, bound );
+        auto guardBB = m_Builder.GetInsertBlock();
+        m_Builder.CreateCondBr( enter, bodyBB, continueBB );
+
+        // The induction variable lives in a register, the variable in memory
+        // is only updated for the body to read it
+        m_Builder.SetInsertPoint( bodyBB );
+        auto iv = m_Builder.CreatePHI( init->getType(), 2, name );
+        iv->addIncoming( init, guardBB );
+        m_Builder.CreateStore( iv, iterator );
+
+        auto prevLoop = m_LoopContinuation;
+        m_LoopContinuation = continueBB;
+        bool tail = m_Tail;
+        m_Tail = false;
+
+        body();
+        m_Builder.CreateBr( latchBB );
+
+        m_Tail = tail;
+        m_LoopContinuation = prevLoop;
+
+        // Rotated exit test, comparing before the step so it can't overflow,
+        // which also makes the step itself free of signed wrap. A variable the
+        // body may have changed is read back and compared against the bound
+        m_Builder.SetInsertPoint( latchBB );
+        auto step = llvm::ConstantInt::get( iv->getType(), 1 );
+        llvm::Value* current = iv;
+        llvm::Value* done = nullptr;
+        if ( written ){
+            current = m_Builder.CreateLoad( iv->getType(), iterator, name );
+            done = up ? m_Builder.CreateICmpSGE( current, bound ) : m_Builder.CreateICmpSLE( current, bound );
+        }
+        else {
+            done = m_Builder.CreateICmpEQ( iv, bound );
+        }
+        auto next = up
+            ? m_Builder.CreateNSWAdd( current, step )
+            : m_Builder.CreateNSWSub( current, step );
+        iv->addIncoming( next, latchBB );
+        m_Builder.CreateCondBr( done, exitBB, bodyBB );
+
+        // The variable ends one step past the last value, which may wrap around
+        m_Builder.SetInsertPoint( exitBB );
+        m_Builder.CreateStore( up ? m_Builder.CreateAdd( current, step ) : m_Builder.CreateSub( current, step ), iterator );
+        m_Builder.CreateBr( continueBB );
+
+        m_Builder.SetInsertPoint( continueBB );
+    }
+
+    llvm::Value* SubprogramVisitor::guard_holds ( llvm::Value* init, llvm::Value* bound, bool up, const bounds::Guard& guard )
+    {
+        // The variable goes through lo..hi, the guard is clamped to the values it can have
+        auto lo = up ? init : bound;
+        auto hi = up ? bound : init;
+        auto clamp = []( long long value ){
+            return static_cast<int32_t>( std::clamp<long long>( value, INT32_MIN, INT32_MAX ) );
+        };
+        return m_Builder.CreateAnd(
+            m_Builder.CreateICmpSGE( lo, m_Builder.getInt32( clamp( guard.low ) ) ),
+            m_Builder.CreateICmpSLE( hi, m_Builder.getInt32( clamp( guard.high ) ) ),
+            "guard" );
+    }
+
+    void SubprogramVisitor::compile_versions ( llvm::Value* holds, const std::vector<const For*>& loops, const std::function<void()>& code )
+    {
+        auto parent = m_Builder.GetInsertBlock()->getParent();
+
+        auto fastBB = llvm::BasicBlock::Create( m_Context, "guarded", parent );
+        auto slowBB = llvm::BasicBlock::Create( m_Context, "checked", parent );
+        auto continueBB = llvm::BasicBlock::Create( m_Context, "afterGuarded", parent );
+        m_Builder.CreateCondBr( holds, fastBB, slowBB );
+
+        m_Builder.SetInsertPoint( fastBB );
+        for ( auto loop : loops ){
+            m_Guarded.insert( loop );
+        }
+        code();
+        for ( auto loop : loops ){
+            m_Guarded.erase( loop );
+        }
+        m_Builder.CreateBr( continueBB );
+
+        m_Builder.SetInsertPoint( slowBB );
+        code();
+        m_Builder.CreateBr( continueBB );
+
+        m_Builder.SetInsertPoint( continueBB );
+    }
+
+    void SubprogramVisitor::compile_guarded_for ( const For& loop, const bounds::Guard& guard )
+    {
+        auto iterator = address( loop.symbol );
+        auto init = compile_expr( loop.initialization );
+        auto bound = compile_expr( loop.target );
+        bool up = loop.direction == For::DIRECTION::TO;
+
+        // A loop that doesn't run at all takes the checked version, it does nothing there either
+        compile_versions( guard_holds( init, bound, up, guard ), { &loop }, [&](){
+            compile_counted_loop( iterator, init, bound, up, loop.code, loop.loopVariable );
+        } );
+    }
+
+    void SubprogramVisitor::compile_tiles (
+        llvm::Value* lo,
+        llvm::Value* hi,
+        unsigned tile,
+        const std::function<void( llvm::Value*, llvm::Value* )>& body,
+        const std::string& name )
+    {
+        auto parent = m_Builder.GetInsertBlock()->getParent();
+        auto int64 = m_Builder.getInt64Ty();
+
+        // Entered with lo <= hi, the last tile ends at hi, computed in 64 bits so it can't overflow
+        auto preBB = m_Builder.GetInsertBlock();
+        auto tileBB = llvm::BasicBlock::Create( m_Context, name + "Tile", parent );
+        auto latchBB = llvm::BasicBlock::Create( m_Context, name + "TileLatch", parent );
+        auto continueBB = llvm::BasicBlock::Create( m_Context, name + "Tiles", parent );
+        m_Builder.CreateBr( tileBB );
+
+        m_Builder.SetInsertPoint( tileBB );
+        auto start = m_Builder.CreatePHI( lo->getType(), 2, name + "Tile" );
+        start->addIncoming( lo, preBB );
+        auto last = m_Builder.CreateNSWAdd( m_Builder.CreateSExt( start, int64 ), m_Builder.getInt64( tile - 1 ) );
+        auto hi64 = m_Builder.CreateSExt( hi, int64 );
+        auto end = m_Builder.CreateTrunc( m_Builder.CreateSelect( m_Builder.CreateICmpSLT( last, hi64 ), last, hi64 ), lo->getType() );
+        body( start, end );
+        m_Builder.CreateBr( latchBB );
+
+        // The next tile starts at most at hi
+        m_Builder.SetInsertPoint( latchBB );
+        auto next = m_Builder.CreateNSWAdd( start, llvm::ConstantInt::get( lo->getType(), tile ) );
+        start->addIncoming( next, latchBB );
+        m_Builder.CreateCondBr( m_Builder.CreateICmpEQ( end, hi ), continueBB, tileBB );
+
+        m_Builder.SetInsertPoint( continueBB );
+    }
+
+    void SubprogramVisitor::compile_loop_nest ( const For& outer, const loops::Nest& nest )
+    {
+        const auto& inner = *nest.inner;
+        auto parent = m_Builder.GetInsertBlock()->getParent();
+
+        // The bounds of the inner loop don't change, they are evaluated once as well
+        struct Range
+        {
+            const For& loop;
+            llvm::Value* iterator;
+            llvm::Value* init;
+            llvm::Value* bound;
+            bool up;
+            llvm::Value* enter;
+        };
+        auto range = [&]( const For& loop ){
+            auto iterator = address( loop.symbol );
+            auto init = compile_expr( loop.initialization );
+            auto bound = compile_expr( loop.target );
+            bool up = loop.direction == For::DIRECTION::TO;
+            auto enter = up ? m_Builder.CreateICmpSLE( init, bound ) : m_Builder.CreateICmpSGE( init, bound );
+            return Range{ loop, iterator, init, bound, up, enter };
+        };
+        auto o = range( outer );
+        auto i = range( inner );
+
+        auto nestBB = llvm::BasicBlock::Create( m_Context, "nest", parent );
+        auto emptyBB = llvm::BasicBlock::Create( m_Context, "emptyNest", parent );
+        auto outerOnlyBB = llvm::BasicBlock::Create( m_Context, "outerOnly", parent );
+        auto continueBB = llvm::BasicBlock::Create( m_Context, "afterNest", parent );
+        m_Builder.CreateCondBr( m_Builder.CreateAnd( o.enter, i.enter ), nestBB, emptyBB );
+
+        // The body never runs, only the outer variable may go through its range,
+        // setting the inner one to its start on every iteration
+        auto past = []( llvm::IRBuilder<>& builder, const Range& r ){
+            auto step = builder.getInt32( 1 );
+            return r.up ? builder.CreateAdd( r.bound, step ) : builder.CreateSub( r.bound, step );
+        };
+        m_Builder.SetInsertPoint( emptyBB );
+        m_Builder.CreateStore( o.init, o.iterator );
+        m_Builder.CreateCondBr( o.enter, outerOnlyBB, continueBB );
+        m_Builder.SetInsertPoint( outerOnlyBB );
+        m_Builder.CreateStore( past( m_Builder, o ), o.iterator );
+        m_Builder.CreateStore( i.init, i.iterator );
+        m_Builder.CreateBr( continueBB );
+
+        // Loops in their new order, first runs outside
+        m_Builder.SetInsertPoint( nestBB );
+        const auto& first = nest.interchange ? i : o;
+        const auto& second = nest.interchange ? o : i;
+
+        auto reordered = [&](){
+            if ( nest.tile == 0 ){
+                compile_counted_loop( first.iterator, first.init, first.bound, first.up, [&](){
+                    compile_counted_loop( second.iterator, second.init, second.bound, second.up, inner.code, second.loop.loopVariable );
+                }, first.loop.loopVariable );
+                return;
+            }
+
+            // Tiles go up, the order of the iterations doesn't matter
+            auto lo = []( const Range& r ){ return r.up ? r.init : r.bound; };
+            auto hi = []( const Range& r ){ return r.up ? r.bound : r.init; };
+            compile_tiles( lo( first ), hi( first ), nest.tile, [&]( llvm::Value* firstLo, llvm::Value* firstHi ){
+                compile_tiles( lo( second ), hi( second ), nest.tile, [&]( llvm::Value* secondLo, llvm::Value* secondHi ){
+                    compile_counted_loop( first.iterator, firstLo, firstHi, true, [&](){
+                        compile_counted_loop( second.iterator, secondLo, secondHi, true, inner.code, second.loop.loopVariable );
+                    }, first.loop.loopVariable );
+                }, second.loop.loopVariable );
+            }, first.loop.loopVariable );
+        };
+
+        // Hoisted bounds checks of both loops are covered by a single version
+        llvm::Value* holds = nullptr;
+        std::vector<const For*> guarded {};
+        for ( const auto& r : { o, i } ){
+            auto guard = m_Bounds != nullptr ? m_Bounds->guard( &r.loop ) : std::nullopt;
+            if ( guard.has_value() ){
+                auto h = guard_holds( r.init, r.bound, r.up, guard.value() );
+                holds = holds == nullptr ? h : m_Builder.CreateAnd( holds, h );
+                guarded.push_back( &r.loop );
+            }
+        }
+
+        if ( holds != nullptr ){
+            compile_versions( holds, guarded, reordered );
+        }
+        else {
+            reordered();
+        }
+
+        // Both variables end past their bounds, as after the original loops
+        m_Builder.CreateStore( past( m_Builder, o ), o.iterator );
+        m_Builder.CreateStore( past( m_Builder, i ), i.iterator );
+        m_Builder.CreateBr( continueBB );
+
+        m_Builder.SetInsertPoint( continueBB );
+    }
+
+    void SubprogramVisitor::compile_parallel_for ( const For& loop )
+    {
+        auto parent = m_Builder.GetInsertBlock()->getParent();
+        auto int32 = m_Builder.getInt32Ty();
+        auto int32Ptr = int32->getPointerTo();
+        auto bytePtr = m_Builder.getInt8PtrTy();
+        auto envPtr = bytePtr->getPointerTo();
+        const auto& reductions = loop.parallel->reductions;
+
+        // The runtime runs ascending ranges, the order doesn't matter
+        auto init = compile_expr( loop.initialization );
+        auto bound = compile_expr( loop.target );
+        bool up = loop.direction == For::DIRECTION::TO;
+        auto lo = up ? init : bound;
+        auto hi = up ? bound : init;
+
+        // `void <subprogram>.parallel(i8** env, i32 lo, i32 hi, i32* partial)`,
+        // the prefix keeps it with its subprogram in the cache
+        auto bodyType = llvm::FunctionType::get( m_Builder.getVoidTy(), { envPtr, int32, int32, int32Ptr }, false );
+        auto body = llvm::Function::Create( bodyType, llvm::Function::InternalLinkage, parent->getName() + ".parallel", m_Module );
+        body->addFnAttr( llvm::Attribute::NoUnwind );
+        auto env = body->getArg( 0 );
+        auto partial = body->getArg( 3 );
+        env->setName( "env" );
+        body->getArg( 1 )->setName( "lo" );
+        body->getArg( 2 )->setName( "hi" );
+        partial->setName( "partial" );
+
+        {
+            // The outlined body has no debug information of its own
+            llvm::IRBuilderBase::InsertPointGuard guard { m_Builder };
+            m_Builder.SetCurrentDebugLocation( llvm::DebugLoc() );
+            m_Builder.SetInsertPoint( llvm::BasicBlock::Create( m_Context, "entry", body ) );
+
+            std::vector<llvm::Value*> locals {};
+            for ( size_t i = 0; i < m_Locals.size(); ++i ){
+                auto slot = m_Builder.CreateLoad( bytePtr, m_Builder.CreateConstInBoundsGEP1_32( bytePtr, env, i ) );
+                locals.push_back( m_Builder.CreateBitCast( slot, m_Locals[i]->getType() ) );
+            }
+
+            // Private copies replace the shared variables, globals included
+            GlobalValues globals = m_Globals;
+            auto privatize = [&]( const Symbol& symbol, const std::string& name ){
+                auto copy = m_Builder.CreateAlloca( int32, nullptr, name );
+                if ( symbol.scope == Symbol::SCOPE::LOCAL ){
+                    locals[symbol.index] = copy;
+                }
+                else {
+                    globals.globals[symbol.index] = copy;
+                }
+                return copy;
+            };
+
+            auto iterator = privatize( loop.symbol.value(), loop.loopVariable );
+
+            std::vector<llvm::Value*> privates {};
+            for ( size_t k = 0; k < reductions.size(); ++k ){
+                auto copy = privatize( reductions[k].symbol.value(), reductions[k].variable );
+                auto slot = m_Builder.CreateConstInBoundsGEP1_32( int32, partial, k );
+                m_Builder.CreateStore( m_Builder.CreateLoad( int32, slot ), copy );
+                privates.push_back( copy );
+            }
+
+            auto exitBB = llvm::BasicBlock::Create( m_Context, "exit", body );
+            SubprogramVisitor visitor {
+                { { m_Context, m_Builder, m_Module, globals }, locals, m_ArrayScopes, m_Bounds, m_Guarded },
+                m_Name,
+                exitBB,
+                std::nullopt, // Results are stored through the environment
+                std::nullopt, // Break can't leave the body
+                nullptr,
+                std::nullopt,
+                false,
+                nullptr,
+                nullptr,
+                m_Nests,
+                true
+            };
+            visitor.compile_counted_loop( iterator, body->getArg( 1 ), body->getArg( 2 ), true, loop.code, loop.loopVariable );
+            m_Builder.CreateBr( exitBB );
+
+            m_Builder.SetInsertPoint( exitBB );
+            for ( size_t k = 0; k < privates.size(); ++k ){
+                auto slot = m_Builder.CreateConstInBoundsGEP1_32( int32, partial, k );
+                m_Builder.CreateStore( m_Builder.CreateLoad( int32, privates[k] ), slot );
+            }
+            m_Builder.CreateRetVoid();
+        }
+
+        // Environment of the addresses of all local slots
+        auto envAddr = entry_alloca( parent, bytePtr, std::max<size_t>( m_Locals.size(), 1 ), "env" );
+        for ( size_t i = 0; i < m_Locals.size(); ++i ){
+            m_Builder.CreateStore(
+                m_Builder.CreateBitCast( m_Locals[i], bytePtr ),
+                m_Builder.CreateConstInBoundsGEP1_32( bytePtr, envAddr, i ) );
+        }
+
+        // The results start with the values of the variables and end up back in them
+        auto count = std::max<size_t>( reductions.size(), 1 );
+        auto ops = entry_alloca( parent, int32, count, "reductionOps" );
+        auto results = entry_alloca( parent, int32, count, "reductions" );
+        for ( size_t k = 0; k < reductions.size(); ++k ){
+            m_Builder.CreateStore( m_Builder.getInt32( static_cast<unsigned>( reductions[k].op ) ),
+                m_Builder.CreateConstInBoundsGEP1_32( int32, ops, k ) );
+            m_Builder.CreateStore( m_Builder.CreateLoad( int32, address( reductions[k].symbol ) ),
+                m_Builder.CreateConstInBoundsGEP1_32( int32, results, k ) );
+        }
+
+        auto runtimeType = llvm::FunctionType::get( m_Builder.getVoidTy(),
+            { bodyType->getPointerTo(), envPtr, int32, int32, int32, int32Ptr, int32Ptr }, false );
+        auto runtime = m_Module.getOrInsertFunction( "mila_parallel_for", runtimeType );
+        m_Builder.CreateCall( runtime, { body, envAddr, lo, hi, m_Builder.getInt32( reductions.size() ), ops, results } );
+
+        for ( size_t k = 0; k < reductions.size(); ++k ){
+            auto value = m_Builder.CreateLoad( int32, m_Builder.CreateConstInBoundsGEP1_32( int32, results, k ), reductions[k].variable );
+            m_Builder.CreateStore( value, address( reductions[k].symbol ) );
+        }
+
+        // The variable ends as after the serial loop, the body can't change it
+        auto step = m_Builder.getInt32( 1 );
+        auto enter = up ? m_Builder.CreateICmpSLE( init, bound ) : m_Builder.CreateICmpSGE( init, bound );
+        auto past = up ? m_Builder.CreateAdd( bound, step ) : m_Builder.CreateSub( bound, step );
+        m_Builder.CreateStore( m_Builder.CreateSelect( enter, past, init ), address( loop.symbol.value() ) );
+    }
+
+    void SubprogramVisitor::compile_sync ()
+    {
+        if ( m_Frame == nullptr ){
+            return;
+        }
+
+        auto syncType = llvm::FunctionType::get( m_Builder.getVoidTy(), { m_Builder.getInt64Ty()->getPointerTo() }, false );
+        m_Builder.CreateCall( m_Module.getOrInsertFunction( "mila_sync", syncType ), { m_Frame } );
+    }
+
+    /// Whether a statement spawns a call, the subprogram then needs a frame to sync
+    bool spawns ( const Statement& stmt )
+    {
+        return wrap( stmt ).visit(
+            []( const Spawn& ){
+                return true;
+            },
+            []( const ptr<Block>& bl ){
+                return std::ranges::any_of( bl->statements, spawns );
+            },
+            []( const ptr<If>& if_ ){
+                return spawns( if_->trueCode )
+                    || ( if_->elseCode.has_value() && spawns( if_->elseCode.value() ) );
+            },
+            []( const ptr<While>& wh ){
+                return spawns( wh->code );
+            },
+            []( const ptr<For>& fo ){
+                return spawns( fo->code );
+            },
+            []( const auto& ){
+                return false;
+            }
+        );
+    }
+
+    /// Right hand sides of and/or up to this cost are evaluated always and combined by a select
+    constexpr unsigned SPECULATION_LIMIT = 4;
+
+    /**
+     * Estimated number of instructions evaluating an expression takes,
+     * nullopt when it must not be evaluated unless needed, because it
+     * calls a subprogram, accesses an array or divides
+     */
+    std::optional<unsigned> speculation_cost ( const Expression& expr )
+    {
+        return wrap( expr ).visit(
+            []( const VariableAccess& ) -> std::optional<unsigned> {
+                return 1;
+            },
+            []( const ConstantExpression& ) -> std::optional<unsigned> {
+                return 0;
+            },
+            []( const ptr<ArrayAccess>& ) -> std::optional<unsigned> {
+                return std::nullopt;
+            },
+            []( const ptr<ArraySlice>& ) -> std::optional<unsigned> {
+                return std::nullopt;
+            },
+            []( const ptr<ArrayReduction>& ) -> std::optional<unsigned> {
+                return std::nullopt;
+            },
+            []( const ptr<SubprogramCall>& ) -> std::optional<unsigned> {
+                return std::nullopt;
+            },
+            []( const ptr<SetConstructor>& set ) -> std::optional<unsigned> {
+                unsigned cost = 0;
+                for ( auto v : values( *set ) ){
+                    auto c = speculation_cost( *v );
+                    if ( ! c.has_value() ){
+                        return std::nullopt;
+                    }
+                    cost += c.value() + 2;
+                }
+                return cost;
+            },
+            []( const ptr<UnaryOperator>& un ) -> std::optional<unsigned> {
+                auto cost = speculation_cost( un->expression );
+                if ( ! cost.has_value() ){
+                    return std::nullopt;
+                }
+                return cost.value() + 1;
+            },
+            []( const ptr<BinaryOperator>& bin ) -> std::optional<unsigned> {
+                switch ( bin->op ) {
+                case BinaryOperator::OPERATOR::DIVISION:
+                case BinaryOperator::OPERATOR::INTEGER_DIVISION:
+                case BinaryOperator::OPERATOR::MODULO:
+                    return std::nullopt;
+                default:
+                    break;
+                }
+
+                auto left = speculation_cost( bin->left );
+                auto right = speculation_cost( bin->right );
+                if ( ! left.has_value() || ! right.has_value() ){
+                    return std::nullopt;
+                }
+                return left.value() + right.value() + 1;
+            }
+        );
+    }
+
+    void SubprogramVisitor::compile_condition ( const Expression& condition, llvm::BasicBlock* trueBB, llvm::BasicBlock* falseBB )
+    {
+        // 'not' just swaps the targets
+        if ( auto un = std::get_if<ptr<UnaryOperator>>( &condition );
+            un != nullptr && (*un)->op == UnaryOperator::OPERATOR::NOT )
+        {
+            compile_condition( (*un)->expression, falseBB, trueBB );
+            return;
+        }
+
+        auto bin = std::get_if<ptr<BinaryOperator>>( &condition );
+        if ( bin == nullptr
+            || ( (*bin)->op != BinaryOperator::OPERATOR::AND && (*bin)->op != BinaryOperator::OPERATOR::OR ) )
+        {
+            m_Builder.CreateCondBr( compile_expr( condition ), trueBB, falseBB );
+            return;
+        }
+
+        bool isAnd = (*bin)->op == BinaryOperator::OPERATOR::AND;
+        auto cost = speculation_cost( (*bin)->right );
+
+        // Cheap and safe right hand side, no branch needed. The left hand side
+        // is evaluated as a value then, so it must be safe as well, otherwise
+        // its own operands lose their short circuit
+        if ( cost.has_value() && cost.value() <= SPECULATION_LIMIT
+            && speculation_cost( (*bin)->left ).has_value() )
+        {
+            auto lhs = compile_expr( (*bin)->left );
+            auto rhs = compile_expr( (*bin)->right );
+            auto cond = isAnd
+                ? m_Builder.CreateSelect( lhs, rhs, m_Builder.getFalse() )
+                : m_Builder.CreateSelect( lhs, m_Builder.getTrue(), rhs );
+            m_Builder.CreateCondBr( cond, trueBB, falseBB );
+            return;
+        }
+
+        // Short circuit, the right hand side decides only when the left one can't
+        auto parent = m_Builder.GetInsertBlock()->getParent();
+        auto rhsBB = llvm::BasicBlock::Create( m_Context, isAnd ? "andRhs" : "orRhs", parent, trueBB );
+
+        if ( isAnd ){
+            compile_condition( (*bin)->left, rhsBB, falseBB );
+        }
+        else {
+            compile_condition( (*bin)->left, trueBB, rhsBB );
+        }
+
+        m_Builder.SetInsertPoint( rhsBB );
+        compile_condition( (*bin)->right, trueBB, falseBB );
+    }
+
+    /// Functions of the runtime, they use the C calling convention
+    bool is_runtime_function ( const llvm::Function* fun )
+    {
+        auto name = fun->getName();
+        return name == "writeln" || name == "write" || name == "readln";
+    }
+
+    bool SubprogramVisitor::compile_tail_call ( const SubprogramCall& sub )
+    {
+        auto fun = callee( sub );
+        auto caller = m_Builder.GetInsertBlock()->getParent();
+        if ( fun->getReturnType() != caller->getReturnType() ){
+            return false;
+        }
+
+        // Spawned calls are synced and the arena is released in the return block
+        if ( m_Frame != nullptr || m_Arena != nullptr ){
+            return false;
+        }
+
+        // Addresses of the caller's variables can't outlive its frame
+        for ( const auto& arg : fun->args() ){
+            if ( arg.getType()->isPointerTy() ){
+                return false;
+            }
+        }
+
+        if ( fun == caller && m_TailRecursion.has_value() )
+        {
+            // All arguments are evaluated before any parameter is overwritten
+            std::vector<llvm::Value*> args {};
+            for ( const auto& a : sub.arguments ){
+                args.push_back( compile_expr( a ) );
+            }
+
+            for ( size_t i = 0; i < args.size(); ++i ){
+                m_Builder.CreateStore( args[i], m_TailRecursion->parameters[i] );
+            }
+            m_Builder.CreateBr( m_TailRecursion->header );
+        }
+        else
+        {
+            auto call = compile_call( sub );
+
+            // Same prototype and calling convention guarantee the tail call
+            // even without optimizations, otherwise it is only a hint
+            bool guaranteed = fun->getFunctionType() == caller->getFunctionType()
+                && ! is_runtime_function( fun );
+            call->setTailCallKind( guaranteed ? llvm::CallInst::TCK_MustTail : llvm::CallInst::TCK_Tail );
+
+            if ( fun->getReturnType()->isVoidTy() ){
+                m_Builder.CreateRetVoid();
+            }
+            else {
+                m_Builder.CreateRet( call );
+            }
+        }
+
+        // Following code is unreachable, exit after a tail call jumps from here
+        auto bb = llvm::BasicBlock::Create( m_Context, "afterTailCall", caller );
+        m_Builder.SetInsertPoint( bb );
+        return true;
+    }
+
+/******************************************************************/
+
+
+    void ProgramVisitor::operator() ( const ProcedureDecl& proc )
+    {
+        if ( m_Module.getFunction( proc.name ) == nullptr ){
+            compile_subprogram_decl(proc.name, proc.parameters, std::nullopt);
+        }
+    }
+
+    void ProgramVisitor::operator() ( const Procedure& proc )
+    {
+        compile_subprogram(
+            proc.name,
+            proc.parameters,
+            proc.variables,
+            std::nullopt,
+            proc.code,
+            proc.location
+        );
+    }
+
+    void ProgramVisitor::operator() ( const FunctionDecl& fun )
+    {
+        if ( m_Module.getFunction( fun.name ) == nullptr ){
+            compile_subprogram_decl(fun.name, fun.parameters, fun.returnType);
+        }
+    }
+
+    void ProgramVisitor::operator() ( const Function& fun )
+    {
+        compile_subprogram(
+            fun.name,
+            fun.parameters,
+            fun.variables,
+            fun.returnType,
+            fun.code,
+            fun.location
+        );
+    }
+
+    void ProgramVisitor::operator() ( const NamedConstant& c )
+    {
+        // When not defined here, the value is still known for optimizations
+        auto val = compile_cexpr( c.value );
+        new llvm::GlobalVariable(
+            m_Module,
+            val->getType(),
             true, // Is a constant
-            llvm::GlobalVariable::ExternalLinkage,
+            m_DefineGlobals
+                ? llvm::GlobalVariable::ExternalLinkage
+                : llvm::GlobalVariable::AvailableExternallyLinkage,
             val,
             c.name
         );
     }
 
+    /// Slot of the arena of the global dynamic arrays, defined by the runtime
+    constexpr const char* GLOBAL_ARENA = "mila_global_arena";
+
     void ProgramVisitor::operator() ( const Variable& var )
     {
         auto type = compile_t( var.type );
-        auto zero = llvm::Constant::getNullValue(type);
+        llvm::Constant* zero = m_DefineGlobals ? llvm::Constant::getNullValue(type) : nullptr;
+
+        // Global dynamic arrays start empty in the global arena
+        if ( std::holds_alternative<ptr<DynamicArray>>( var.type ) ){
+            auto bytePtr = m_Builder.getInt8PtrTy();
+            auto arena = m_Module.getOrInsertGlobal( GLOBAL_ARENA, bytePtr );
+            if ( zero != nullptr ){
+                auto structType = llvm::cast<llvm::StructType>( type );
+                zero = llvm::ConstantStruct::get( structType, {
+                    llvm::Constant::getNullValue( structType->getElementType( 0 ) ),
+                    m_Builder.getInt64( 0 ),
+                    arena
+                } );
+            }
+        }
         new llvm::GlobalVariable(
             m_Module,
             type,
@@ -513,47 +2174,88 @@ namespace compiler
 
     void ProgramVisitor::add_external_funcs()
     {
-        std::vector<llvm::Type*> int_arg (1, m_Builder.getInt32Ty());
-        llvm::FunctionType * fun_type = llvm::FunctionType::get(m_Builder.getInt32Ty(), int_arg , false);
-
-        // create writeln function
+        // The runtime functions return an int, which is ignored
+        m_Globals.builtins.clear();
+        for ( const auto& b : sema::builtins() )
         {
-            llvm::Function * fun = llvm::Function::Create(fun_type, llvm::Function::ExternalLinkage, "writeln", m_Module);
-            for (auto & a : fun->args())
-            {
-                a.setName("x");
+            std::vector<llvm::Type*> args {};
+            for ( const auto& p : b.parameters ){
+                auto type = compile_t( p.type );
+                args.push_back( p.mode != Variable::MODE::VALUE ? type->getPointerTo() : type );
             }
-        }
 
-        // create write function
-        {
-            llvm::Function * fun = llvm::Function::Create(fun_type, llvm::Function::ExternalLinkage, "write", m_Module);
-            for (auto & a : fun->args())
+            auto fun_type = llvm::FunctionType::get( m_Builder.getInt32Ty(), args, false );
+            auto fun = llvm::Function::Create( fun_type, llvm::Function::ExternalLinkage, b.name, m_Module );
+            fun->addFnAttr( llvm::Attribute::NoUnwind );
+            for ( auto& a : fun->args() )
             {
                 a.setName("x");
             }
+
+            m_Globals.builtins.push_back( fun );
         }
+    }
+
+    void ProgramVisitor::compile_declarations ( const Program& program )
+    {
+        m_Globals.globals.assign( program.globals.size() + 1, nullptr );
 
-        // create readln
+        for ( size_t i = 0; i < program.globals.size(); ++i )
         {
-            std::vector<llvm::Type*> read_arg (1, m_Builder.getInt32Ty()->getPointerTo());
-            llvm::FunctionType * read_type = llvm::FunctionType::get(m_Builder.getInt32Ty(), read_arg, false);
-            llvm::Function * fun = llvm::Function::Create( read_type, llvm::Function::ExternalLinkage, "readln", m_Module );
-            for (auto & a : fun->args())
-            {
-                a.setName("x");
+            const auto& g = program.globals[i];
+            wrap( g ).visit(
+                [this]( const Procedure& proc ){
+                    (*this)( ProcedureDecl{ proc.name, proc.parameters } );
+                },
+                [this]( const Function& fun ){
+                    (*this)( FunctionDecl{ fun.name, fun.parameters, fun.returnType } );
+                },
+                [this]( const auto& decl ){
+                    (*this)( decl );
+                }
+            );
+
+            // Forward declarations and definitions share the function
+            auto name = std::visit( []( const auto& decl ){ return decl.name; }, g );
+            m_Globals.globals[i] = m_Module.getNamedValue( name );
+        }
+
+        (*this)( FunctionDecl{ "main", {}, SimpleType::INTEGER } );
+        m_Globals.globals.back() = m_Module.getFunction( "main" );
+
+        // Every module declares the subprograms with the same attributes
+        if ( m_Attributes != nullptr ){
+            for ( size_t i = 0; i < m_Attributes->size(); ++i ){
+                if ( m_Attributes->at( i ).has_value() ){
+                    attributes::apply( *llvm::cast<llvm::Function>( m_Globals.globals[i] ), m_Attributes->at( i ).value() );
+                }
             }
         }
     }
 
-    void ProgramVisitor::compile_program ( const Program& program )
+    void ProgramVisitor::compile_definition ( const Program& program, size_t index )
     {
-        for ( const auto& g : program.globals )
+        if ( index < program.globals.size() ){
+            compile_glob( program.globals[index] );
+        }
+        else {
+            compile_subprogram("main", {}, {}, SimpleType::INTEGER, program.code, program.location);
+        }
+    }
+
+    std::vector<size_t> ProgramVisitor::definitions ( const Program& program )
+    {
+        std::vector<size_t> acc {};
+        for ( size_t i = 0; i < program.globals.size(); ++i )
         {
-            compile_glob ( g );
+            const auto& g = program.globals[i];
+            if ( std::holds_alternative<Procedure>( g ) || std::holds_alternative<Function>( g ) ){
+                acc.push_back( i );
+            }
         }
 
-        compile_subprogram("main", {}, {}, SimpleType::INTEGER, program.code);
+        acc.push_back( program.globals.size() );
+        return acc;
     }
 
 /******************************************************************/
@@ -572,12 +2274,13 @@ namespace compiler
             llvmReturnType = m_Builder.getVoidTy();
         }
 
-        // Args
+        // Args, var and const parameters are addresses
         std::vector<llvm::Type*> llvmParams;
         llvmParams.reserve( parameters.size() );
         for ( const auto& p : parameters )
         {
-            llvmParams.push_back( compile_t( p.type ) );
+            auto type = compile_t( p.type );
+            llvmParams.push_back( p.mode == Variable::MODE::VALUE ? type : type->getPointerTo() );
         }
 
         // The actual function
@@ -588,11 +2291,23 @@ namespace compiler
             m_Module
         );
 
-        // Name the arguments
+        // Name the arguments, the addresses are valid for the whole call and not kept,
+        // const parameters are only read through. Noalias is added with the inferred
+        // attributes, when the subprogram doesn't access the global variables
+        const auto& layout = m_Module.getDataLayout();
         size_t i = 0;
         for ( auto& a : llvmFun->args() )
         {
             a.setName( parameters[i].name );
+            if ( parameters[i].mode != Variable::MODE::VALUE ){
+                auto type = compile_t( parameters[i].type );
+                a.addAttr( llvm::Attribute::NoCapture );
+                a.addAttr( llvm::Attribute::getWithDereferenceableBytes( m_Context, layout.getTypeAllocSize( type ) ) );
+                a.addAttr( llvm::Attribute::getWithAlignment( m_Context, layout.getABITypeAlign( type ) ) );
+                if ( parameters[i].mode == Variable::MODE::CONST ){
+                    a.addAttr( llvm::Attribute::ReadOnly );
+                }
+            }
             ++i;
         }
 
@@ -604,7 +2319,8 @@ namespace compiler
         const Many<Variable>& parameters,
         const Many<Variable>& variables,
         const std::optional<Type>& retType,
-        const Block& code
+        const Block& code,
+        const Location& location
     )
     {
         llvm::Function* llvmFun = m_Module.getFunction( name );
@@ -616,48 +2332,170 @@ namespace compiler
             // TODO validate correct structure
         }
 
+        // On cache hit only the declaration is needed, the body is linked in later
+        std::optional<std::uint64_t> cacheKey;
+        auto start = std::chrono::steady_clock::now();
+        if ( m_Cache != nullptr ){
+            cacheKey = m_Cache->key( name, parameters, variables, retType, code, location );
+            if ( m_Cache->lookup( cacheKey.value(), name ) ){
+                return;
+            }
+        }
+
         // Entry and return basic blocks
         auto entryBB = llvm::BasicBlock::Create(m_Context, "entry", llvmFun);
         auto returnBB = llvm::BasicBlock::Create(m_Context, "return", llvmFun);
 
         m_Builder.SetInsertPoint( entryBB );
 
-        // Parameters
+        // Prologue and epilogue belong to the subprogram header
+        llvm::DISubprogram* debugScope = nullptr;
+        if ( m_Debug != nullptr ){
+            debugScope = m_Debug->subprogram( llvmFun, parameters, retType, location );
+            m_Builder.SetCurrentDebugLocation( m_Debug->location( debugScope, location ) );
+        }
+
+        // Slots in the order the semantic analysis numbered them
+        std::vector<llvm::Value*> locals {};
+
+        // Parameters, var and const ones are used in place
         for ( auto& a : llvmFun->args() ) {
-            auto pAddr = m_Builder.CreateAlloca( a.getType() );
-            m_Builder.CreateStore( &a, pAddr );
+            llvm::Value* pAddr = &a;
+            if ( parameters[a.getArgNo()].mode == Variable::MODE::VALUE ){
+                pAddr = m_Builder.CreateAlloca( a.getType() );
+                m_Builder.CreateStore( &a, pAddr );
+            }
+            locals.push_back( pAddr );
+
+            if ( m_Debug != nullptr ){
+                m_Debug->variable( m_Builder, debugScope, pAddr, parameters[a.getArgNo()], a.getArgNo() + 1 );
+            }
+        }
+
+        // Dynamic arrays and arrays too big for the stack live in the arena of the
+        // subprogram, it is created by the first allocation and released on return.
+        // Nothing can refer to the locals after that, so their size alone decides
+        const auto& layout = m_Module.getDataLayout();
+        auto bytePtr = m_Builder.getInt8PtrTy();
+        auto heap = [&]( const Type& type ){
+            return std::holds_alternative<ptr<Array>>( type )
+                && layout.getTypeAllocSize( compile_t( type ) ).getFixedSize() > m_StackArrays;
+        };
+        llvm::Value* arena = nullptr;
+        if ( std::ranges::any_of( variables, [&]( const Variable& v ){
+            return heap( v.type ) || std::holds_alternative<ptr<DynamicArray>>( v.type );
+        } ) ){
+            arena = m_Builder.CreateAlloca( bytePtr, nullptr, "arena" );
+            m_Builder.CreateStore( llvm::Constant::getNullValue( bytePtr ), arena );
         }
 
-        // Local variables
-        DeclarationMap locals {};
+        // Local variables, dynamic arrays start empty
         for ( const auto& v : variables )
         {
-            auto vAddr = m_Builder.CreateAlloca( compile_t(v.type) );
-            locals.add(v.name, vAddr);
+            auto type = compile_t( v.type );
+            llvm::Value* vAddr = nullptr;
+            if ( heap( v.type ) ){
+                // `i8* mila_arena_alloc(i8** arena, i64 size)`
+                auto allocType = llvm::FunctionType::get( bytePtr, { bytePtr->getPointerTo(), m_Builder.getInt64Ty() }, false );
+                auto alloc = m_Module.getOrInsertFunction( "mila_arena_alloc", allocType );
+                auto block = m_Builder.CreateCall( alloc, { arena, m_Builder.getInt64( layout.getTypeAllocSize( type ).getFixedSize() ) } );
+                vAddr = m_Builder.CreateBitCast( block, type->getPointerTo(), v.name );
+            }
+            else {
+                vAddr = m_Builder.CreateAlloca( type );
+            }
+            if ( std::holds_alternative<ptr<DynamicArray>>( v.type ) ){
+                m_Builder.CreateStore( m_Builder.CreateInsertValue( llvm::Constant::getNullValue( type ), arena, 2 ), vAddr );
+            }
+            locals.push_back( vAddr );
+
+            if ( m_Debug != nullptr ){
+                m_Debug->variable( m_Builder, debugScope, vAddr, v, 0 );
+            }
         }
 
         // Return address
         std::optional<llvm::Value*> returnAddress;
         if ( retType.has_value() ) {
-            returnAddress = m_Builder.CreateAlloca( llvmFun->getReturnType() );
+            auto retAddr = m_Builder.CreateAlloca( llvmFun->getReturnType() );
+
+            if ( m_Debug != nullptr ){
+                m_Debug->variable( m_Builder, debugScope, retAddr, Variable{ name, retType.value(), location }, 0 );
+            }
+
+            // 'x := function_name' reads the return value
+            locals.push_back( retAddr );
+            returnAddress = retAddr;
         }
         else {
             returnAddress = std::nullopt;
         }
 
+        // Spawned calls are counted in the frame until they are synced,
+        // at the latest when the subprogram returns
+        bool spawning = std::ranges::any_of( code.statements, spawns );
+        llvm::Value* frame = nullptr;
+        if ( spawning ){
+            frame = m_Builder.CreateAlloca( m_Builder.getInt64Ty(), nullptr, "frame" );
+            m_Builder.CreateStore( m_Builder.getInt64( 0 ), frame );
+        }
+
+        // Self tail calls refill the parameters and start over from here
+        std::optional<TailRecursion> tailRecursion;
+        if ( m_TailRecursionLoops && ! spawning && arena == nullptr ){
+            std::vector<llvm::Value*> paramAddrs ( locals.begin(), locals.begin() + parameters.size() );
+
+            auto headerBB = llvm::BasicBlock::Create( m_Context, "tailRecursion", llvmFun, returnBB );
+            m_Builder.CreateBr( headerBB );
+            m_Builder.SetInsertPoint( headerBB );
+            tailRecursion = TailRecursion{ headerBB, paramAddrs };
+        }
+
+        // Every entry, including a self tail call, starts with a zero result
+        if ( returnAddress.has_value() ){
+            m_Builder.CreateStore( llvm::Constant::getNullValue( llvmFun->getReturnType() ), returnAddress.value() );
+        }
+
         // Code
+        ArrayScopes arrayScopes {};
+        for ( size_t i = 0; i < parameters.size(); ++i ){
+            if ( parameters[i].mode != Variable::MODE::VALUE ){
+                arrayScopes.m_References.insert( i );
+            }
+        }
         SubprogramVisitor visitor {
-            { { m_Context, m_Builder, m_Module }, locals },
+            { { m_Context, m_Builder, m_Module, m_Globals }, locals, &arrayScopes, m_Bounds },
             name,
             returnBB,
             returnAddress,
-            std::nullopt // Not starting in a loop
+            std::nullopt, // Not starting in a loop
+            debugScope,
+            tailRecursion,
+            true,
+            frame,
+            arena,
+            m_Nests
         };
         visitor.compile_block( code );
 
-        // Return
+        // Return, main releases the arena of the global dynamic arrays as well
         m_Builder.CreateBr( returnBB );
         m_Builder.SetInsertPoint( returnBB );
+        visitor.compile_sync();
+        std::vector<llvm::Value*> arenas {};
+        if ( arena != nullptr ){
+            arenas.push_back( arena );
+        }
+        if ( name == "main" ){
+            if ( auto globalArena = m_Module.getNamedGlobal( GLOBAL_ARENA ) ){
+                arenas.push_back( globalArena );
+            }
+        }
+        for ( auto a : arenas ){
+            // `void mila_arena_release(i8** arena)` frees everything allocated in it
+            auto releaseType = llvm::FunctionType::get( m_Builder.getVoidTy(), { bytePtr->getPointerTo() }, false );
+            m_Builder.CreateCall( m_Module.getOrInsertFunction( "mila_arena_release", releaseType ), { a } );
+        }
         if ( returnAddress.has_value() ){
             auto retVal = m_Builder.CreateLoad( llvmFun->getReturnType(), returnAddress.value() );
             m_Builder.CreateRet( retVal );
@@ -665,22 +2503,414 @@ namespace compiler
         else {
             m_Builder.CreateRetVoid();
         }
+        m_Builder.SetCurrentDebugLocation( llvm::DebugLoc() );
+        arrayScopes.annotate( m_Context, name );
+
+        if ( cacheKey.has_value() ){
+            m_Cache->miss( cacheKey.value(), name,
+                std::chrono::duration_cast<std::chrono::microseconds>( std::chrono::steady_clock::now() - start ) );
+        }
     }
 
 /******************************************************************/
 
-    std::unique_ptr<Compiler> Compiler::compile ( const Program& program )
+    void Compiler::generate ( const Program& program, unsigned jobs )
     {
-        std::unique_ptr<Compiler> compiler ( new Compiler{ program.name } );
+        std::optional<bounds::Analysis> checks;
+        if ( m_Options.boundsCheck ){
+            checks = bounds::analyze( program );
+            m_BoundsStats = checks->stats;
+        }
+        auto checksPtr = checks.has_value() ? &checks.value() : nullptr;
+
+        std::optional<loops::Plans> nests;
+        if ( m_Options.tileLoops > 0 ){
+            nests = loops::analyze( program, m_Options.tileLoops );
+        }
+        auto nestsPtr = nests.has_value() ? &nests.value() : nullptr;
+
+        // Instrumented code writes its counters, so nothing can be assumed about it
+        attributes::Table attrs {};
+        if ( ! m_Options.profileGenerate ){
+            attrs = attributes::infer( program, m_Options.boundsCheck, m_Options.stackArrays );
+        }
+        auto attrsPtr = m_Options.profileGenerate ? nullptr : &attrs;
 
+        GlobalValues globals {};
         ProgramVisitor pr {
             {
-                {compiler->m_Context, compiler->m_Builder, compiler->m_Module},
-                {}
-            }
+                {m_Context, m_Builder, m_Module, globals},
+                {},
+                nullptr,
+                checksPtr
+            },
+            m_Cache.get(),
+            true, // Define globals
+            nullptr, // Only declarations, described by the workers
+            m_Options.tailRecursionLoops,
+            attrsPtr,
+            nestsPtr,
+            m_Options.stackArrays
         };
         pr.add_external_funcs();
-        pr.compile_program( program );
+
+        if ( m_Cache != nullptr ){
+            m_Cache->prepare( program, attrsPtr );
+        }
+
+        // Everything is declared up front, so the bodies can be generated independently
+        pr.compile_declarations( program );
+
+        std::vector<std::string> order {};
+        for ( const auto& fun : m_Module.functions() ){
+            order.push_back( fun.getName().str() );
+        }
+
+        auto definitions = ProgramVisitor::definitions( program );
+        std::atomic<size_t> next { 0 };
+
+        jobs = std::max( jobs, 1u );
+        std::vector<std::string> bitcodes ( jobs );
+        std::vector<std::exception_ptr> errors ( jobs );
+
+        // A single job goes through the same path on this thread, so the
+        // output doesn't depend on the number of jobs
+        auto work = [&]( unsigned w ){
+            try
+            {
+                llvm::LLVMContext context {};
+                llvm::IRBuilder<> builder { context };
+                llvm::Module module { m_Module.getModuleIdentifier(), context };
+                module.setTargetTriple( m_Module.getTargetTriple() );
+                module.setDataLayout( m_Module.getDataLayout() );
+
+                std::unique_ptr<debug::DebugInfo> debugInfo {};
+                if ( m_Options.debugInfo ){
+                    debugInfo = std::make_unique<debug::DebugInfo>( module, m_Options.sourceFile, m_Options.optLevel > 0, program );
+                }
+
+                GlobalValues workerGlobals {};
+                ProgramVisitor visitor {
+                    {
+                        {context, builder, module, workerGlobals},
+                        {},
+                        nullptr,
+                        checksPtr
+                    },
+                    m_Cache.get(),
+                    false, // Globals are defined by the main module
+                    debugInfo.get(),
+                    m_Options.tailRecursionLoops,
+                    attrsPtr,
+                    nestsPtr,
+                    m_Options.stackArrays
+                };
+                visitor.add_external_funcs();
+                visitor.compile_declarations( program );
+
+                for ( size_t i = next++; i < definitions.size(); i = next++ ){
+                    visitor.compile_definition( program, definitions[i] );
+                }
+
+                if ( debugInfo != nullptr ){
+                    debugInfo->finalize();
+                }
+
+                // Contexts can't be mixed, so the module is passed on as bitcode,
+                // keeping the use lists in order so the output is deterministic
+                llvm::raw_string_ostream str { bitcodes[w] };
+                llvm::WriteBitcodeToFile( module, str, true );
+                str.flush();
+            }
+            catch ( ... )
+            {
+                errors[w] = std::current_exception();
+            }
+        };
+
+        if ( jobs == 1 ){
+            work( 0 );
+        }
+        else {
+            std::vector<std::thread> workers {};
+            for ( unsigned w = 0; w < jobs; ++w ){
+                workers.emplace_back( work, w );
+            }
+
+            for ( auto& t : workers ){
+                t.join();
+            }
+        }
+
+        for ( const auto& e : errors ){
+            if ( e ){
+                std::rethrow_exception( e );
+            }
+        }
+
+        for ( const auto& bitcode : bitcodes )
+        {
+            llvm::SMDiagnostic diag {};
+            auto part = llvm::parseIR( llvm::MemoryBufferRef( bitcode, "worker" ), diag, m_Context );
+            if ( part == nullptr ){
+                throw std::runtime_error( "Failed to link generated code" );
+            }
+
+            // Every worker describes its code in its own unit, the first one is kept for all
+            debug::share_unit( *part, m_Module );
+            if ( llvm::Linker::linkModules( m_Module, std::move( part ) ) ){
+                throw std::runtime_error( "Failed to link generated code" );
+            }
+        }
+
+        // Linking moves the definitions to the end, restore the serial order
+        for ( const auto& name : order ){
+            auto fun = m_Module.getFunction( name );
+            fun->removeFromParent();
+            m_Module.getFunctionList().push_back( fun );
+        }
+    }
+
+    void Compiler::verify () const
+    {
+        std::string err {};
+        llvm::raw_string_ostream errStream { err };
+
+        if ( llvm::verifyModule( m_Module, &errStream ) ){
+            throw std::runtime_error( "Generated invalid code: " + errStream.str() );
+        }
+    }
+
+    void Compiler::link_runtime ()
+    {
+#ifdef MILA_EMBEDDED_RUNTIME
+        llvm::MemoryBufferRef buffer {
+            llvm::StringRef( reinterpret_cast<const char*>( runtime::BITCODE ), runtime::BITCODE_SIZE ),
+            "runtime"
+        };
+
+        llvm::SMDiagnostic diag {};
+        auto runtimeModule = llvm::parseIR( buffer, diag, m_Context );
+        if ( runtimeModule == nullptr ){
+            throw std::runtime_error( "Invalid embedded runtime: " + diag.getMessage().str() );
+        }
+
+        // Take over the target of the runtime so the modules are compatible
+        m_Module.setTargetTriple( runtimeModule->getTargetTriple() );
+        m_Module.setDataLayout( runtimeModule->getDataLayout() );
+
+        // Only the used runtime functions (and whatever they use) are pulled in
+        if ( llvm::Linker::linkModules( m_Module, std::move( runtimeModule ), llvm::Linker::Flags::LinkOnlyNeeded ) ){
+            throw std::runtime_error( "Failed to link the runtime" );
+        }
+#else
+        throw std::runtime_error( "mila was built without the embedded runtime" );
+#endif
+    }
+
+    void Compiler::internalize ()
+    {
+        for ( auto& fun : m_Module.functions() )
+        {
+            // Mila has no exceptions and the runtime is plain C
+            fun.addFnAttr( llvm::Attribute::NoUnwind );
+
+            // Runtime imports and the entry point stay visible to the linker
+            if ( fun.isDeclaration() || fun.getName() == "main" ){
+                continue;
+            }
+
+            fun.setLinkage( llvm::GlobalValue::InternalLinkage );
+
+            // Outlined bodies are called by the runtime through a pointer
+            if ( fun.hasAddressTaken() ){
+                continue;
+            }
+            fun.setCallingConv( llvm::CallingConv::Fast );
+
+            // Calling convention of the call has to match the callee
+            for ( auto user : fun.users() ){
+                if ( auto call = llvm::dyn_cast<llvm::CallBase>( user ) ){
+                    call->setCallingConv( llvm::CallingConv::Fast );
+                }
+            }
+        }
+
+        for ( auto& glob : m_Module.globals() ){
+            // Imports and special variables (llvm.global_dtors of the runtime) are left alone
+            if ( glob.isDeclaration() || glob.hasAppendingLinkage() ){
+                continue;
+            }
+
+            glob.setLinkage( llvm::GlobalValue::InternalLinkage );
+        }
+    }
+
+    llvm::OptimizationLevel optimization_level ( unsigned level )
+    {
+        switch ( level ) {
+        case 0:
+            return llvm::OptimizationLevel::O0;
+        case 1:
+            return llvm::OptimizationLevel::O1;
+        case 2:
+            return llvm::OptimizationLevel::O2;
+        default:
+            return llvm::OptimizationLevel::O3;
+        }
+    }
+
+    void Compiler::optimize ( unsigned level )
+    {
+        llvm::LoopAnalysisManager lam {};
+        llvm::FunctionAnalysisManager fam {};
+        llvm::CGSCCAnalysisManager cgam {};
+        llvm::ModuleAnalysisManager mam {};
+
+        // LLVM's pass timers are collected into the time report
+        std::string passTimers {};
+        llvm::raw_string_ostream passTimersStream { passTimers };
+        llvm::PassInstrumentationCallbacks pic {};
+        std::optional<llvm::StandardInstrumentations> si {};
+        if ( m_Options.report != nullptr ){
+            llvm::TimePassesIsEnabled = true;
+            si.emplace( false );
+            si->getTimePasses().setOutStream( passTimersStream );
+            si->registerCallbacks( pic, &fam );
+        }
+
+        // Profile guided optimization, the pipeline inserts the instrumentation
+        // or annotates the code with the profile before the inliner
+        llvm::Optional<llvm::PGOOptions> pgo {};
+        if ( m_Options.profileGenerate ){
+            pgo = llvm::PGOOptions( "", "", "", llvm::PGOOptions::IRInstr );
+        }
+        else if ( m_Options.profileUse.has_value() ){
+            pgo = llvm::PGOOptions( m_Options.profileUse.value(), "", "", llvm::PGOOptions::IRUse );
+        }
+
+        // The vectorizers need the target's costs and register widths, they
+        // are enabled from -O2 like in clang
+        auto machine = backend::target_machine( m_Module.getTargetTriple(), level );
+        llvm::PipelineTuningOptions tuning {};
+        tuning.LoopVectorization = level >= 2;
+        tuning.SLPVectorization = level >= 2;
+
+        llvm::PassBuilder pb { machine.get(), tuning, pgo, &pic };
+        pb.registerModuleAnalyses( mam );
+        pb.registerCGSCCAnalyses( cgam );
+        pb.registerFunctionAnalyses( fam );
+        pb.registerLoopAnalyses( lam );
+        pb.crossRegisterProxies( lam, fam, cgam, mam );
+
+        // The per module pipeline contains the IPO passes (IPSCCP, global opt,
+        // function attributes inference, inliner, dead argument elimination)
+        auto mpm = pb.buildPerModuleDefaultPipeline( optimization_level( level ) );
+        mpm.run( m_Module, mam );
+
+        if ( si.has_value() ){
+            si->getTimePasses().print();
+            llvm::TimePassesIsEnabled = false;
+            m_Options.report->pass_timers( passTimersStream.str() );
+        }
+    }
+
+    std::unique_ptr<Compiler> Compiler::compile ( const Program& program, const Options& options )
+    {
+        std::unique_ptr<Compiler> compiler ( new Compiler{ program.name, options } );
+
+        // The optimizer and the backend have to agree on the data layout
+        auto triple = llvm::sys::getDefaultTargetTriple();
+        compiler->m_Module.setTargetTriple( triple );
+        compiler->m_Module.setDataLayout( backend::target_machine( triple, options.optLevel )->createDataLayout() );
+
+        if ( options.profileGenerate && options.profileUse.has_value() ){
+            throw std::runtime_error( "Profile can't be generated and used at once" );
+        }
+
+        // A missing profile would otherwise only be reported by LLVM as a fatal error
+        std::string profileVersion {};
+        if ( options.profileUse.has_value() ){
+            std::error_code ec {};
+            auto modified = std::filesystem::last_write_time( options.profileUse.value(), ec );
+            if ( ec ){
+                throw std::runtime_error( "Can't read profile " + options.profileUse.value() + ": " + ec.message() );
+            }
+            profileVersion = std::to_string( modified.time_since_epoch().count() );
+        }
+
+        if ( options.cacheDirectory.has_value() ){
+            // Everything that changes the code generated for a single subprogram
+            std::string flags = "O" + std::to_string( options.optLevel )
+                + " whole-program=" + std::to_string( options.wholeProgram )
+                + " profile-generate=" + std::to_string( options.profileGenerate )
+                + " tail-recursion-loops=" + std::to_string( options.tailRecursionLoops )
+                + " debug=" + ( options.debugInfo ? std::filesystem::absolute( options.sourceFile ).string() : "" )
+                + " profile-use=" + options.profileUse.value_or( "" ) + "@" + profileVersion
+                + " link-runtime=" + std::to_string( options.linkRuntime )
+                + " bounds-check=" + std::to_string( options.boundsCheck )
+                + " tile-loops=" + std::to_string( options.tileLoops )
+                + " stack-arrays=" + std::to_string( options.stackArrays )
+                + " " + compiler->m_Module.getTargetTriple()
+                + " " + compiler->m_Module.getDataLayoutStr();
+
+            compiler->m_Cache = std::make_unique<cache::FunctionCache>( options.cacheDirectory.value(), flags, options.debugInfo );
+        }
+
+        auto report = options.report;
+
+        timing::measure( report, "codegen", [&](){
+            compiler->generate( program, options.jobs );
+        } );
+        if ( report != nullptr ){
+            report->count( "instructions", compiler->m_Module.getInstructionCount() );
+        }
+
+        timing::measure( report, "verify", [&](){
+            compiler->verify();
+        } );
+
+        if ( compiler->m_Cache != nullptr ){
+            std::optional<llvm::OptimizationLevel> level;
+            if ( options.optLevel > 0 ){
+                level = optimization_level( options.optLevel );
+            }
+
+            timing::measure( report, "cache", [&](){
+                compiler->m_Cache->finish( compiler->m_Module, level );
+            } );
+        }
+
+        if ( options.linkRuntime ){
+            timing::measure( report, "link", [&](){
+                compiler->link_runtime();
+            } );
+        }
+
+        unsigned optLevel = options.optLevel;
+
+        // The profile passes are part of the optimization pipeline
+        if ( ( options.profileGenerate || options.profileUse.has_value() ) && optLevel == 0 ){
+            optLevel = 2;
+        }
+
+        if ( options.wholeProgram ){
+            compiler->internalize();
+
+            // Whole program mode is pointless without the IPO pipeline
+            if ( optLevel == 0 ){
+                optLevel = 2;
+            }
+        }
+
+        if ( optLevel > 0 ){
+            timing::measure( report, "optimize", [&](){
+                compiler->optimize( optLevel );
+            } );
+            if ( report != nullptr ){
+                report->count( "instructions", compiler->m_Module.getInstructionCount() );
+            }
+        }
 
         return compiler;
     }
@@ -689,4 +2919,27 @@ namespace compiler
     {
         return m_Module;
     }
+
+    std::optional<cache::Stats> Compiler::cache_stats () const
+    {
+        if ( m_Cache == nullptr ){
+            return std::nullopt;
+        }
+
+        return m_Cache->stats();
+    }
+
+    std::optional<bounds::Stats> Compiler::bounds_stats () const
+    {
+        return m_BoundsStats;
+    }
+
+    void Compiler::emit_object ()
+    {
+        if ( ! m_Options.objectFile.has_value() ){
+            throw std::runtime_error( "No object file to emit" );
+        }
+
+        backend::emit_object( m_Module, m_Options.objectFile.value(), m_Options.partitions, m_Options.optLevel );
+    }
 }
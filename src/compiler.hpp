@@ -2,6 +2,12 @@
 #define COMPILER_HPP
 
 #include "ast.hpp"
+#include "attributes.hpp"
+#include "bounds.hpp"
+#include "cache.hpp"
+#include "debug_info.hpp"
+#include "loops.hpp"
+#include "timing.hpp"
 #include <llvm/ADT/APFloat.h>
 #include <llvm/ADT/STLExtras.h>
 #include <llvm/IR/BasicBlock.h>
@@ -14,29 +20,24 @@
 #include <llvm/IR/Module.h>
 #include <llvm/IR/Type.h>
 #include <llvm/IR/Verifier.h>
+#include <functional>
+#include <vector>
 #include <optional>
+#include <set>
 #include <variant>
 
 namespace compiler
 {
     using namespace ast;
 
-    /// Simple wrapper around map for holding variables
-    class DeclarationMap
+    /// Values of the symbols resolved by the semantic analysis to the globals and builtins
+    struct GlobalValues
     {
-    private:
-        std::map<std::string, llvm::Value*> m_Data;
-
-    public:
-        DeclarationMap()
-        : m_Data{}
-        {}
-
-        /// Try to find a value to an identifier in the map
-        std::optional<llvm::Value*> find ( const std::string& ident ) const;
+        /// Globals by their index in Program::globals, main is the last one
+        std::vector<llvm::Value*> globals;
 
-        /// Add an identifier and it's value to the map, throwing if it is a redefinition
-        void add ( const std::string& ident, llvm::Value* val );
+        /// Runtime functions by their index in sema::builtins()
+        std::vector<llvm::Function*> builtins;
     };
 
     /******************************************************************/
@@ -53,6 +54,9 @@ namespace compiler
         /// LLVM module
         llvm::Module& m_Module;
 
+        /// Values of the global symbols in the module
+        GlobalValues& m_Globals;
+
         /// Compile constant
         llvm::ConstantInt* compile_const ( const Constant& variant )
         {
@@ -71,6 +75,9 @@ namespace compiler
             return std::visit( *this, variant );
         }
 
+        /// Value of a constant integer expression, like an array bound
+        long long constant_int ( const Expression& expr );
+
         // TODO groups like this in doc
         /// @name Constant generators
         /// @{
@@ -82,13 +89,57 @@ namespace compiler
         llvm::Constant* operator() ( const VariableAccess& );
         llvm::Constant* operator() ( const ConstantExpression& );
         llvm::Constant* operator() ( const ptr<ArrayAccess>& );
+        llvm::Constant* operator() ( const ptr<ArraySlice>& );
+        llvm::Constant* operator() ( const ptr<ArrayReduction>& );
         llvm::Constant* operator() ( const ptr<SubprogramCall>& );
+        llvm::Constant* operator() ( const ptr<SetConstructor>& );
         llvm::Constant* operator() ( const ptr<UnaryOperator>& );
         llvm::Constant* operator() ( const ptr<BinaryOperator>& );
 
         // Types
         llvm::Type* operator() ( SimpleType );
         llvm::Type* operator() ( const ptr<Array>& );
+        llvm::Type* operator() ( const ptr<DynamicArray>& );
+        llvm::Type* operator() ( const ptr<Set>& );
+    };
+
+    /**
+     * @brief Alias scopes of the array accesses of a subprogram
+     *
+     * Arrays are distinct variables, so accesses of different arrays never
+     * overlap. Every access gets the scope of its array and the scopes of
+     * all other arrays of the subprogram as noalias, once all are known.
+     */
+    class ArrayScopes
+    {
+    private:
+        /// Load or store with the array it accesses, arrays are identified by their symbols
+        std::vector<std::pair<llvm::Instruction*, std::pair<Symbol::SCOPE, size_t>>> m_Accesses;
+
+    public:
+        /// Slots of the var and const parameters, their arrays may be any arrays of the callers
+        std::set<size_t> m_References {};
+
+        void add ( llvm::Instruction* access, const Symbol& array );
+
+        /// Attach the metadata to the accesses, the scopes are named after the subprogram
+        void annotate ( llvm::LLVMContext& context, const std::string& name ) const;
+    };
+
+    /// Elements of a whole array or a slice in the row-major block
+    struct Elements
+    {
+        /// Address of the first element, the 64-bit word of a packed array
+        llvm::Value* first;
+
+        /// Number of elements of the first dimension, i64
+        llvm::Value* rows;
+
+        /// Number of elements, or words of a packed array, of a single row
+        long long stride;
+
+        /// Type of the elements, i64 for packed arrays
+        llvm::Type* type;
     };
 
     /**
@@ -100,8 +151,20 @@ namespace compiler
     struct ExprVisitor : public ConstantVisitor
     {
     public:
-        /// Local declarations
-        const DeclarationMap m_Locals;
+        /// Addresses of the local slots: parameters, variables and the result
+        const std::vector<llvm::Value*> m_Locals;
+
+        /// Collects the array accesses of the subprogram, nullptr outside of one
+        ArrayScopes* m_ArrayScopes = nullptr;
+
+        /// Bounds checks of the array accesses, nullptr when the checks are off
+        const bounds::Analysis* m_Bounds = nullptr;
+
+        /// Loops being compiled in their guarded version, their hoisted checks are left out
+        std::set<const For*> m_Guarded {};
+
+        /// Location of the statement being compiled, reported by failed checks
+        Location m_Location {};
 
         /// Compile expression
         llvm::Value* compile_expr ( const Expression& variant )
@@ -109,17 +172,104 @@ namespace compiler
             return std::visit( *this, variant );
         }
 
-        llvm::Value* local_or_global ( const std::string& name );
+        /// Address of a local or global variable
+        llvm::Value* address ( const std::optional<Symbol>& symbol );
+
+        /**
+         * Position of an array element in the row-major block, constant parts
+         * of the indexes are folded together with the low bounds into a
+         * single offset. The access (ArrayAccess or ArrayAssignment node)
+         * picks the bounds checks of its indexes
+         */
+        llvm::Value* position (
+            const std::optional<Symbol>& array,
+            const Many<Expression>& indexes,
+            const void* access
+        );
+
+        /// Address of an array element, see position
+        llvm::Value* element (
+            const std::optional<Symbol>& array,
+            const Many<Expression>& indexes,
+            const std::string& name,
+            const void* access
+        );
+
+        /// Address of the 64-bit word of a packed array holding an element and the bit of the element in it
+        std::pair<llvm::Value*, llvm::Value*> packed_element (
+            const std::optional<Symbol>& array,
+            const Many<Expression>& indexes,
+            const std::string& name,
+            const void* access
+        );
+
+        /// Set with the values of the constructor that are within its type, the others are left out
+        llvm::Value* compile_set ( const SetConstructor& set );
+
+        /// Whether an integer is in a set of the type
+        llvm::Value* compile_membership ( llvm::Value* value, llvm::Value* set, const Set& type );
+
+        /// Exit the program with an error unless the position is within the array of count (i64) elements
+        void bounds_check ( llvm::Value* position, long long low, llvm::Value* count );
+
+        /// Data pointer and i64 length of a dynamic array, loaded from its descriptor
+        std::pair<llvm::Value*, llvm::Value*> descriptor ( const std::optional<Symbol>& array );
+
+        /// Elements of a whole array, rows of a packed one are left to its words
+        Elements elements ( const std::optional<Symbol>& array );
+
+        /// Elements of a slice, an empty slice has no rows wherever it is
+        Elements elements ( const ArraySlice& slice );
+
+        /// Elements of a whole array (VariableAccess) or a slice
+        Elements elements ( const Expression& array );
+
+        /**
+         * Compile a loop over 0..count-1 by strips of width, followed by a
+         * loop over the rest one by one, the callback generates the body
+         * from the first position and the width of a strip
+         */
+        void compile_strips (
+            llvm::Value* count,
+            unsigned width,
+            const std::function<void( llvm::Value*, unsigned )>& body,
+            const std::string& name
+        );
+
+        /// Record a load or store of an array element for the alias scopes
+        void array_access ( llvm::Instruction* access, const std::optional<Symbol>& array );
+
+        /// Function a call refers to
+        llvm::Function* callee ( const SubprogramCall& sub );
+
+        /// Compile the arguments of a call, pointer parameters get the addresses of the variables
+        std::vector<llvm::Value*> compile_arguments ( const SubprogramCall& sub, llvm::Function* fun );
+
+        /// Compile a call of a subprogram, matching its calling convention
+        llvm::CallInst* compile_call ( const SubprogramCall& sub );
 
         // Expressions
         llvm::Value* operator() ( const VariableAccess& );
         llvm::Value* operator() ( const ConstantExpression& );
         llvm::Value* operator() ( const ptr<ArrayAccess>& );
+        llvm::Value* operator() ( const ptr<ArraySlice>& );
+        llvm::Value* operator() ( const ptr<ArrayReduction>& );
         llvm::Value* operator() ( const ptr<SubprogramCall>& );
+        llvm::Value* operator() ( const ptr<SetConstructor>& );
         llvm::Value* operator() ( const ptr<UnaryOperator>& );
         llvm::Value* operator() ( const ptr<BinaryOperator>& );
     };
 
+    /// Self tail recursion turned into a loop
+    struct TailRecursion
+    {
+        /// Block after the prologue the recursive calls jump to
+        llvm::BasicBlock* header;
+
+        /// Addresses of the parameters, in order, the arguments are stored to
+        std::vector<llvm::Value*> parameters;
+    };
+
     /// Visitor generating statements in function and procedure
     class SubprogramVisitor : public ExprVisitor
     {
@@ -136,35 +286,179 @@ namespace compiler
         /// In loop the basic block that continues the looping, otherwise nullopt
         std::optional<llvm::BasicBlock*> m_LoopContinuation;
 
-        /// Compile a statement
-        void compile_stm ( const Statement& variant )
-        {
-            return std::visit( *this, variant );
-        }
+        /// Debug scope of the subprogram, nullptr without debug information
+        llvm::DISubprogram* m_DebugScope;
+
+        /// Set when self tail calls are compiled as jumps, otherwise nullopt
+        std::optional<TailRecursion> m_TailRecursion;
+
+        /// The statement being compiled is followed only by the return of the subprogram
+        bool m_Tail = true;
+
+        /// Counter of the pending spawned calls, nullptr when the subprogram spawns none
+        llvm::Value* m_Frame = nullptr;
+
+        /// Slot of the arena released when the subprogram returns, nullptr when it has none
+        llvm::Value* m_Arena = nullptr;
+
+        /// Reordered loop nests, nullptr when the loops are compiled as written
+        const loops::Plans* m_Nests = nullptr;
+
+        /**
+         * Compiling the body of a parallel for, whose iterations may store
+         * bits of the same word of a packed array, so they do it atomically
+         */
+        bool m_Parallel = false;
+
+        /// Compile a statement, its instructions get the statement's location
+        void compile_stm ( const Statement& variant );
 
         // Statements
         void operator() ( const SubprogramCall& );
         void operator() ( const Assignment& );
         void operator() ( const ArrayAssignment& );
+        void operator() ( const SliceAssignment& );
+        void operator() ( const SetLength& );
         void operator() ( const ExitStatement& );
         void operator() ( const BreakStatement& );
         void operator() ( const EmptyStatement& );
+        void operator() ( const Spawn& );
+        void operator() ( const SyncStatement& );
         void operator() ( const ptr<Block>& );
         void operator() ( const ptr<If>& );
         void operator() ( const ptr<While>& );
         void operator() ( const ptr<For>& );
 
+        /**
+         * Compile an assignment to a whole array or a slice: a copy of the
+         * elements of another one, a store of an array value or a fill by
+         * an element value
+         */
+        void compile_array_assignment ( const Elements& target, const std::optional<Symbol>& array, const Expression& value );
+
         /// Compile the subprogram code
         void compile_block ( const Block& code );
 
         /// Helper function to handle compiling of 'while' and 'for' loops
-        void compile_loop ( Expression condition, Statement block );
+        void compile_loop ( const Expression& condition, const Statement& block );
+
+        /**
+         * Compile a counted loop from init to bound (both evaluated already),
+         * the induction variable is stored to the iterator for the body, which
+         * ends with the value after the loop. When the body may write the
+         * iterator, the next iteration continues from its value
+         */
+        void compile_counted_loop (
+            llvm::Value* iterator,
+            llvm::Value* init,
+            llvm::Value* bound,
+            bool up,
+            const Statement& code,
+            const std::string& name,
+            bool written = false
+        );
+
+        /// Compile a counted loop whose body is generated by the callback
+        void compile_counted_loop (
+            llvm::Value* iterator,
+            llvm::Value* init,
+            llvm::Value* bound,
+            bool up,
+            const std::function<void()>& body,
+            const std::string& name,
+            bool written = false
+        );
+
+        /**
+         * Compile a loop over tiles of lo..hi (lo <= hi), the callback
+         * generates the body from the first and the last value of a tile
+         */
+        void compile_tiles (
+            llvm::Value* lo,
+            llvm::Value* hi,
+            unsigned tile,
+            const std::function<void( llvm::Value*, llvm::Value* )>& body,
+            const std::string& name
+        );
+
+        /**
+         * Compile a nest of two for loops in the order given by the plan.
+         * The body runs only when both ranges are not empty, the variables
+         * end up with the same values as after the loops as written
+         */
+        void compile_loop_nest ( const For& outer, const loops::Nest& nest );
+
+        /**
+         * Compile a parallel for, the body is outlined into a function the
+         * runtime runs on ranges of the iterations. Variables are shared
+         * through an environment of their addresses, the loop variable and
+         * the reduced variables are private to each range
+         */
+        void compile_parallel_for ( const For& loop );
+
+        /**
+         * Compile a serial for whose hoisted bounds checks hold when the
+         * variable stays within the guard, as two versions of the loop:
+         * without the checks when the whole range is within the guard,
+         * otherwise with them
+         */
+        void compile_guarded_for ( const For& loop, const bounds::Guard& guard );
+
+        /// Whether the variable of a loop from init to bound stays within the guard
+        llvm::Value* guard_holds ( llvm::Value* init, llvm::Value* bound, bool up, const bounds::Guard& guard );
+
+        /**
+         * Compile the code twice, without the hoisted checks of the loops
+         * when the guards hold, with them otherwise
+         */
+        void compile_versions ( llvm::Value* holds, const std::vector<const For*>& loops, const std::function<void()>& code );
+
+        /// Wait for the calls spawned by the subprogram, nothing when it spawns none
+        void compile_sync ();
+
+        /**
+         * Compile a condition as a jump to one of the blocks. The right hand
+         * side of and/or is skipped by a branch when it has side effects,
+         * may trap or is expensive, otherwise it is combined by a select
+         */
+        void compile_condition ( const Expression& condition, llvm::BasicBlock* trueBB, llvm::BasicBlock* falseBB );
+
+        /**
+         * Compile a call in tail position whose value is returned (nothing
+         * for procedures), returning false when it can't be a tail call
+         */
+        bool compile_tail_call ( const SubprogramCall& sub );
     };
 
     /// Visitor generating top level declarations and definitions
     struct ProgramVisitor : public ExprVisitor
     {
     public:
+        /// Cache of generated subprograms, nullptr when caching is off
+        cache::FunctionCache* m_Cache;
+
+        /**
+         * Define the global variables, otherwise they are only declared,
+         * because they are defined in a different module that this one is
+         * linked to
+         */
+        bool m_DefineGlobals;
+
+        /// Debug information builder, nullptr when debug information is off
+        debug::DebugInfo* m_Debug;
+
+        /// Compile self tail recursion as loops
+        bool m_TailRecursionLoops;
+
+        /// Inferred attributes of the subprograms, nullptr when the inference is off
+        const attributes::Table* m_Attributes;
+
+        /// Reordered loop nests, nullptr when the loops are compiled as written
+        const loops::Plans* m_Nests;
+
+        /// Local arrays bigger than this many bytes are allocated in the arena of their subprogram
+        unsigned m_StackArrays;
+
         /// Compile a global definition
         void compile_glob ( const Global& variant )
         {
@@ -182,8 +476,17 @@ namespace compiler
         /// Add a linkage to external functions (writeln, write, readln)
         void add_external_funcs();
 
-        /// Compile the whole AST
-        void compile_program ( const Program& program );
+        /// Compile globals and declarations of all subprograms, including main
+        void compile_declarations ( const Program& program );
+
+        /**
+         * Compile a body of a subprogram, the index points to program globals,
+         * past the end is main
+         */
+        void compile_definition ( const Program& program, size_t index );
+
+        /// Indexes of the program subprograms that have a body, see compile_definition
+        static std::vector<size_t> definitions ( const Program& program );
 
         /// Compile a subprogram declaration
         llvm::Function* compile_subprogram_decl (
@@ -198,11 +501,96 @@ namespace compiler
             const Many<Variable>& parameters,
             const Many<Variable>& variables,
             const std::optional<Type>& retType,
-            const Block& code
+            const Block& code,
+            const Location& location
         );
     };
     /// @}
 
+    /// Options controlling the code generation and optimization
+    struct Options
+    {
+        /// Optimization level (0 - 3), 0 turns the optimizer off
+        unsigned optLevel = 0;
+
+        /**
+         * Whole program mode, everything except main and the runtime imports
+         * gets internal linkage and fast calling convention, so the
+         * interprocedural optimizations can work with it freely
+         */
+        bool wholeProgram = false;
+
+        /**
+         * Link the runtime bitcode embedded in the compiler into the module
+         * before optimization, so the runtime calls can be inlined
+         */
+        bool linkRuntime = false;
+
+        /**
+         * Instrument the program to collect an execution profile, the program
+         * has to be linked with the LLVM profiling runtime (clang -fprofile-generate)
+         * and writes default.profraw, or the file in LLVM_PROFILE_FILE
+         */
+        bool profileGenerate = false;
+
+        /**
+         * Profile merged by llvm-profdata to optimize with, it provides
+         * branch weights and function entry counts
+         */
+        std::optional<std::string> profileUse = std::nullopt;
+
+        /**
+         * Compile self recursive calls in tail position as jumps to the start
+         * of the subprogram, other tail calls are always marked as such
+         */
+        bool tailRecursionLoops = false;
+
+        /// Emit DWARF debug information describing the source file
+        bool debugInfo = false;
+
+        /// Path of the compiled source, used by the debug information
+        std::string sourceFile = "";
+
+        /// Directory of the persistent subprogram cache, nullopt turns the cache off
+        std::optional<std::string> cacheDirectory = std::nullopt;
+
+        /// Number of threads generating the subprogram bodies
+        unsigned jobs = 1;
+
+        /// Native object (or archive with more partitions) to write instead of printing the IR
+        std::optional<std::string> objectFile = std::nullopt;
+
+        /// Number of partitions the module is split into for parallel code generation
+        unsigned partitions = 1;
+
+        /// Report collecting the time spent in each phase, nullptr turns the measuring off
+        timing::Report* report = nullptr;
+
+        /**
+         * Check the indexes of array accesses, exiting with an error when
+         * one is out of bounds. Checks proven by the range analysis are
+         * left out, those of loop variables are hoisted before the loop
+         */
+        bool boundsCheck = false;
+
+        /**
+         * Interchange or tile nests of for loops walking multidimensional
+         * arrays column by column, tiles have this many iterations of each
+         * loop, 0 compiles the loops as written
+         */
+        unsigned tileLoops = 0;
+
+        /**
+         * Local arrays bigger than this many bytes are allocated in the
+         * arena of their subprogram instead of the stack, like the dynamic
+         * arrays, and released together with them when it returns
+         */
+        unsigned stackArrays = 65536;
+    };
+
+    /// Map the optimization level number to LLVM optimization level
+    llvm::OptimizationLevel optimization_level ( unsigned level );
+
     /**
      * @brief Code compiler
      *
@@ -222,21 +610,65 @@ namespace compiler
         /// LLVM module
         llvm::Module m_Module;
 
-        Compiler ( const std::string& name )
+        /// Subprogram cache, if it is turned on
+        std::unique_ptr<cache::FunctionCache> m_Cache;
+
+        /// Options the program was compiled with
+        Options m_Options;
+
+        /// Statistics of the bounds checks, if they are turned on
+        std::optional<bounds::Stats> m_BoundsStats;
+
+        Compiler ( const std::string& name, const Options& options )
         : m_Context {}
         , m_Builder { m_Context }
         , m_Module{ name, m_Context }
+        , m_Options { options }
         {}
 
+        /**
+         * Generate the code of the program. With more than one job the
+         * subprogram bodies are generated by worker threads, each into its own
+         * context and module, which are then linked into this module
+         */
+        void generate ( const Program& program, unsigned jobs );
+
+        /// Verify the generated module, throwing on broken IR
+        void verify () const;
+
+        /// Link the embedded runtime bitcode into the module
+        void link_runtime ();
+
+        /**
+         * Give every definition except main internal linkage and fast
+         * calling convention, marking all functions as nounwind
+         */
+        void internalize ();
+
+        /// Run the LLVM optimization pipeline on given level over the module
+        void optimize ( unsigned level );
+
     public:
         /**
          * Compile the given program, returning a pointer to a struct that
          * persist the inner LLVM structure
          */
-        static std::unique_ptr<Compiler> compile ( const Program& program );
+        static std::unique_ptr<Compiler> compile ( const Program& program, const Options& options = {} );
 
         /// Get the generated module
         const llvm::Module& get_module () const;
+
+        /// Get the subprogram cache statistics, nullopt if the cache was off
+        std::optional<cache::Stats> cache_stats () const;
+
+        /// Get the bounds check statistics, nullopt if the checks were off
+        std::optional<bounds::Stats> bounds_stats () const;
+
+        /**
+         * Generate native code into the object file given by the options,
+         * split into the given number of partitions generated in parallel
+         */
+        void emit_object ();
     };
 }
 
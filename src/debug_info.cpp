@@ -0,0 +1,191 @@
+#include "debug_info.hpp"
+#include "sema.hpp"
+#include <filesystem>
+#include <stdexcept>
+#include <llvm/Transforms/Utils/ValueMapper.h>
+
+namespace debug
+{
+    DebugInfo::DebugInfo ( llvm::Module& module, const std::string& source, bool optimized, const Program& program )
+    : m_Builder { module }
+    , m_Optimized { optimized }
+    , m_Program { program }
+    {
+        auto path = std::filesystem::absolute( source );
+        m_File = m_Builder.createFile( path.filename().string(), path.parent_path().string() );
+
+        // Mila is close enough to Pascal for the debuggers
+        m_Unit = m_Builder.createCompileUnit(
+            llvm::dwarf::DW_LANG_Pascal83,
+            m_File,
+            "mila",
+            optimized,
+            "",
+            0
+        );
+
+        if ( module.getModuleFlag( "Debug Info Version" ) == nullptr ){
+            module.addModuleFlag( llvm::Module::Warning, "Debug Info Version", llvm::DEBUG_METADATA_VERSION );
+            module.addModuleFlag( llvm::Module::Warning, "Dwarf Version", 4 );
+        }
+    }
+
+    llvm::DIType* DebugInfo::type ( const Type& type )
+    {
+        if ( auto simple = std::get_if<SimpleType>( &type ) ){
+            switch ( *simple ) {
+            case SimpleType::INTEGER:
+                return m_Builder.createBasicType( "integer", 32, llvm::dwarf::DW_ATE_signed );
+            case SimpleType::BOOLEAN:
+                return m_Builder.createBasicType( "boolean", 8, llvm::dwarf::DW_ATE_boolean );
+            }
+        }
+
+        // A set of a..b is a bitset of whole 64-bit words
+        if ( auto set = std::get_if<ptr<Set>>( &type ) ){
+            auto low = sema::constant_value( m_Program, (*set)->lowBound ).value();
+            auto high = sema::constant_value( m_Program, (*set)->highBound ).value();
+            auto base = m_Builder.createBasicType( "integer", 32, llvm::dwarf::DW_ATE_signed );
+            return m_Builder.createSetType( m_Unit, "set of " + std::to_string( low ) + ".." + std::to_string( high ),
+                m_File, 0, ( high - low + 64 ) / 64 * 64, 64, base );
+        }
+
+        // A dynamic array is its descriptor: the elements, their number and the arena owning them
+        if ( auto dyn = std::get_if<ptr<DynamicArray>>( &type ) ){
+            auto element = this->type( (*dyn)->elementType );
+            auto member = [this]( const char* name, llvm::DIType* t, uint64_t offset ) -> llvm::Metadata* {
+                return m_Builder.createMemberType( m_Unit, name, m_File, 0, 64, 64, offset, llvm::DINode::FlagZero, t );
+            };
+            llvm::Metadata* members[] = {
+                member( "data", m_Builder.createPointerType( element, 64 ), 0 ),
+                member( "length", m_Builder.createBasicType( "length", 64, llvm::dwarf::DW_ATE_signed ), 64 ),
+                member( "arena", m_Builder.createPointerType( nullptr, 64 ), 128 )
+            };
+            return m_Builder.createStructType( m_Unit, "array of " + element->getName().str(),
+                m_File, 0, 192, 64, llvm::DINode::FlagZero, nullptr, m_Builder.getOrCreateArray( members ) );
+        }
+
+        // Bounds were checked to be constant by the semantic analysis,
+        // dimensions are subranges of a single array type like in C
+        auto element = this->type( element_type( type ) );
+        auto size = element->getSizeInBits();
+        llvm::SmallVector<llvm::Metadata*, 4> subranges {};
+        for ( auto arr : dimensions( type ) ){
+            auto low = sema::constant_value( m_Program, arr->lowBound ).value();
+            auto high = sema::constant_value( m_Program, arr->highBound ).value();
+            auto count = high - low + 1;
+            subranges.push_back( m_Builder.getOrCreateSubrange( low, count ) );
+            size *= count;
+        }
+
+        // Bits of packed arrays aren't addressable, the debugger sees the words holding them
+        if ( packed( type ) ){
+            auto words = ( size / element->getSizeInBits() + 63 ) / 64;
+            return m_Builder.createArrayType(
+                words * 64,
+                0,
+                m_Builder.createBasicType( "word", 64, llvm::dwarf::DW_ATE_unsigned ),
+                m_Builder.getOrCreateArray( { m_Builder.getOrCreateSubrange( 0, words ) } )
+            );
+        }
+
+        return m_Builder.createArrayType(
+            size,
+            0,
+            element,
+            m_Builder.getOrCreateArray( subranges )
+        );
+    }
+
+    llvm::DISubprogram* DebugInfo::subprogram (
+        llvm::Function* function,
+        const Many<Variable>& parameters,
+        const std::optional<Type>& retType,
+        const Location& location )
+    {
+        // First is the return type, null for procedures
+        llvm::SmallVector<llvm::Metadata*, 8> types {};
+        types.push_back( retType.has_value() ? type( retType.value() ) : nullptr );
+        for ( const auto& p : parameters ){
+            // Var and const parameters are passed as references
+            auto t = type( p.type );
+            types.push_back( p.mode == Variable::MODE::VALUE ? t : m_Builder.createReferenceType( llvm::dwarf::DW_TAG_reference_type, t ) );
+        }
+
+        auto flags = llvm::DISubprogram::SPFlagDefinition;
+        if ( m_Optimized ){
+            flags |= llvm::DISubprogram::SPFlagOptimized;
+        }
+        if ( function->hasLocalLinkage() ){
+            flags |= llvm::DISubprogram::SPFlagLocalToUnit;
+        }
+
+        auto sub = m_Builder.createFunction(
+            m_File,
+            function->getName(),
+            function->getName(),
+            m_File,
+            location.line,
+            m_Builder.createSubroutineType( m_Builder.getOrCreateTypeArray( types ) ),
+            location.line,
+            llvm::DINode::FlagPrototyped,
+            flags
+        );
+
+        function->setSubprogram( sub );
+        return sub;
+    }
+
+    llvm::DILocation* DebugInfo::location ( llvm::DIScope* scope, const Location& location ) const
+    {
+        return llvm::DILocation::get( scope->getContext(), location.line, location.column, scope );
+    }
+
+    void DebugInfo::variable (
+        llvm::IRBuilder<>& builder,
+        llvm::DISubprogram* scope,
+        llvm::Value* address,
+        const Variable& var,
+        unsigned argNo )
+    {
+        llvm::DILocalVariable* desc;
+        if ( argNo > 0 ){
+            desc = m_Builder.createParameterVariable( scope, var.name, argNo, m_File, var.location.line, type( var.type ), true );
+        }
+        else {
+            desc = m_Builder.createAutoVariable( scope, var.name, m_File, var.location.line, type( var.type ), true );
+        }
+
+        m_Builder.insertDeclare(
+            address,
+            desc,
+            m_Builder.createExpression(),
+            location( scope, var.location ),
+            builder.GetInsertBlock()
+        );
+    }
+
+    void DebugInfo::finalize ()
+    {
+        m_Builder.finalize();
+    }
+
+    void share_unit ( llvm::Module& part, const llvm::Module& module )
+    {
+        auto units = module.getNamedMetadata( "llvm.dbg.cu" );
+        auto partUnits = part.getNamedMetadata( "llvm.dbg.cu" );
+        if ( units == nullptr || units->getNumOperands() == 0 || partUnits == nullptr ){
+            return;
+        }
+
+        // Subprograms are distinct and updated in place, types scoped in the unit are recreated
+        llvm::ValueToValueMapTy vmap {};
+        for ( auto unit : partUnits->operands() ){
+            vmap.MD()[unit].reset( units->getOperand( 0 ) );
+        }
+        for ( auto& fun : part ){
+            llvm::RemapFunction( fun, vmap, llvm::RF_IgnoreMissingLocals | llvm::RF_ReuseAndMutateDistinctMDs );
+        }
+        part.eraseNamedMetadata( partUnits );
+    }
+}
@@ -0,0 +1,84 @@
+#ifndef DEBUG_INFO_HPP
+#define DEBUG_INFO_HPP
+
+#include "ast.hpp"
+#include <llvm/IR/DIBuilder.h>
+#include <llvm/IR/DebugInfoMetadata.h>
+#include <llvm/IR/Function.h>
+#include <llvm/IR/IRBuilder.h>
+#include <llvm/IR/Instructions.h>
+#include <llvm/IR/Module.h>
+#include <string>
+
+/// DWARF debug information of the generated code
+namespace debug
+{
+    using namespace ast;
+
+    /**
+     * @brief Debug information builder of a single module
+     *
+     * Holds the compile unit of the source file, subprograms and variables
+     * are described in it. finalize() has to be called once the module is
+     * generated.
+     */
+    class DebugInfo
+    {
+    private:
+        llvm::DIBuilder m_Builder;
+        llvm::DIFile* m_File;
+        llvm::DICompileUnit* m_Unit;
+        bool m_Optimized;
+
+        /// Analyzed program, the array bounds are evaluated in it
+        const Program& m_Program;
+
+    public:
+        /**
+         * @param module Module the debug information belongs to
+         * @param source Path of the compiled source file
+         * @param optimized Whether the code is going to be optimized
+         * @param program Program being compiled
+         */
+        DebugInfo ( llvm::Module& module, const std::string& source, bool optimized, const Program& program );
+
+        /// Debug type of a Mila type
+        llvm::DIType* type ( const Type& type );
+
+        /// Describe a subprogram definition and attach it to the function
+        llvm::DISubprogram* subprogram (
+            llvm::Function* function,
+            const Many<Variable>& parameters,
+            const std::optional<Type>& retType,
+            const Location& location
+        );
+
+        /// Location in given scope
+        llvm::DILocation* location ( llvm::DIScope* scope, const Location& location ) const;
+
+        /**
+         * Describe a variable stored at the address, argNo is the 1-based
+         * position of a parameter, 0 for local variables
+         */
+        void variable (
+            llvm::IRBuilder<>& builder,
+            llvm::DISubprogram* scope,
+            llvm::Value* address,
+            const Variable& var,
+            unsigned argNo
+        );
+
+        /// Resolve the debug information, no more can be added afterwards
+        void finalize ();
+    };
+
+    /**
+     * Move the debug information of a module about to be linked into
+     * another one to the compile unit of the other, which stays its only
+     * unit. Nothing changes when the other module has no unit yet. Both
+     * have to be in the same context
+     */
+    void share_unit ( llvm::Module& part, const llvm::Module& module );
+}
+
+#endif // DEBUG_INFO_HPP
@@ -30,12 +30,14 @@ namespace lexer
     std::optional<token::Token> transition ( const Table<St>& table, Position& pos, std::istream& stream, const St& state )
     {
         // Bad stream
-        if ( stream.fail() ){
+        if ( stream.bad() ){
             throw std::runtime_error( "Error while reading input." );
         }
 
         // Handle EOF
-        if ( stream.eof() || std::isspace( stream.peek() ) ){
+        if ( stream.eof()
+            || stream.peek() == std::char_traits<char>::eof()
+            || std::isspace( stream.peek() ) ){
             // On start state just return nothing
             if ( is_start_state<St>::value ){
                 return std::nullopt;
@@ -130,6 +132,7 @@ namespace lexer
             }
         }
 
+        m_TokenStart = m_Position;
         return transition_all(start_state(), m_Position, m_Data);
     }
 
@@ -138,4 +141,9 @@ namespace lexer
         return m_Position;
     }
 
+    Position Lexer::token_position() const
+    {
+        return m_TokenStart;
+    }
+
 }
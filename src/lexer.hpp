@@ -29,6 +29,9 @@ namespace lexer
         std::istream& m_Data;
         Position m_Position {0, 1};
 
+        /// Where the last scanned token starts
+        Position m_TokenStart {0, 1};
+
     public:
         Lexer( std::istream& str )
         : m_Data( str )
@@ -41,6 +44,9 @@ namespace lexer
 
         /// Return current line and column number number
         Position position() const;
+
+        /// Return the position of the first character of the last scanned token
+        Position token_position() const;
     };
 
 }
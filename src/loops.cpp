@@ -0,0 +1,495 @@
+#include "loops.hpp"
+#include "sema.hpp"
+#include "variant_helpers.hpp"
+#include <algorithm>
+#include <set>
+#include <vector>
+
+namespace loops
+{
+    /// Symbols identify the variables
+    using Key = std::pair<Symbol::SCOPE, size_t>;
+
+    std::optional<Key> key ( const std::optional<Symbol>& symbol )
+    {
+        if ( ! symbol.has_value() ){
+            return std::nullopt;
+        }
+        return Key{ symbol->scope, symbol->index };
+    }
+
+    /// Variable a simple expression reads, nullopt for anything else
+    std::optional<Key> variable ( const Expression& e )
+    {
+        auto va = std::get_if<VariableAccess>( &e );
+        return va == nullptr ? std::nullopt : key( va->symbol );
+    }
+
+    /// Index of the form `v + c` or just `c`, the variable is nullopt for constants
+    struct Affine
+    {
+        std::optional<Key> variable;
+        long long offset;
+
+        bool operator== ( const Affine& ) const = default;
+    };
+
+    std::optional<Affine> affine ( const Program& program, const Expression& e )
+    {
+        if ( auto c = sema::constant_value( program, e ); c.has_value() ){
+            return Affine{ std::nullopt, c.value() };
+        }
+
+        if ( auto v = variable( e ); v.has_value() ){
+            return Affine{ v, 0 };
+        }
+
+        auto bin = std::get_if<ptr<BinaryOperator>>( &e );
+        if ( bin == nullptr ){
+            return std::nullopt;
+        }
+
+        bool plus = (*bin)->op == BinaryOperator::OPERATOR::PLUS;
+        bool minus = (*bin)->op == BinaryOperator::OPERATOR::MINUS;
+        auto left = affine( program, (*bin)->left );
+        auto right = affine( program, (*bin)->right );
+        if ( ! left.has_value() || ! right.has_value() || ! ( plus || minus ) ){
+            return std::nullopt;
+        }
+
+        if ( ! right->variable.has_value() ){
+            return Affine{ left->variable, plus ? left->offset + right->offset : left->offset - right->offset };
+        }
+        if ( plus && ! left->variable.has_value() ){
+            return Affine{ right->variable, left->offset + right->offset };
+        }
+        return std::nullopt;
+    }
+
+    /// Whether an expression reads a variable
+    bool mentions ( const Expression& e, const Key& var )
+    {
+        return wrap( e ).visit(
+            [&var]( const VariableAccess& va ){
+                return key( va.symbol ) == var;
+            },
+            []( const ConstantExpression& ){
+                return false;
+            },
+            [&var]( const ptr<ArrayAccess>& arr ){
+                return std::ranges::any_of( arr->indexes, [&var]( const auto& i ){ return mentions( i, var ); } );
+            },
+            [&var]( const ptr<ArraySlice>& sl ){
+                return mentions( sl->low, var ) || mentions( sl->high, var );
+            },
+            [&var]( const ptr<ArrayReduction>& red ){
+                return mentions( red->array, var );
+            },
+            [&var]( const ptr<SubprogramCall>& sub ){
+                return std::ranges::any_of( sub->arguments, [&var]( const auto& a ){ return mentions( a, var ); } );
+            },
+            [&var]( const ptr<SetConstructor>& set ){
+                return std::ranges::any_of( values( *set ), [&var]( const auto& v ){ return mentions( *v, var ); } );
+            },
+            [&var]( const ptr<UnaryOperator>& un ){
+                return mentions( un->expression, var );
+            },
+            [&var]( const ptr<BinaryOperator>& bin ){
+                return mentions( bin->left, var ) || mentions( bin->right, var );
+            }
+        );
+    }
+
+    /// Only statement of a loop body that is another for loop, nullptr otherwise
+    const For* nested ( const Statement& code )
+    {
+        if ( auto fo = std::get_if<ptr<For>>( &code ) ){
+            return fo->get();
+        }
+
+        auto bl = std::get_if<ptr<Block>>( &code );
+        if ( bl == nullptr ){
+            return nullptr;
+        }
+
+        const For* inner = nullptr;
+        for ( const auto& st : (*bl)->statements ){
+            if ( std::holds_alternative<EmptyStatement>( st ) ){
+                continue;
+            }
+            auto fo = std::get_if<ptr<For>>( &st );
+            if ( fo == nullptr || inner != nullptr ){
+                return nullptr;
+            }
+            inner = fo->get();
+        }
+        return inner;
+    }
+
+    /// Collects what the body of a nest does, failing on anything that fixes the order of the iterations
+    class Body
+    {
+    public:
+        /// Array accesses with their indexes, both reads and writes
+        std::vector<std::pair<Key, const Many<Expression>*>> m_Accesses {};
+
+        std::set<Key> m_WrittenArrays {};
+
+        /// Variables summed into
+        std::set<Key> m_Sums {};
+
+        /// Variables read, except by the sums into them
+        std::set<Key> m_Reads {};
+
+        bool m_Valid = true;
+
+        void expr ( const Expression& e )
+        {
+            wrap( e ).visit(
+                [this]( const VariableAccess& va ){
+                    if ( auto k = key( va.symbol ); k.has_value() ){
+                        m_Reads.insert( k.value() );
+                    }
+                },
+                []( const ConstantExpression& ){},
+                [this]( const ptr<ArrayAccess>& arr ){
+                    access( arr->symbol, arr->indexes );
+                },
+                // Whole arrays are read at other elements than the written ones
+                [this]( const ptr<ArraySlice>& ){
+                    m_Valid = false;
+                },
+                [this]( const ptr<ArrayReduction>& ){
+                    m_Valid = false;
+                },
+                // Calls may have side effects or depend on them
+                [this]( const ptr<SubprogramCall>& ){
+                    m_Valid = false;
+                },
+                [this]( const ptr<SetConstructor>& set ){
+                    for ( auto v : values( *set ) ){
+                        expr( *v );
+                    }
+                },
+                [this]( const ptr<UnaryOperator>& un ){
+                    expr( un->expression );
+                },
+                [this]( const ptr<BinaryOperator>& bin ){
+                    expr( bin->left );
+                    expr( bin->right );
+                }
+            );
+        }
+
+        void access ( const std::optional<Symbol>& symbol, const Many<Expression>& indexes )
+        {
+            // Dynamic arrays have a single dimension, there is nothing to reorder for
+            auto k = key( symbol );
+            if ( ! k.has_value() || std::holds_alternative<ptr<DynamicArray>>( symbol->type.value() ) ){
+                m_Valid = false;
+                return;
+            }
+
+            m_Accesses.emplace_back( k.value(), &indexes );
+            for ( const auto& i : indexes ){
+                expr( i );
+            }
+        }
+
+        /// `v := v + e`, `v := e + v` or `v := v - e` with e not reading v
+        void sum ( const Assignment& as )
+        {
+            auto k = key( as.symbol );
+            auto bin = std::get_if<ptr<BinaryOperator>>( &as.value );
+            if ( ! k.has_value() || bin == nullptr ){
+                m_Valid = false;
+                return;
+            }
+
+            const Expression* rest = nullptr;
+            if ( variable( (*bin)->left ) == k ){
+                bool additive = (*bin)->op == BinaryOperator::OPERATOR::PLUS || (*bin)->op == BinaryOperator::OPERATOR::MINUS;
+                rest = additive ? &(*bin)->right : nullptr;
+            }
+            else if ( variable( (*bin)->right ) == k && (*bin)->op == BinaryOperator::OPERATOR::PLUS ){
+                rest = &(*bin)->left;
+            }
+
+            if ( rest == nullptr || mentions( *rest, k.value() ) ){
+                m_Valid = false;
+                return;
+            }
+
+            m_Sums.insert( k.value() );
+            expr( *rest );
+        }
+
+        void stat ( const Statement& s )
+        {
+            std::visit( overloaded {
+                [this]( const Assignment& as ){
+                    sum( as );
+                },
+                [this]( const ArrayAssignment& as ){
+                    if ( auto k = key( as.symbol ); k.has_value() ){
+                        m_WrittenArrays.insert( k.value() );
+                    }
+                    access( as.symbol, as.indexes );
+                    expr( as.value );
+                },
+                []( const EmptyStatement& ){},
+                [this]( const ptr<Block>& bl ){
+                    for ( const auto& st : bl->statements ){
+                        stat( st );
+                    }
+                },
+                [this]( const ptr<If>& if_ ){
+                    expr( if_->condition );
+                    stat( if_->trueCode );
+                    if ( if_->elseCode.has_value() ){
+                        stat( if_->elseCode.value() );
+                    }
+                },
+                // Calls, exits, loops and the runtime
+                [this]( const auto& ){
+                    m_Valid = false;
+                }
+            }, s );
+        }
+    };
+
+    /// Walks the program, planning the nests
+    class Nests
+    {
+    private:
+        const Program& m_Program;
+        unsigned m_Tile;
+
+    public:
+        Plans m_Plans {};
+
+        /// Slots of the var and const parameters of the subprogram being walked
+        std::set<size_t> m_References {};
+
+        Nests ( const Program& program, unsigned tile )
+        : m_Program { program }
+        , m_Tile { tile }
+        {}
+
+        /**
+         * Var and const parameters may refer to global variables, the keys
+         * tell them apart only in subprograms without such parameters
+         */
+        bool aliased ( const Key& k ) const
+        {
+            return ! m_References.empty()
+                && ( k.first == Symbol::SCOPE::GLOBAL || ( k.first == Symbol::SCOPE::LOCAL && m_References.count( k.second ) > 0 ) );
+        }
+
+        /// Bounds of the inner loop can be evaluated once, before the nest
+        bool invariant ( const Expression& e, const Key& outer, const Key& inner, const Body& body ) const
+        {
+            return wrap( e ).visit(
+                [&]( const VariableAccess& va ){
+                    auto k = key( va.symbol );
+                    return k.has_value() && k != outer && k != inner && body.m_Sums.count( k.value() ) == 0
+                        && ! aliased( k.value() );
+                },
+                []( const ConstantExpression& ){
+                    return true;
+                },
+                []( const ptr<ArrayAccess>& ){
+                    return false;
+                },
+                []( const ptr<ArraySlice>& ){
+                    return false;
+                },
+                []( const ptr<ArrayReduction>& ){
+                    return false;
+                },
+                []( const ptr<SubprogramCall>& ){
+                    return false;
+                },
+                []( const ptr<SetConstructor>& ){
+                    return false;
+                },
+                [&]( const ptr<UnaryOperator>& un ){
+                    return invariant( un->expression, outer, inner, body );
+                },
+                [&]( const ptr<BinaryOperator>& bin ){
+                    // Division may trap, the bound could be evaluated when the original wouldn't
+                    switch ( bin->op ) {
+                    case BinaryOperator::OPERATOR::DIVISION:
+                    case BinaryOperator::OPERATOR::INTEGER_DIVISION:
+                    case BinaryOperator::OPERATOR::MODULO:
+                        return false;
+                    default:
+                        return invariant( bin->left, outer, inner, body ) && invariant( bin->right, outer, inner, body );
+                    }
+                }
+            );
+        }
+
+        /// Number of accesses going through columns when the variable is the innermost
+        static size_t columns ( const Body& body, const Key& innermost )
+        {
+            return std::ranges::count_if( body.m_Accesses, [&innermost]( const auto& access ){
+                const auto& indexes = *access.second;
+                if ( indexes.size() < 2 || mentions( indexes.back(), innermost ) ){
+                    return false;
+                }
+                return std::any_of( indexes.begin(), indexes.end() - 1, [&innermost]( const auto& i ){
+                    return mentions( i, innermost );
+                } );
+            } );
+        }
+
+        void plan ( const For& outer )
+        {
+            auto inner = nested( outer.code );
+            if ( inner == nullptr || inner->parallel.has_value() || outer.written || inner->written ){
+                return;
+            }
+
+            auto o = key( outer.symbol );
+            auto i = key( inner->symbol );
+            if ( ! o.has_value() || ! i.has_value() || o == i ){
+                return;
+            }
+
+            Body body {};
+            body.stat( inner->code );
+            if ( ! body.m_Valid
+                || body.m_Sums.count( o.value() ) > 0 || body.m_Sums.count( i.value() ) > 0
+                || ! invariant( inner->initialization, o.value(), i.value(), body )
+                || ! invariant( inner->target, o.value(), i.value(), body ) ){
+                return;
+            }
+
+            // Globals next to var and const parameters
+            std::set<Key> keys { o.value(), i.value() };
+            keys.insert( body.m_WrittenArrays.begin(), body.m_WrittenArrays.end() );
+            keys.insert( body.m_Sums.begin(), body.m_Sums.end() );
+            keys.insert( body.m_Reads.begin(), body.m_Reads.end() );
+            for ( const auto& access : body.m_Accesses ){
+                keys.insert( access.first );
+            }
+            if ( std::ranges::any_of( keys, [this]( const Key& k ){ return aliased( k ) && k.first == Symbol::SCOPE::GLOBAL; } ) ){
+                return;
+            }
+
+            // Sums can go in any order, as long as nothing else reads them
+            for ( const auto& s : body.m_Sums ){
+                if ( body.m_Reads.count( s ) > 0 ){
+                    return;
+                }
+            }
+
+            // Every iteration writes its own elements and reads only them from the written arrays
+            for ( const auto& [array, indexes] : body.m_Accesses )
+            {
+                if ( body.m_WrittenArrays.count( array ) == 0 ){
+                    continue;
+                }
+
+                // Indexes `o + c`, `i + c` or constants, each variable exactly once
+                std::vector<std::optional<Affine>> pattern {};
+                size_t outers = 0, inners = 0;
+                for ( const auto& index : *indexes ){
+                    auto a = affine( m_Program, index );
+                    if ( ! a.has_value() || ( a->variable.has_value() && a->variable != o && a->variable != i ) ){
+                        return;
+                    }
+                    outers += a->variable == o;
+                    inners += a->variable == i;
+                    pattern.push_back( a );
+                }
+                if ( outers != 1 || inners != 1 ){
+                    return;
+                }
+
+                for ( const auto& [other, otherIndexes] : body.m_Accesses ){
+                    if ( other != array ){
+                        continue;
+                    }
+                    for ( size_t d = 0; d < otherIndexes->size(); ++d ){
+                        if ( affine( m_Program, (*otherIndexes)[d] ) != pattern[d] ){
+                            return;
+                        }
+                    }
+                }
+            }
+
+            auto current = columns( body, i.value() );
+            auto swapped = columns( body, o.value() );
+            if ( current == 0 ){
+                return;
+            }
+
+            Nest nest { inner, swapped < current };
+            if ( swapped > 0 ){
+                nest.tile = m_Tile;
+            }
+            m_Plans[&outer] = nest;
+        }
+
+        void stat ( const Statement& s )
+        {
+            std::visit( overloaded {
+                [this]( const ptr<Block>& bl ){
+                    for ( const auto& st : bl->statements ){
+                        stat( st );
+                    }
+                },
+                [this]( const ptr<If>& if_ ){
+                    stat( if_->trueCode );
+                    if ( if_->elseCode.has_value() ){
+                        stat( if_->elseCode.value() );
+                    }
+                },
+                [this]( const ptr<While>& wh ){
+                    stat( wh->code );
+                },
+                [this]( const ptr<For>& fo ){
+                    if ( ! fo->parallel.has_value() ){
+                        plan( *fo );
+                    }
+                    stat( fo->code );
+                },
+                []( const auto& ){}
+            }, s );
+        }
+    };
+
+    Plans analyze ( const Program& program, unsigned tile )
+    {
+        Nests nests { program, tile };
+        auto subprogram = [&nests]( const Many<Variable>& parameters, const Block& code ){
+            nests.m_References.clear();
+            for ( size_t i = 0; i < parameters.size(); ++i ){
+                if ( parameters[i].mode != Variable::MODE::VALUE ){
+                    nests.m_References.insert( i );
+                }
+            }
+            for ( const auto& st : code.statements ){
+                nests.stat( st );
+            }
+        };
+
+        for ( const auto& g : program.globals ){
+            if ( auto proc = std::get_if<Procedure>( &g ) ){
+                subprogram( proc->parameters, proc->code );
+            }
+            else if ( auto fun = std::get_if<Function>( &g ) ){
+                subprogram( fun->parameters, fun->code );
+            }
+        }
+
+        nests.m_References.clear();
+        for ( const auto& st : program.code.statements ){
+            nests.stat( st );
+        }
+
+        return nests.m_Plans;
+    }
+}
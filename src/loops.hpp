@@ -0,0 +1,42 @@
+#ifndef LOOPS_HPP
+#define LOOPS_HPP
+
+#include "ast.hpp"
+#include <map>
+
+/// Interchange and tiling of nested for loops for the locality of row-major arrays
+namespace loops
+{
+    using namespace ast;
+
+    /// How a nest of two for loops is reordered
+    struct Nest
+    {
+        /// The only statement of the outer loop
+        const For* inner;
+
+        /// The loop of the inner variable runs outside of the loop of the outer one
+        bool interchange = false;
+
+        /// Both variables go through tiles of this size, 0 when not tiled
+        unsigned tile = 0;
+    };
+
+    /// Reordered nests by their outer loop
+    using Plans = std::map<const For*, Nest>;
+
+    /**
+     * @brief Find the nests walking multidimensional arrays column by column
+     *
+     * A serial for whose body is just another serial for over a range not
+     * depending on the outer one can be reordered freely when its body
+     * only writes array elements indexed by both variables, reads written
+     * arrays only at those elements and sums into variables it doesn't
+     * read otherwise. Nests whose inner variable indexes a dimension other
+     * than the last one are interchanged when the other order walks all
+     * arrays row by row, otherwise both loops are split into tiles.
+     */
+    Plans analyze ( const Program& program, unsigned tile );
+}
+
+#endif // LOOPS_HPP
@@ -2,14 +2,21 @@
 #include "lexer.hpp"
 #include "ast.hpp"
 #include "parser.hpp"
+#include "sema.hpp"
+#include "timing.hpp"
 #include "tokens.hpp"
 
+#include <algorithm>
+#include <cctype>
 #include <fstream>
 #include <ios>
 #include <iostream>
 #include <llvm/Support/raw_ostream.h>
+#include <optional>
+#include <sstream>
 #include <stdexcept>
 #include <string>
+#include <thread>
 
 constexpr const char * USAGE =
     "Usage: \n"
@@ -17,7 +24,25 @@ constexpr const char * USAGE =
     "\t-h\t\t Print this help\n"
     "\t-l\t\t Print lexer output\n"
     "\t-p\t\t Print parser output\n"
-    "\t-o\t\t Compile the input, printing the LLVM IR\n";
+    "\t-o\t\t Compile the input, printing the LLVM IR\n"
+    "\n"
+    "Compilation flags (after -o):\n"
+    "\t-O<0-3>\t\t Optimization level\n"
+    "\t-g\t\t Emit DWARF debug information\n"
+    "\t--whole-program\t Internalize everything except main and run the IPO pipeline\n"
+    "\t--tail-recursion-loops\t Compile self recursive tail calls as loops\n"
+    "\t--link-runtime\t Link the runtime into the output, allowing its inlining\n"
+    "\t--bounds-check\t Exit with an error on array indexes out of bounds, printing statistics\n"
+    "\t--tile-loops[=<N>]\t Interchange or tile (N by N, default 32) loops walking arrays column by column\n"
+    "\t--stack-arrays=<BYTES>\t Local arrays bigger than BYTES (default 65536) are allocated on the heap\n"
+    "\t--profile-generate\t Instrument the program for profiling, link it with clang -fprofile-generate\n"
+    "\t--profile-use=<FILE>\t Optimize using the profile merged by llvm-profdata\n"
+    "\t--cache=<DIR>\t Reuse unchanged subprograms from the cache in DIR, printing statistics\n"
+    "\t-j<N>\t\t Generate subprograms on N threads (0 for all cores)\n"
+    "\t--emit-obj=<FILE>\t Write a native object into FILE instead of printing the IR\n"
+    "\t--time-report\t Print time, peak memory and sizes of each compiler phase\n"
+    "\t--time-report=<FILE>\t Write the phase report as JSON into FILE\n"
+    "\t--split=<N>\t Split code generation into N parallel partitions (0 for all cores), FILE of --emit-obj becomes an archive\n";
 
 void print_lexer( const std::string& in_file )
 {
@@ -47,16 +72,178 @@ void print_parser( const std::string& in_file )
     std::cout << ast::to_string( ast ) << std::endl;
 }
 
-void compile( const std::string& in_file )
+/// Where the time report goes, if requested
+struct ReportOptions
+{
+    bool enabled = false;
+
+    /// JSON output file, the table is printed to stderr without it
+    std::optional<std::string> jsonFile = std::nullopt;
+};
+
+/// Parse the compilation flags following the -o flag
+compiler::Options parse_options( int argc, char const* argv [], ReportOptions& reportOptions )
+{
+    compiler::Options options {};
+    bool split = false;
+
+    for ( int i = 3; i < argc; ++i )
+    {
+        std::string flag ( argv[i] );
+
+        if ( flag.size() == 3 && flag.starts_with( "-O" ) && flag[2] >= '0' && flag[2] <= '3' ) {
+            options.optLevel = flag[2] - '0';
+        }
+        else if ( flag == "-g" ) {
+            options.debugInfo = true;
+        }
+        else if ( flag == "--whole-program" ) {
+            options.wholeProgram = true;
+        }
+        else if ( flag == "--tail-recursion-loops" ) {
+            options.tailRecursionLoops = true;
+        }
+        else if ( flag == "--link-runtime" ) {
+            options.linkRuntime = true;
+        }
+        else if ( flag == "--bounds-check" ) {
+            options.boundsCheck = true;
+        }
+        else if ( flag == "--tile-loops" ) {
+            options.tileLoops = 32;
+        }
+        else if ( flag.starts_with( "--tile-loops=" ) && flag.size() > 13
+            && std::ranges::all_of( flag.substr( 13 ), ::isdigit ) ) {
+            options.tileLoops = std::stoul( flag.substr( 13 ) );
+        }
+        else if ( flag.starts_with( "--stack-arrays=" ) && flag.size() > 15
+            && std::ranges::all_of( flag.substr( 15 ), ::isdigit ) ) {
+            options.stackArrays = std::stoul( flag.substr( 15 ) );
+        }
+        else if ( flag.starts_with( "-j" ) && flag.size() > 2
+            && std::ranges::all_of( flag.substr( 2 ), ::isdigit ) ) {
+            options.jobs = std::stoul( flag.substr( 2 ) );
+            if ( options.jobs == 0 ) {
+                options.jobs = std::max( 1u, std::thread::hardware_concurrency() );
+            }
+        }
+        else if ( flag.starts_with( "--emit-obj=" ) ) {
+            options.objectFile = flag.substr( std::string( "--emit-obj=" ).size() );
+        }
+        else if ( flag.starts_with( "--split=" ) && flag.size() > 8
+            && std::ranges::all_of( flag.substr( 8 ), ::isdigit ) ) {
+            options.partitions = std::stoul( flag.substr( 8 ) );
+            split = true;
+            if ( options.partitions == 0 ) {
+                options.partitions = std::max( 1u, std::thread::hardware_concurrency() );
+            }
+        }
+        else if ( flag == "--profile-generate" ) {
+            options.profileGenerate = true;
+        }
+        else if ( flag.starts_with( "--profile-use=" ) ) {
+            options.profileUse = flag.substr( std::string( "--profile-use=" ).size() );
+        }
+        else if ( flag == "--time-report" ) {
+            reportOptions.enabled = true;
+        }
+        else if ( flag.starts_with( "--time-report=" ) ) {
+            reportOptions.enabled = true;
+            reportOptions.jsonFile = flag.substr( std::string( "--time-report=" ).size() );
+        }
+        else if ( flag.starts_with( "--cache=" ) ) {
+            options.cacheDirectory = flag.substr( std::string( "--cache=" ).size() );
+        }
+        else {
+            throw std::runtime_error( "Unknown flag " + flag );
+        }
+    }
+
+    // The printed IR is always one module
+    if ( split && ! options.objectFile.has_value() ) {
+        throw std::runtime_error( "Flag --split requires --emit-obj" );
+    }
+
+    return options;
+}
+
+void compile( const std::string& in_file, compiler::Options options, const ReportOptions& reportOptions )
 {
     std::fstream f ( in_file, std::ios_base::in );
 
-    auto ast = parser::Parser::parse( f );
+    options.sourceFile = in_file;
+
+    timing::Report report {};
+    if ( reportOptions.enabled ) {
+        options.report = &report;
+    }
+
+    ast::Program ast {};
+    if ( options.report != nullptr ) {
+        // The parser pulls tokens on demand, so lexing is measured on its own
+        // over the source in memory, parsing then includes lexing again
+        std::stringstream source {};
+        source << f.rdbuf();
 
-    auto visitor = compiler::Compiler::compile( ast );
-    const auto& module = visitor->get_module();
+        size_t tokens = report.measure( "lex", [&source](){
+            std::stringstream copy { source.str() };
+            lexer::Lexer lex { copy };
 
-    module.print(llvm::outs(), nullptr);
+            size_t count = 0;
+            while ( lex.next().has_value() ) {
+                count++;
+            }
+            return count;
+        } );
+        report.count( "tokens", tokens );
+
+        ast = report.measure( "parse", [&source](){
+            return parser::Parser::parse( source );
+        } );
+        report.count( "nodes", ast::node_count( ast ) );
+    }
+    else {
+        ast = parser::Parser::parse( f );
+    }
+
+    auto symbolStats = timing::measure( options.report, "sema", [&ast](){
+        return sema::analyze( ast );
+    } );
+    if ( options.report != nullptr ) {
+        report.count( "lookups", symbolStats.lookups );
+    }
+
+    auto visitor = compiler::Compiler::compile( ast, options );
+
+    timing::measure( options.report, "emit", [&](){
+        if ( options.objectFile.has_value() ) {
+            visitor->emit_object();
+        }
+        else {
+            visitor->get_module().print(llvm::outs(), nullptr);
+            llvm::outs().flush();
+        }
+    } );
+
+    if ( auto stats = visitor->cache_stats(); stats.has_value() ) {
+        std::cerr << cache::to_string( stats.value() ) << std::endl;
+    }
+
+    if ( auto stats = visitor->bounds_stats(); stats.has_value() ) {
+        std::cerr << bounds::to_string( stats.value() ) << std::endl;
+    }
+
+    if ( reportOptions.jsonFile.has_value() ) {
+        std::ofstream out ( reportOptions.jsonFile.value() );
+        out << report.to_json();
+        if ( ! out ) {
+            throw std::runtime_error( "Can't write the time report into " + reportOptions.jsonFile.value() );
+        }
+    }
+    else if ( reportOptions.enabled ) {
+        std::cerr << report.to_table();
+        std::cerr << symbols::to_string( symbolStats ) << std::endl;
+    }
 }
 
 int main( int argc, char const* argv [] )
@@ -82,7 +269,9 @@ int main( int argc, char const* argv [] )
             print_parser(argv[1]);
         }
         else if ( flag == "-o" ) {
-            compile( argv[1] );
+            ReportOptions reportOptions {};
+            auto options = parse_options( argc, argv, reportOptions );
+            compile( argv[1], options, reportOptions );
         }
         else {
             std::cerr << USAGE << std::endl;
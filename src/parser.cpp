@@ -27,14 +27,14 @@ void append( std::vector<T1>& dest, const std::vector<T2>& from )
 }
 
 /// Transform all identifiers to variables with given type
-Many<Variable> identifiers_to_variables( const Many<ast::Identifier>& ids, Type t )
+Many<Variable> identifiers_to_variables( const Many<ast::Identifier>& ids, Type t, Location loc )
 {
     Many<Variable> out{};
     out.reserve( ids.size() );
     std::ranges::transform( ids, std::back_inserter( out ),
-        [&t]( const ast::Identifier& i ) -> Variable
+        [&t, &loc]( const ast::Identifier& i ) -> Variable
         {
-            return { i, t };
+            return { i, t, loc };
         }
     );
 
@@ -89,6 +89,14 @@ namespace parser
         }
     }
 
+    Location Parser::location()
+    {
+        // The top token is the last one the lexer scanned
+        lookup();
+        auto pos = m_Data.get_data().token_position();
+        return { pos.line, pos.column + 1 };
+    }
+
     /*********************************************************************/
 
     WrappedToken Parser::next_token()
@@ -199,6 +207,7 @@ namespace parser
         auto name = match_identifier();
         match( CONTROL_SYMBOL::SEMICOLON );
         auto globs = globals();
+        auto loc = location();
         auto code = block();
         match( CONTROL_SYMBOL::DOT );
 
@@ -206,7 +215,7 @@ namespace parser
         if ( t.has_value() )
             fail( "EOF", t->variant );
 
-        return Program{ name, globs, code };
+        return Program{ name, globs, code, loc };
     }
 
     /*********************************************************************/
@@ -235,7 +244,7 @@ namespace parser
             }
             else if ( lookup_eq( KEYWORD::PROCEDURE ) )
             {
-                wrap(function()).visit(
+                wrap(procedure()).visit(
                     [&globals]( const auto& p ){
                         globals.push_back(p);
                     }
@@ -294,12 +303,13 @@ namespace parser
 
     Many<Variable> Parser::single_variable()
     {
+        auto loc = location();
         auto ids = identifier_list();
         match( CONTROL_SYMBOL::COLON );
         auto t = type();
         match( CONTROL_SYMBOL::SEMICOLON );
 
-        return identifiers_to_variables( ids, t );
+        return identifiers_to_variables( ids, t, loc );
     }
 
     /*********************************************************************/
@@ -322,6 +332,7 @@ namespace parser
 
     std::variant<ProcedureDecl, Procedure> Parser::procedure()
     {
+        auto loc = location();
         match( KEYWORD::PROCEDURE );
         auto n = match_identifier();
         auto ps = parameters();
@@ -331,7 +342,7 @@ namespace parser
 
         if ( b.has_value() )
         {
-            return Procedure{ n, ps, b->first, b->second };
+            return Procedure{ n, ps, b->first, b->second, loc };
         }
         else
         {
@@ -341,6 +352,7 @@ namespace parser
 
     std::variant<FunctionDecl, Function> Parser::function()
     {
+        auto loc = location();
         match( KEYWORD::FUNCTION );
         auto n = match_identifier();
         auto ps = parameters();
@@ -353,7 +365,7 @@ namespace parser
 
         if ( b.has_value() )
         {
-            return Function{ n, ps, t, b->first, b->second };
+            return Function{ n, ps, t, b->first, b->second, loc };
         }
         else
         {
@@ -395,11 +407,28 @@ namespace parser
 
     Many<Variable> Parser::single_parameter()
     {
+        auto loc = location();
+
+        // `var` and `const` parameters are passed by reference
+        auto mode = Variable::MODE::VALUE;
+        if ( lookup_eq( KEYWORD::VAR ) ){
+            match( KEYWORD::VAR );
+            mode = Variable::MODE::VAR;
+        }
+        else if ( lookup_eq( KEYWORD::CONST ) ){
+            match( KEYWORD::CONST );
+            mode = Variable::MODE::CONST;
+        }
+
         auto ids = identifier_list();
         match( CONTROL_SYMBOL::COLON );
         auto t = type();
 
-        return identifiers_to_variables( ids, t );
+        auto vars = identifiers_to_variables( ids, t, loc );
+        for ( auto& v : vars ){
+            v.mode = mode;
+        }
+        return vars;
     }
 
     /*********************************************************************/
@@ -452,6 +481,8 @@ namespace parser
 
     Statement Parser::stat()
     {
+        auto loc = location();
+
         if ( lookup_type<token::Identifier>() )
             return stat_id();
 
@@ -464,18 +495,26 @@ namespace parser
         if ( lookup_eq( KEYWORD::WHILE ) )
             return make_ptr<While>( while_p() );
 
-        if ( lookup_eq( KEYWORD::FOR ) )
+        if ( lookup_eq( KEYWORD::FOR ) || lookup_eq( KEYWORD::PARALLEL ) )
             return make_ptr<For>( for_p() );
 
         if ( lookup_eq( KEYWORD::EXIT ) )
         {
             match( KEYWORD::EXIT );
-            return ExitStatement{};
+            return ExitStatement{ loc };
         }
         if ( lookup_eq( KEYWORD::BREAK ) )
         {
             match( KEYWORD::BREAK );
-            return BreakStatement{};
+            return BreakStatement{ loc };
+        }
+        if ( lookup_eq( KEYWORD::SPAWN ) )
+            return Spawn{ spawn_call(), std::nullopt, loc };
+
+        if ( lookup_eq( KEYWORD::SYNC ) )
+        {
+            match( KEYWORD::SYNC );
+            return SyncStatement{ loc };
         }
 
         return EmptyStatement{};
@@ -483,22 +522,27 @@ namespace parser
 
     Statement Parser::stat_id()
     {
+        auto loc = location();
         auto id = match_identifier();
         if ( lookup_eq( OPERATOR::ASSIGNEMENT ) )
         {
             match( OPERATOR::ASSIGNEMENT );
+            if ( lookup_eq( KEYWORD::SPAWN ) )
+                return Spawn{ spawn_call(), id, loc };
+
             auto ex = expr();
-            return Assignment{ id, ex };
+            return Assignment{ id, ex, loc };
         }
 
         else if ( lookup_eq( CONTROL_SYMBOL::SQUARE_BRACKET_OPEN ) )
         {
-            match( CONTROL_SYMBOL::SQUARE_BRACKET_OPEN );
-            auto pos = expr();
-            match( CONTROL_SYMBOL::SQUARE_BRACKET_CLOSE );
+            auto at = indexes();
             match( OPERATOR::ASSIGNEMENT );
             auto val = expr();
-            return ArrayAssignment{ id, pos, val };
+            if ( auto bounds = std::get_if<std::pair<Expression, Expression>>( &at ) ){
+                return SliceAssignment{ ArraySlice{ id, bounds->first, bounds->second }, val, loc };
+            }
+            return ArrayAssignment{ id, std::get<Many<Expression>>( at ), val, loc };
         }
 
         else if ( lookup_eq( CONTROL_SYMBOL::BRACKET_OPEN ) )
@@ -506,7 +550,7 @@ namespace parser
             match( CONTROL_SYMBOL::BRACKET_OPEN );
             auto args = arguments();
             match( CONTROL_SYMBOL::BRACKET_CLOSE );
-            return SubprogramCall{ id, args };
+            return SubprogramCall{ id, args, loc };
         }
 
         else
@@ -515,32 +559,54 @@ namespace parser
         }
     }
 
+    SubprogramCall Parser::spawn_call()
+    {
+        match( KEYWORD::SPAWN );
+        auto loc = location();
+        auto id = match_identifier();
+        match( CONTROL_SYMBOL::BRACKET_OPEN );
+        auto args = arguments();
+        match( CONTROL_SYMBOL::BRACKET_CLOSE );
+        return SubprogramCall{ id, args, loc };
+    }
+
     If Parser::if_p()
     {
+        auto loc = location();
         match( KEYWORD::IF );
         auto exp = expr();
         match( KEYWORD::THEN );
         auto true_b = stat();
         if ( !lookup_eq( KEYWORD::ELSE ) )
         {
-            return { exp, true_b, std::nullopt };
+            return { exp, true_b, std::nullopt, loc };
         }
         match( KEYWORD::ELSE );
         auto false_b = stat();
-        return { exp, true_b, false_b };
+        return { exp, true_b, false_b, loc };
     }
 
     While Parser::while_p()
     {
+        auto loc = location();
         match( KEYWORD::WHILE );
         auto exp = expr();
         match( KEYWORD::DO );
         auto st = stat();
-        return { exp, st };
+        return { exp, st, loc };
     }
 
     For Parser::for_p()
     {
+        auto loc = location();
+
+        std::optional<Parallel> parallel = std::nullopt;
+        if ( lookup_eq( KEYWORD::PARALLEL ) )
+        {
+            match( KEYWORD::PARALLEL );
+            parallel = Parallel{ {} };
+        }
+
         match( KEYWORD::FOR );
         auto id = match_identifier();
         match( OPERATOR::ASSIGNEMENT );
@@ -563,9 +629,46 @@ namespace parser
         }
 
         auto target = expr();
+
+        if ( parallel.has_value() && lookup_eq( KEYWORD::REDUCE ) )
+        {
+            match( KEYWORD::REDUCE );
+            parallel->reductions = reductions();
+        }
+
         match( KEYWORD::DO );
         auto st = stat();
-        return { id, init, dir, target, st };
+        return { id, init, dir, target, st, loc, std::nullopt, parallel };
+    }
+
+    Many<Reduction> Parser::reductions()
+    {
+        Many<Reduction> acc {};
+        while ( true )
+        {
+            // The operations aren't keywords, so variables can still be called sum
+            auto op = match_identifier();
+            Reduction::OPERATOR rop;
+            if ( op == "sum" ){
+                rop = Reduction::OPERATOR::SUM;
+            }
+            else if ( op == "min" ){
+                rop = Reduction::OPERATOR::MIN;
+            }
+            else if ( op == "max" ){
+                rop = Reduction::OPERATOR::MAX;
+            }
+            else {
+                fail( "sum, min or max", token::Identifier{ op } );
+            }
+
+            acc.push_back( Reduction{ rop, match_identifier() } );
+
+            if ( ! lookup_eq( CONTROL_SYMBOL::COMMA ) ){
+                return acc;
+            }
+            match( CONTROL_SYMBOL::COMMA );
+        }
     }
 
     /*********************************************************************/
@@ -584,6 +687,12 @@ namespace parser
             return make_ptr<BinaryOperator>( op, lhs, rhs );
         }
 
+        if ( lookup_eq( KEYWORD::IN ) ){
+            match( KEYWORD::IN );
+            auto rhs = simple_expr();
+            return make_ptr<BinaryOperator>( BinaryOperator::OPERATOR::IN, lhs, rhs );
+        }
+
         return lhs;
     }
 
@@ -662,18 +771,20 @@ namespace parser
     {
         if ( lookup_type<token::Identifier>() )
         {
+            auto loc = location();
             auto id = match_identifier();
             if ( lookup_eq( CONTROL_SYMBOL::SQUARE_BRACKET_OPEN ) ){
-                match(CONTROL_SYMBOL::SQUARE_BRACKET_OPEN);
-                auto exp = expr();
-                match(CONTROL_SYMBOL::SQUARE_BRACKET_CLOSE);
-                return make_ptr<ArrayAccess>( id, exp );
+                auto at = indexes();
+                if ( auto bounds = std::get_if<std::pair<Expression, Expression>>( &at ) ){
+                    return make_ptr<ArraySlice>( id, bounds->first, bounds->second );
+                }
+                return make_ptr<ArrayAccess>( id, std::get<Many<Expression>>( at ) );
             }
             else if ( lookup_eq( CONTROL_SYMBOL::BRACKET_OPEN ) ){
                 match( CONTROL_SYMBOL::BRACKET_OPEN );
                 auto exp = arguments();
                 match ( CONTROL_SYMBOL::BRACKET_CLOSE );
-                return make_ptr<SubprogramCall>( id, exp );
+                return make_ptr<SubprogramCall>( id, exp, loc );
             }
             else{
                 return VariableAccess{id};
@@ -693,6 +804,18 @@ namespace parser
             return exp;
         }
 
+        if ( lookup_eq( CONTROL_SYMBOL::SQUARE_BRACKET_OPEN ) ){
+            return set_constructor();
+        }
+
+        if ( lookup_eq( KEYWORD::CARD ) ){
+            match( KEYWORD::CARD );
+            match( CONTROL_SYMBOL::BRACKET_OPEN );
+            auto exp = expr();
+            match( CONTROL_SYMBOL::BRACKET_CLOSE );
+            return make_ptr<UnaryOperator>( UnaryOperator::OPERATOR::CARD, exp );
+        }
+
         if ( lookup_eq( KEYWORD::NOT ) ){
             match(KEYWORD::NOT);
             auto fac = factor();
@@ -732,25 +855,117 @@ namespace parser
         return exs;
     }
 
+    std::variant<Many<Expression>, std::pair<Expression, Expression>> Parser::indexes()
+    {
+        match( CONTROL_SYMBOL::SQUARE_BRACKET_OPEN );
+        auto first = expr();
+        if ( lookup_eq( CONTROL_SYMBOL::TWO_DOTS ) ){
+            match( CONTROL_SYMBOL::TWO_DOTS );
+            auto high = expr();
+            match( CONTROL_SYMBOL::SQUARE_BRACKET_CLOSE );
+            return std::pair{ first, high };
+        }
+
+        // `[i, j]` and `[i][j]` are the same
+        Many<Expression> exs { first };
+        while ( true ){
+            while ( lookup_eq( CONTROL_SYMBOL::COMMA ) ){
+                match( CONTROL_SYMBOL::COMMA );
+                exs.push_back( expr() );
+            }
+            match( CONTROL_SYMBOL::SQUARE_BRACKET_CLOSE );
+
+            if ( ! lookup_eq( CONTROL_SYMBOL::SQUARE_BRACKET_OPEN ) ){
+                return exs;
+            }
+            match( CONTROL_SYMBOL::SQUARE_BRACKET_OPEN );
+            exs.push_back( expr() );
+        }
+    }
+
+    Expression Parser::set_constructor()
+    {
+        match( CONTROL_SYMBOL::SQUARE_BRACKET_OPEN );
+
+        Many<SetElement> elements {};
+        if ( ! lookup_eq( CONTROL_SYMBOL::SQUARE_BRACKET_CLOSE ) ){
+            do {
+                if ( ! elements.empty() ){
+                    match( CONTROL_SYMBOL::COMMA );
+                }
+                SetElement element { expr() };
+                if ( lookup_eq( CONTROL_SYMBOL::TWO_DOTS ) ){
+                    match( CONTROL_SYMBOL::TWO_DOTS );
+                    element.last = expr();
+                }
+                elements.push_back( element );
+            } while ( lookup_eq( CONTROL_SYMBOL::COMMA ) );
+        }
+
+        match( CONTROL_SYMBOL::SQUARE_BRACKET_CLOSE );
+        return make_ptr<SetConstructor>( elements );
+    }
+
     /*********************************************************************/
 
-    Type Parser::type()
+    Type Parser::type( bool packed )
     {
-        if ( lookup_eq( KEYWORD::ARRAY) )
+        if ( lookup_eq( KEYWORD::PACKED ) )
         {
-            match( KEYWORD::ARRAY );
-            match( CONTROL_SYMBOL::SQUARE_BRACKET_OPEN );
+            match( KEYWORD::PACKED );
+            if ( ! lookup_eq( KEYWORD::ARRAY ) ){
+                fail( "array", lookup()->variant );
+            }
 
+            // All dimensions share the bits of one array
+            auto t = type( true );
+            for ( auto a = std::get_if<ptr<Array>>( &t ); a != nullptr; a = std::get_if<ptr<Array>>( &(*a)->elementType ) ){
+                (*a)->packed = true;
+            }
+            return t;
+        }
+        else if ( lookup_eq( KEYWORD::SET ) )
+        {
+            match( KEYWORD::SET );
+            match( KEYWORD::OF );
             auto low = expr();
             match( CONTROL_SYMBOL::TWO_DOTS );
             auto high = expr();
+            return make_ptr<Set>( low, high );
+        }
+        else if ( lookup_eq( KEYWORD::ARRAY) )
+        {
+            match( KEYWORD::ARRAY );
+
+            // `array of T` has no bounds, its length is set at run time
+            if ( lookup_eq( KEYWORD::OF ) && ! packed )
+            {
+                match( KEYWORD::OF );
+                return make_ptr<DynamicArray>( type() );
+            }
+            match( CONTROL_SYMBOL::SQUARE_BRACKET_OPEN );
+
+            Many<std::pair<Expression, Expression>> bounds {};
+            do {
+                if ( ! bounds.empty() ){
+                    match( CONTROL_SYMBOL::COMMA );
+                }
+                auto low = expr();
+                match( CONTROL_SYMBOL::TWO_DOTS );
+                auto high = expr();
+                bounds.emplace_back( low, high );
+            } while ( lookup_eq( CONTROL_SYMBOL::COMMA ) );
 
             match( CONTROL_SYMBOL::SQUARE_BRACKET_CLOSE );
 
             match( KEYWORD::OF );
             auto t = type();
 
-            return make_ptr<Array>( low, high, t );
+            // `array [a..b, c..d] of T` is `array [a..b] of array [c..d] of T`
+            for ( auto b = bounds.rbegin(); b != bounds.rend(); ++b ){
+                t = make_ptr<Array>( b->first, b->second, t );
+            }
+            return t;
         }
         else if (lookup_eq( KEYWORD::INTEGER ) )
         {
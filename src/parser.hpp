@@ -42,6 +42,9 @@ namespace parser
         /// Look at the top token
         std::optional<WrappedToken> lookup();
 
+        /// Source location of the top token
+        Location location();
+
         /// Pop one token from stack, throwing error on empty
         WrappedToken next_token();
 
@@ -128,10 +131,14 @@ namespace parser
         Statement stat();
         Statement stat_id();
 
+        /// `spawn` followed by a call
+        SubprogramCall spawn_call();
+
         // suffix _p is used because these are keywords
         If if_p();
         While while_p();
         For for_p();
+        Many<Reduction> reductions();
 
         Expression expr();
         Expression simple_expr();
@@ -142,7 +149,14 @@ namespace parser
 
         Many<Expression> arguments();
 
-        Type type();
+        /// Indexes of an array element, `[i, j]` or `[i][j]`, or the bounds of a slice `[l..h]`
+        std::variant<Many<Expression>, std::pair<Expression, Expression>> indexes();
+
+        /// `[a, b..c]`, possibly empty
+        Expression set_constructor();
+
+        /// Type, arrays following `packed` need their bounds
+        Type type( bool packed = false );
     };
 }
 
@@ -0,0 +1,21 @@
+#ifndef RUNTIME_HPP
+#define RUNTIME_HPP
+
+#include <cstddef>
+
+/**
+ * @brief The runtime (include/fce.c) compiled to LLVM bitcode
+ *
+ * Only available when the compiler is built with MILA_EMBEDDED_RUNTIME,
+ * the array is generated at build time.
+ */
+namespace runtime
+{
+    /// The bitcode itself
+    extern const unsigned char BITCODE[];
+
+    /// Size of the bitcode in bytes
+    extern const std::size_t BITCODE_SIZE;
+}
+
+#endif // RUNTIME_HPP
@@ -0,0 +1,1543 @@
+#include "sema.hpp"
+#include "variant_helpers.hpp"
+#include <algorithm>
+#include <bit>
+#include <cctype>
+#include <map>
+#include <set>
+#include <stdexcept>
+
+namespace sema
+{
+    const Many<Builtin>& builtins ()
+    {
+        static const Many<Builtin> BUILTINS {
+            { "writeln", { { SimpleType::INTEGER, Variable::MODE::VALUE } }, std::nullopt },
+            { "write",   { { SimpleType::INTEGER, Variable::MODE::VALUE } }, std::nullopt },
+            { "readln",  { { SimpleType::INTEGER, Variable::MODE::VAR } },   std::nullopt },
+        };
+
+        return BUILTINS;
+    }
+
+    Many<Parameter> parameters ( const Program& program, const SubprogramCall& sub )
+    {
+        if ( sub.symbol->scope == Symbol::SCOPE::BUILTIN ){
+            return builtins()[sub.symbol->index].parameters;
+        }
+
+        Many<Parameter> acc {};
+        std::visit( [&acc]( const auto& g ){
+            if constexpr ( requires { g.parameters; } ){
+                for ( const auto& p : g.parameters ){
+                    acc.push_back( { p.type, p.mode } );
+                }
+            }
+        }, program.globals[sub.symbol->index] );
+        return acc;
+    }
+
+    std::string type_name ( const Type& type )
+    {
+        return wrap( type ).visit(
+            []( SimpleType t ) -> std::string {
+                switch ( t ) {
+                case SimpleType::INTEGER:
+                    return "integer";
+                case SimpleType::BOOLEAN:
+                    return "boolean";
+                }
+                return "";
+            },
+            []( const ptr<Array>& arr ){
+                return ( arr->packed ? "packed array of " : "array of " ) + type_name( arr->elementType );
+            },
+            []( const ptr<DynamicArray>& arr ){
+                return "dynamic array of " + type_name( arr->elementType );
+            },
+            []( const ptr<Set>& ) -> std::string {
+                return "set";
+            }
+        );
+    }
+
+/******************************************************************/
+
+    std::optional<long long> constant_value ( const Program& program, const Expression& expr )
+    {
+        auto value = [&program]( const Expression& e ){
+            return constant_value( program, e );
+        };
+
+        return wrap( expr ).visit(
+            [&]( const VariableAccess& va ) -> std::optional<long long> {
+                if ( ! va.symbol.has_value()
+                    || va.symbol->scope != Symbol::SCOPE::GLOBAL
+                    || va.symbol->index >= program.globals.size() ){
+                    return std::nullopt;
+                }
+
+                auto named = std::get_if<NamedConstant>( &program.globals[va.symbol->index] );
+                if ( named == nullptr ){
+                    return std::nullopt;
+                }
+                return value( named->value );
+            },
+            []( const ConstantExpression& c ) -> std::optional<long long> {
+                return wrap( c.value ).visit(
+                    []( const BooleanConstant& b ) -> long long {
+                        return b.value;
+                    },
+                    []( const IntegerConstant& i ) -> long long {
+                        return i.value;
+                    }
+                );
+            },
+            []( const ptr<ArrayAccess>& ) -> std::optional<long long> {
+                return std::nullopt;
+            },
+            []( const ptr<ArraySlice>& ) -> std::optional<long long> {
+                return std::nullopt;
+            },
+            []( const ptr<ArrayReduction>& ) -> std::optional<long long> {
+                return std::nullopt;
+            },
+            []( const ptr<SubprogramCall>& ) -> std::optional<long long> {
+                return std::nullopt;
+            },
+            []( const ptr<SetConstructor>& ) -> std::optional<long long> {
+                return std::nullopt;
+            },
+            [&]( const ptr<UnaryOperator>& un ) -> std::optional<long long> {
+                auto v = value( un->expression );
+                if ( ! v.has_value() ){
+                    return std::nullopt;
+                }
+
+                switch ( un->op ) {
+                case UnaryOperator::OPERATOR::PLUS:
+                    return v;
+                case UnaryOperator::OPERATOR::MINUS:
+                    return -v.value();
+                case UnaryOperator::OPERATOR::NOT:
+                    return ! v.value();
+                case UnaryOperator::OPERATOR::CARD:
+                    return std::nullopt;
+                }
+                return std::nullopt;
+            },
+            [&]( const ptr<BinaryOperator>& bin ) -> std::optional<long long> {
+                auto l = value( bin->left );
+                auto r = value( bin->right );
+                if ( ! l.has_value() || ! r.has_value() ){
+                    return std::nullopt;
+                }
+
+                auto a = l.value();
+                auto b = r.value();
+                switch ( bin->op ) {
+                case BinaryOperator::OPERATOR::EQ:
+                    return a == b;
+                case BinaryOperator::OPERATOR::NOT_EQ:
+                    return a != b;
+                case BinaryOperator::OPERATOR::LESS_EQ:
+                    return a <= b;
+                case BinaryOperator::OPERATOR::LESS:
+                    return a < b;
+                case BinaryOperator::OPERATOR::MORE_EQ:
+                    return a >= b;
+                case BinaryOperator::OPERATOR::MORE:
+                    return a > b;
+                case BinaryOperator::OPERATOR::PLUS:
+                    return a + b;
+                case BinaryOperator::OPERATOR::MINUS:
+                    return a - b;
+                case BinaryOperator::OPERATOR::TIMES:
+                    return a * b;
+                case BinaryOperator::OPERATOR::DIVISION:
+                case BinaryOperator::OPERATOR::INTEGER_DIVISION:
+                    if ( b == 0 ){
+                        return std::nullopt;
+                    }
+                    return a / b;
+                case BinaryOperator::OPERATOR::MODULO:
+                    if ( b == 0 ){
+                        return std::nullopt;
+                    }
+                    return a % b;
+                case BinaryOperator::OPERATOR::AND:
+                    return a & b;
+                case BinaryOperator::OPERATOR::OR:
+                    return a | b;
+                case BinaryOperator::OPERATOR::XOR:
+                    return a ^ b;
+                case BinaryOperator::OPERATOR::IN:
+                    return std::nullopt;
+                }
+                return std::nullopt;
+            }
+        );
+    }
+
+    uint64_t array_size ( const Program& program, const Type& array )
+    {
+        uint64_t count = 1;
+        auto dims = dimensions( array );
+        for ( auto dim : dims ){
+            count *= constant_value( program, dim->highBound ).value() - constant_value( program, dim->lowBound ).value() + 1;
+        }
+        if ( dims.front()->packed ){
+            return ( count + 63 ) / 64 * 8;
+        }
+
+        uint64_t element = wrap( element_type( array ) ).visit(
+            []( SimpleType t ) -> uint64_t {
+                return t == SimpleType::INTEGER ? 4 : 1;
+            },
+            [&program]( const ptr<Set>& set ) -> uint64_t {
+                auto values = constant_value( program, set->highBound ).value() - constant_value( program, set->lowBound ).value() + 1;
+                return std::bit_ceil( static_cast<uint64_t>( values + 63 ) / 64 * 8 );
+            },
+            []( const ptr<DynamicArray>& ) -> uint64_t {
+                return 24;
+            },
+            []( const ptr<Array>& ) -> uint64_t {
+                throw std::logic_error( "Dimensions of an array have no array elements" );
+            }
+        );
+        return count * element;
+    }
+
+    /// Finds out whether a statement may change a variable
+    class Modifies
+    {
+    private:
+        const Program& m_Program;
+        const Symbol& m_Variable;
+
+        /// Slots of the var and const parameters of the subprogram
+        const std::set<size_t>& m_References;
+
+        bool reference ( const Symbol& symbol ) const
+        {
+            return symbol.scope == Symbol::SCOPE::LOCAL && m_References.count( symbol.index ) > 0;
+        }
+
+        /// Global variables and var or const parameters, which may refer to the globals
+        bool shared ( const Symbol& symbol ) const
+        {
+            return symbol.scope == Symbol::SCOPE::GLOBAL || reference( symbol );
+        }
+
+        /// The variable itself, or a global it may refer to, or a parameter that may refer to it
+        bool same ( const std::optional<Symbol>& symbol ) const
+        {
+            if ( ! symbol.has_value() ){
+                return false;
+            }
+            if ( symbol->scope == m_Variable.scope && symbol->index == m_Variable.index ){
+                return true;
+            }
+            return ( reference( symbol.value() ) && m_Variable.scope == Symbol::SCOPE::GLOBAL )
+                || ( reference( m_Variable ) && symbol->scope == Symbol::SCOPE::GLOBAL );
+        }
+
+        /// Called subprograms assign to the arguments of var parameters, those of the program also to the global variables
+        bool call ( const SubprogramCall& sub ) const
+        {
+            if ( ! sub.symbol.has_value() ){
+                return true;
+            }
+
+            auto params = parameters( m_Program, sub );
+            for ( size_t i = 0; i < sub.arguments.size() && i < params.size(); ++i ){
+                auto va = std::get_if<VariableAccess>( &sub.arguments[i] );
+                if ( params[i].mode == Variable::MODE::VAR && va != nullptr && same( va->symbol ) ){
+                    return true;
+                }
+            }
+
+            if ( sub.symbol->scope != Symbol::SCOPE::BUILTIN && shared( m_Variable ) ){
+                return true;
+            }
+
+            return std::ranges::any_of( sub.arguments, [this]( const auto& a ){ return expr( a ); } );
+        }
+
+    public:
+        Modifies ( const Program& program, const Symbol& variable, const std::set<size_t>& references )
+        : m_Program { program }
+        , m_Variable { variable }
+        , m_References { references }
+        {}
+
+        bool expr ( const Expression& e ) const
+        {
+            return wrap( e ).visit(
+                []( const VariableAccess& ){
+                    return false;
+                },
+                []( const ConstantExpression& ){
+                    return false;
+                },
+                [this]( const ptr<ArrayAccess>& arr ){
+                    return std::ranges::any_of( arr->indexes, [this]( const auto& i ){ return expr( i ); } );
+                },
+                [this]( const ptr<ArraySlice>& sl ){
+                    return expr( sl->low ) || expr( sl->high );
+                },
+                [this]( const ptr<ArrayReduction>& red ){
+                    return expr( red->array );
+                },
+                [this]( const ptr<SubprogramCall>& sub ){
+                    return call( *sub );
+                },
+                [this]( const ptr<SetConstructor>& set ){
+                    return std::ranges::any_of( values( *set ), [this]( const auto& v ){ return expr( *v ); } );
+                },
+                [this]( const ptr<UnaryOperator>& un ){
+                    return expr( un->expression );
+                },
+                [this]( const ptr<BinaryOperator>& bin ){
+                    return expr( bin->left ) || expr( bin->right );
+                }
+            );
+        }
+
+        bool stat ( const Statement& s ) const
+        {
+            return std::visit( overloaded {
+                [this]( const SubprogramCall& sub ){
+                    return call( sub );
+                },
+                [this]( const Assignment& as ){
+                    return same( as.symbol ) || expr( as.value );
+                },
+                [this]( const ArrayAssignment& as ){
+                    return std::ranges::any_of( as.indexes, [this]( const auto& i ){ return expr( i ); } )
+                        || expr( as.value );
+                },
+                [this]( const SetLength& sl ){
+                    return same( sl.array.symbol ) || expr( sl.length );
+                },
+                [this]( const SliceAssignment& as ){
+                    return expr( as.slice.low ) || expr( as.slice.high ) || expr( as.value );
+                },
+                [this]( const Spawn& sp ){
+                    return same( sp.symbol ) || call( sp.call );
+                },
+                []( const ExitStatement& ){
+                    return false;
+                },
+                []( const BreakStatement& ){
+                    return false;
+                },
+                []( const EmptyStatement& ){
+                    return false;
+                },
+                []( const SyncStatement& ){
+                    return false;
+                },
+                [this]( const ptr<Block>& bl ){
+                    return std::ranges::any_of( bl->statements, [this]( const auto& st ){ return stat( st ); } );
+                },
+                [this]( const ptr<If>& if_ ){
+                    return expr( if_->condition )
+                        || stat( if_->trueCode )
+                        || ( if_->elseCode.has_value() && stat( if_->elseCode.value() ) );
+                },
+                [this]( const ptr<While>& wh ){
+                    return expr( wh->condition ) || stat( wh->code );
+                },
+                [this]( const ptr<For>& fo ){
+                    if ( same( fo->symbol ) ){
+                        return true;
+                    }
+                    if ( fo->parallel.has_value() ){
+                        for ( const auto& r : fo->parallel->reductions ){
+                            if ( same( r.symbol ) ){
+                                return true;
+                            }
+                        }
+                    }
+                    return expr( fo->initialization ) || expr( fo->target ) || stat( fo->code );
+                }
+            }, s );
+        }
+    };
+
+    bool modifies ( const Program& program, const Symbol& variable, const std::set<size_t>& references, const Statement& code )
+    {
+        return Modifies( program, variable, references ).stat( code );
+    }
+
+/******************************************************************/
+
+    /// Scope of the globals in the symbol table, the builtins are below it, locals above
+    constexpr size_t GLOBAL_SCOPE = 1;
+
+    /// Walks the program, resolving the identifiers and checking the types
+    class Analyzer
+    {
+    private:
+        /// Signature of a program subprogram
+        struct Signature
+        {
+            Many<Parameter> parameters;
+            std::optional<Type> returnType;
+            bool defined;
+        };
+
+        Program& m_Program;
+
+        /// Scopes of the builtins, globals and the subprogram being analyzed
+        symbols::SymbolTable m_Symbols;
+
+        /// Subprogram signatures by the index of their first declaration, nullopt for other globals
+        std::vector<std::optional<Signature>> m_Signatures;
+
+        /// Location of the statement being analyzed, for error messages
+        Location m_Location;
+
+        /// Number of loops around the statement being analyzed
+        size_t m_Loops = 0;
+
+        /// Number of parallel for loops around the statement being analyzed
+        size_t m_Parallel = 0;
+
+        /// Variables of the parallel for loops around the statement being analyzed
+        std::vector<Symbol> m_Iterators;
+
+        /// Slots of the var and const parameters of the subprogram being analyzed, by their mode
+        std::map<size_t, Variable::MODE> m_References;
+
+    public:
+        Analyzer ( Program& program )
+        : m_Program { program }
+        {
+            const auto& b = builtins();
+            m_Symbols.push();
+            for ( size_t i = 0; i < b.size(); ++i ){
+                m_Symbols.add( symbols::key( b[i].name ), Symbol{ Symbol::SCOPE::BUILTIN, i, b[i].returnType } );
+            }
+            m_Symbols.push();
+        }
+
+        void analyze ();
+
+        symbols::Stats stats () const;
+
+    private:
+        [[noreturn]] void fail ( const std::string& message ) const;
+
+        /// Run f, adding the current location to its errors
+        template <typename F>
+        void located ( F&& f );
+
+        Symbol resolve ( const Identifier& name ) const;
+
+        /// Signature of the subprogram the symbol refers to, nullptr for variables and builtins
+        Signature* signature ( const Symbol& symbol );
+
+        /// Symbol of a global, nullopt if there is no such global
+        std::optional<Symbol> global ( const Identifier& name ) const;
+
+        /// Check the type is valid, array and set bounds have to be constant
+        void check_type ( const Type& type );
+
+        /// Values of the constant bounds of an array or a set
+        std::pair<long long, long long> bounds ( Expression& low, Expression& high, const std::string& what );
+
+        /// Check the indexes of an element of the array the symbol refers to, returning its type
+        Type element ( const Symbol& symbol, const Identifier& name, Many<Expression>& indexes );
+
+        /// Check a slice, returning the type of its array
+        Type slice ( ArraySlice& slice );
+
+        /**
+         * Check a whole array or a slice copied or reduced, returning the
+         * type of the array, nullopt when the expression is neither
+         */
+        std::optional<Type> array_value ( Expression& expr );
+
+        /// Number of elements of the first dimension of a whole array or a slice, nullopt unless constant
+        std::optional<long long> length ( const Expression& expr ) const;
+
+        /**
+         * Check an assignment to a whole array or a slice of the given
+         * length: a copy of an array or slice of the same length and
+         * elements, a fill by an element value or a value of the array type
+         */
+        void assign_array ( const Type& type, std::optional<long long> count, Expression& value, const std::string& what );
+
+        /// Replace a call of sum, min or max not declared by the program by the reduction of an array
+        void reduction ( Expression& expr );
+
+        bool same ( const Type& a, const Type& b ) const;
+
+        void expect ( const Type& expected, const Type& got, const std::string& what ) const;
+
+        /// Give set constructors without a type the set type expected by the context of the expression
+        void settle ( Expression& expr, const Type& type );
+
+        void declare_subprogram (
+            size_t index,
+            const Identifier& name,
+            const Many<Variable>& parameters,
+            const std::optional<Type>& returnType,
+            bool definition );
+
+        void subprogram (
+            const Identifier& name,
+            const Many<Variable>& parameters,
+            const Many<Variable>& variables,
+            const std::optional<Type>& returnType,
+            Block& code,
+            const Location& location );
+
+        /// Analyze a call, returning the return type of the subprogram
+        std::optional<Type> call ( SubprogramCall& sub );
+
+        /// Symbol of a variable that is assigned to
+        Symbol assigned ( const Identifier& name );
+
+        /// Fail for a const parameter, which can't be modified
+        void modifiable ( const Symbol& symbol, const Identifier& name ) const;
+
+        /// Whether a symbol is a var or const parameter of the subprogram being analyzed
+        bool reference ( const Symbol& symbol ) const;
+
+        /**
+         * Fail when a variable passed to a var parameter can be reached
+         * through another argument passed by reference, the parameters of
+         * subprograms don't alias
+         */
+        void distinct ( const SubprogramCall& sub, const Many<Parameter>& parameters ) const;
+
+        /// Replace `inc(v)` and `dec(v)` not declared by the program by the assignment `v := v + 1` or `v := v - 1`
+        void increment ( Statement& stat );
+
+        /// Replace `setlength(A, n)` not declared by the program by the SetLength of a dynamic array
+        void set_length ( Statement& stat );
+
+        Type expr ( Expression& expr );
+        void stat ( Statement& stat );
+
+        /// Check a reduction of a parallel for loop
+        void reduction ( Reduction& reduction, const For& loop );
+    };
+
+    void Analyzer::fail ( const std::string& message ) const
+    {
+        if ( m_Location.line == 0 ){
+            throw std::runtime_error( message );
+        }
+
+        throw std::runtime_error( message
+            + " (line " + std::to_string( m_Location.line )
+            + ", column " + std::to_string( m_Location.column ) + ")" );
+    }
+
+    template <typename F>
+    void Analyzer::located ( F&& f )
+    {
+        // Redefinitions are reported by the declaration maps without a location
+        try
+        {
+            f();
+        }
+        catch ( const std::runtime_error& e )
+        {
+            std::string message = e.what();
+            if ( m_Location.line == 0 || message.find( "(line " ) != std::string::npos ){
+                throw;
+            }
+            fail( message );
+        }
+    }
+
+    Symbol Analyzer::resolve ( const Identifier& name ) const
+    {
+        if ( auto s = m_Symbols.find( symbols::key( name ) ); s.has_value() ){
+            return s.value();
+        }
+
+        fail( "Usage of undeclared " + name );
+    }
+
+    Analyzer::Signature* Analyzer::signature ( const Symbol& symbol )
+    {
+        if ( symbol.scope != Symbol::SCOPE::GLOBAL || ! m_Signatures[symbol.index].has_value() ){
+            return nullptr;
+        }
+
+        return &m_Signatures[symbol.index].value();
+    }
+
+    std::optional<Symbol> Analyzer::global ( const Identifier& name ) const
+    {
+        return m_Symbols.find_in( GLOBAL_SCOPE, symbols::key( name ) );
+    }
+
+    void Analyzer::check_type ( const Type& type )
+    {
+        if ( auto arr = std::get_if<ptr<Array>>( &type ) ){
+            auto [low, high] = bounds( (*arr)->lowBound, (*arr)->highBound, "array" );
+            if ( low > high ){
+                fail( "Array bounds " + std::to_string( low ) + ".." + std::to_string( high ) + " are empty" );
+            }
+
+            if ( (*arr)->packed && ! same( element_type( type ), SimpleType::BOOLEAN ) ){
+                fail( "Packed arrays have to be of boolean" );
+            }
+
+            if ( std::holds_alternative<ptr<DynamicArray>>( (*arr)->elementType ) ){
+                fail( "Arrays of dynamic arrays aren't supported" );
+            }
+            check_type( (*arr)->elementType );
+        }
+        else if ( auto dyn = std::get_if<ptr<DynamicArray>>( &type ) ){
+            if ( array_type( (*dyn)->elementType ) ){
+                fail( "Dynamic arrays of arrays aren't supported" );
+            }
+            check_type( (*dyn)->elementType );
+        }
+        else if ( auto set = std::get_if<ptr<Set>>( &type ) ){
+            auto [low, high] = bounds( (*set)->lowBound, (*set)->highBound, "set" );
+            if ( low > high || high - low >= MAX_SET_SIZE ){
+                fail( "Set bounds " + std::to_string( low ) + ".." + std::to_string( high )
+                    + " have to contain 1 to " + std::to_string( MAX_SET_SIZE ) + " values" );
+            }
+        }
+    }
+
+    std::pair<long long, long long> Analyzer::bounds ( Expression& low, Expression& high, const std::string& what )
+    {
+        expect( SimpleType::INTEGER, expr( low ), what + " bound" );
+        expect( SimpleType::INTEGER, expr( high ), what + " bound" );
+
+        auto l = constant_value( m_Program, low );
+        auto h = constant_value( m_Program, high );
+        if ( ! l.has_value() || ! h.has_value() ){
+            auto capitalized = what;
+            capitalized[0] = std::toupper( capitalized[0] );
+            fail( capitalized + " bounds have to be constant" );
+        }
+        return { l.value(), h.value() };
+    }
+
+    Type Analyzer::element ( const Symbol& symbol, const Identifier& name, Many<Expression>& indexes )
+    {
+        if ( ! symbol.type.has_value() || ! array_type( symbol.type.value() ) || signature( symbol ) != nullptr ){
+            fail( name + " isn't an array" );
+        }
+
+        // Elements are always simple, arrays can't be values
+        auto dims = std::holds_alternative<ptr<DynamicArray>>( symbol.type.value() ) ? 1 : dimensions( symbol.type.value() ).size();
+        if ( indexes.size() != dims ){
+            fail( name + " has " + std::to_string( dims ) + " dimensions, but "
+                + std::to_string( indexes.size() ) + " indexes are given" );
+        }
+
+        for ( auto& index : indexes ){
+            expect( SimpleType::INTEGER, expr( index ), "array index" );
+        }
+        return element_type( symbol.type.value() );
+    }
+
+    Type Analyzer::slice ( ArraySlice& slice )
+    {
+        auto symbol = resolve( slice.array );
+        if ( ! symbol.type.has_value() || ! array_type( symbol.type.value() ) || signature( symbol ) != nullptr ){
+            fail( slice.array + " isn't an array" );
+        }
+        if ( packed( symbol.type.value() ) ){
+            fail( "Slice of packed array " + slice.array );
+        }
+
+        expect( SimpleType::INTEGER, expr( slice.low ), "slice bound" );
+        expect( SimpleType::INTEGER, expr( slice.high ), "slice bound" );
+
+        // Empty slices are fine anywhere, the others are checked when known,
+        // those of dynamic arrays only at run time
+        auto low = constant_value( m_Program, slice.low );
+        auto high = constant_value( m_Program, slice.high );
+        auto dims = dimensions( symbol.type.value() );
+        if ( dims.empty() ){
+            slice.symbol = symbol;
+            return symbol.type.value();
+        }
+        auto first = constant_value( m_Program, dims.front()->lowBound ).value();
+        auto last = constant_value( m_Program, dims.front()->highBound ).value();
+        if ( low.has_value() && high.has_value() && low.value() <= high.value()
+            && ( low.value() < first || high.value() > last ) ){
+            fail( "Slice " + std::to_string( low.value() ) + ".." + std::to_string( high.value() )
+                + " is out of bounds " + std::to_string( first ) + ".." + std::to_string( last ) + " of " + slice.array );
+        }
+
+        slice.symbol = symbol;
+        return symbol.type.value();
+    }
+
+    std::optional<Type> Analyzer::array_value ( Expression& expression )
+    {
+        if ( auto sl = std::get_if<ptr<ArraySlice>>( &expression ) ){
+            return slice( **sl );
+        }
+
+        auto va = std::get_if<VariableAccess>( &expression );
+        if ( va == nullptr ){
+            return std::nullopt;
+        }
+
+        auto symbol = resolve( va->identifier );
+        if ( ! symbol.type.has_value() || ! array_type( symbol.type.value() ) ){
+            return std::nullopt;
+        }
+        return expr( expression );
+    }
+
+    std::optional<long long> Analyzer::length ( const Expression& expression ) const
+    {
+        if ( auto sl = std::get_if<ptr<ArraySlice>>( &expression ) ){
+            auto low = constant_value( m_Program, (*sl)->low );
+            auto high = constant_value( m_Program, (*sl)->high );
+            if ( ! low.has_value() || ! high.has_value() ){
+                return std::nullopt;
+            }
+            return std::max( high.value() - low.value() + 1, 0ll );
+        }
+
+        // Lengths of dynamic arrays are known only at run time
+        auto arr = std::get_if<ptr<Array>>( &std::get<VariableAccess>( expression ).symbol->type.value() );
+        if ( arr == nullptr ){
+            return std::nullopt;
+        }
+        return constant_value( m_Program, (*arr)->highBound ).value() - constant_value( m_Program, (*arr)->lowBound ).value() + 1;
+    }
+
+    void Analyzer::assign_array ( const Type& type, std::optional<long long> count, Expression& value, const std::string& what )
+    {
+        // Arrays of the same rows, but possibly different bounds or dynamic, are copied
+        auto row = []( const Type& array ) -> const Type& {
+            if ( auto dyn = std::get_if<ptr<DynamicArray>>( &array ) ){
+                return (*dyn)->elementType;
+            }
+            return std::get<ptr<Array>>( array )->elementType;
+        };
+        auto copy = [&]( const Type& source, std::optional<long long> got ){
+            if ( packed( type ) != packed( source ) || ! same( row( type ), row( source ) ) ){
+                fail( "Type mismatch in " + what + ": expected " + type_name( type ) + ", got " + type_name( source ) );
+            }
+            if ( count.has_value() && got.has_value() && count.value() != got.value() ){
+                fail( "Copy of " + std::to_string( got.value() ) + " elements in " + what
+                    + ", which has " + std::to_string( count.value() ) );
+            }
+        };
+
+        if ( auto source = array_value( value ); source.has_value() ){
+            copy( source.value(), length( value ) );
+            return;
+        }
+
+        // Array values, like function results, are copied too, anything else fills the elements
+        const auto& element = element_type( type );
+        settle( value, element );
+        auto got = expr( value );
+        if ( auto from = std::get_if<ptr<Array>>( &got ) ){
+            copy( got, constant_value( m_Program, (*from)->highBound ).value() - constant_value( m_Program, (*from)->lowBound ).value() + 1 );
+            return;
+        }
+        expect( element, got, what );
+    }
+
+    void Analyzer::reduction ( Expression& expression )
+    {
+        auto sub = std::get_if<ptr<SubprogramCall>>( &expression );
+        if ( sub == nullptr || m_Symbols.find( symbols::key( (*sub)->functionName ) ).has_value() ){
+            return;
+        }
+
+        static const std::map<std::string, ArrayReduction::OPERATOR> OPERATORS {
+            { "sum", ArrayReduction::OPERATOR::SUM },
+            { "min", ArrayReduction::OPERATOR::MIN },
+            { "max", ArrayReduction::OPERATOR::MAX },
+            { "length", ArrayReduction::OPERATOR::LENGTH },
+        };
+
+        auto op = OPERATORS.find( (*sub)->functionName );
+        if ( op == OPERATORS.end() ){
+            return;
+        }
+        if ( (*sub)->arguments.size() != 1 ){
+            fail( "Wrong number of arguments in call of " + (*sub)->functionName );
+        }
+
+        auto array = (*sub)->arguments.front();
+        expression = make_ptr<ArrayReduction>( op->second, array );
+    }
+
+    bool Analyzer::same ( const Type& a, const Type& b ) const
+    {
+        auto sa = std::get_if<SimpleType>( &a );
+        auto sb = std::get_if<SimpleType>( &b );
+        if ( sa != nullptr || sb != nullptr ){
+            return sa != nullptr && sb != nullptr && *sa == *sb;
+        }
+
+        auto dyna = std::get_if<ptr<DynamicArray>>( &a );
+        auto dynb = std::get_if<ptr<DynamicArray>>( &b );
+        if ( dyna != nullptr || dynb != nullptr ){
+            return dyna != nullptr && dynb != nullptr && same( (*dyna)->elementType, (*dynb)->elementType );
+        }
+
+        auto seta = std::get_if<ptr<Set>>( &a );
+        auto setb = std::get_if<ptr<Set>>( &b );
+        if ( seta != nullptr || setb != nullptr ){
+            return seta != nullptr && setb != nullptr
+                && constant_value( m_Program, (*seta)->lowBound ) == constant_value( m_Program, (*setb)->lowBound )
+                && constant_value( m_Program, (*seta)->highBound ) == constant_value( m_Program, (*setb)->highBound );
+        }
+
+        const auto& aa = std::get<ptr<Array>>( a );
+        const auto& ab = std::get<ptr<Array>>( b );
+        return aa->packed == ab->packed
+            && constant_value( m_Program, aa->lowBound ) == constant_value( m_Program, ab->lowBound )
+            && constant_value( m_Program, aa->highBound ) == constant_value( m_Program, ab->highBound )
+            && same( aa->elementType, ab->elementType );
+    }
+
+    void Analyzer::expect ( const Type& expected, const Type& got, const std::string& what ) const
+    {
+        if ( ! same( expected, got ) ){
+            fail( "Type mismatch in " + what + ": expected " + type_name( expected ) + ", got " + type_name( got ) );
+        }
+    }
+
+    void Analyzer::settle ( Expression& expression, const Type& type )
+    {
+        if ( ! std::holds_alternative<ptr<Set>>( type ) ){
+            return;
+        }
+
+        if ( auto set = std::get_if<ptr<SetConstructor>>( &expression ) ){
+            if ( ! (*set)->type.has_value() ){
+                (*set)->type = type;
+            }
+        }
+        else if ( auto bin = std::get_if<ptr<BinaryOperator>>( &expression ) ){
+            if ( (*bin)->op == BinaryOperator::OPERATOR::PLUS
+                || (*bin)->op == BinaryOperator::OPERATOR::MINUS
+                || (*bin)->op == BinaryOperator::OPERATOR::TIMES ){
+                settle( (*bin)->left, type );
+                settle( (*bin)->right, type );
+            }
+        }
+    }
+
+/******************************************************************/
+
+    void Analyzer::analyze ()
+    {
+        m_Signatures.assign( m_Program.globals.size(), std::nullopt );
+
+        // All globals are visible in all bodies, only constants and types
+        // have to refer to the ones declared before them
+        for ( size_t i = 0; i < m_Program.globals.size(); ++i )
+        {
+            std::visit( overloaded {
+                [this, i]( const ProcedureDecl& decl ){
+                    declare_subprogram( i, decl.name, decl.parameters, std::nullopt, false );
+                },
+                [this, i]( const Procedure& proc ){
+                    m_Location = proc.location;
+                    declare_subprogram( i, proc.name, proc.parameters, std::nullopt, true );
+                },
+                [this, i]( const FunctionDecl& decl ){
+                    declare_subprogram( i, decl.name, decl.parameters, decl.returnType, false );
+                },
+                [this, i]( const Function& fun ){
+                    m_Location = fun.location;
+                    declare_subprogram( i, fun.name, fun.parameters, fun.returnType, true );
+                },
+                [this, i]( NamedConstant& c ){
+                    auto type = expr( c.value );
+                    if ( ! constant_value( m_Program, c.value ).has_value() ){
+                        fail( "Value of constant " + c.name + " isn't constant" );
+                    }
+                    located( [&](){
+                        m_Symbols.add( symbols::key( c.name ), Symbol{ Symbol::SCOPE::GLOBAL, i, type } );
+                    } );
+                },
+                [this, i]( const Variable& var ){
+                    m_Location = var.location;
+                    check_type( var.type );
+                    located( [&](){
+                        m_Symbols.add( symbols::key( var.name ), Symbol{ Symbol::SCOPE::GLOBAL, i, var.type } );
+                    } );
+                }
+            }, m_Program.globals[i] );
+        }
+
+        for ( size_t index = 0; index < m_Signatures.size(); ++index ){
+            if ( m_Signatures[index].has_value() && ! m_Signatures[index]->defined ){
+                m_Location = {};
+                fail( "Subprogram " + std::visit( []( const auto& g ){ return g.name; }, m_Program.globals[index] )
+                    + " is declared forward but never defined" );
+            }
+        }
+
+        for ( auto& g : m_Program.globals )
+        {
+            if ( auto proc = std::get_if<Procedure>( &g ) ){
+                subprogram( proc->name, proc->parameters, proc->variables, std::nullopt, proc->code, proc->location );
+            }
+            else if ( auto fun = std::get_if<Function>( &g ) ){
+                subprogram( fun->name, fun->parameters, fun->variables, fun->returnType, fun->code, fun->location );
+            }
+        }
+
+        subprogram( "main", {}, {}, SimpleType::INTEGER, m_Program.code, m_Program.location );
+    }
+
+    void Analyzer::declare_subprogram (
+        size_t index,
+        const Identifier& name,
+        const Many<Variable>& parameters,
+        const std::optional<Type>& returnType,
+        bool definition )
+    {
+        // Dynamic arrays are never copied as a whole value, they live in the arena of their subprogram
+        Signature signature { {}, returnType, definition };
+        for ( const auto& p : parameters ){
+            check_type( p.type );
+            if ( std::holds_alternative<ptr<DynamicArray>>( p.type ) && p.mode == Variable::MODE::VALUE ){
+                fail( "Dynamic array parameter " + p.name + " has to be var or const" );
+            }
+            signature.parameters.push_back( { p.type, p.mode } );
+        }
+        if ( returnType.has_value() ){
+            check_type( returnType.value() );
+            if ( std::holds_alternative<ptr<DynamicArray>>( returnType.value() ) ){
+                fail( "Function " + name + " can't return a dynamic array" );
+            }
+        }
+
+        auto previous = global( name );
+        if ( ! previous.has_value() ){
+            m_Symbols.add( symbols::key( name ), Symbol{ Symbol::SCOPE::GLOBAL, index, returnType } );
+            m_Signatures[index] = signature;
+            return;
+        }
+
+        // A forward declaration has to match its definition
+        auto known = this->signature( previous.value() );
+        if ( known == nullptr ){
+            fail( "Redefinition of " + name );
+        }
+
+        auto& first = *known;
+        if ( definition && first.defined ){
+            fail( "Redefinition of " + name );
+        }
+
+        bool matches = first.parameters.size() == signature.parameters.size()
+            && first.returnType.has_value() == returnType.has_value()
+            && ( ! returnType.has_value() || same( first.returnType.value(), returnType.value() ) );
+        for ( size_t i = 0; matches && i < signature.parameters.size(); ++i ){
+            matches = first.parameters[i].mode == signature.parameters[i].mode
+                && same( first.parameters[i].type, signature.parameters[i].type );
+        }
+
+        if ( ! matches ){
+            fail( "Definition of " + name + " doesn't match its forward declaration" );
+        }
+
+        first.defined = first.defined || definition;
+    }
+
+    void Analyzer::subprogram (
+        const Identifier& name,
+        const Many<Variable>& parameters,
+        const Many<Variable>& variables,
+        const std::optional<Type>& returnType,
+        Block& code,
+        const Location& location )
+    {
+        m_Symbols.push();
+        m_Location = location;
+
+        // Slots are numbered as the code generator allocates them
+        size_t slot = 0;
+        m_References.clear();
+        for ( const auto& p : parameters ){
+            m_Location = p.location;
+            if ( p.mode != Variable::MODE::VALUE ){
+                m_References[slot] = p.mode;
+            }
+            located( [&](){
+                m_Symbols.add( symbols::key( p.name ), Symbol{ Symbol::SCOPE::LOCAL, slot++, p.type } );
+            } );
+        }
+
+        for ( const auto& v : variables ){
+            m_Location = v.location;
+            check_type( v.type );
+            located( [&](){
+                m_Symbols.add( symbols::key( v.name ), Symbol{ Symbol::SCOPE::LOCAL, slot++, v.type } );
+            } );
+        }
+
+        // 'function_name' is the result inside a function
+        if ( returnType.has_value() ){
+            m_Location = location;
+            located( [&](){
+                m_Symbols.add( symbols::key( name ), Symbol{ Symbol::SCOPE::LOCAL, slot++, returnType } );
+            } );
+        }
+
+        for ( auto& st : code.statements ){
+            stat( st );
+        }
+
+        m_Symbols.pop();
+        m_Location = {};
+    }
+
+/******************************************************************/
+
+    std::optional<Type> Analyzer::call ( SubprogramCall& sub )
+    {
+        // Inside a function its name is the result, calls still go to the function
+        auto subprogram = global( sub.functionName );
+        auto symbol = subprogram.has_value() && signature( subprogram.value() ) != nullptr
+            ? subprogram.value()
+            : resolve( sub.functionName );
+
+        Many<Parameter> parameters {};
+        if ( symbol.scope == Symbol::SCOPE::BUILTIN ){
+            parameters = builtins()[symbol.index].parameters;
+        }
+        else {
+            auto callee = signature( symbol );
+            if ( callee == nullptr ){
+                fail( sub.functionName + " isn't a subprogram" );
+            }
+            parameters = callee->parameters;
+        }
+
+        if ( parameters.size() != sub.arguments.size() ){
+            fail( "Wrong number of arguments in call of " + sub.functionName );
+        }
+
+        for ( size_t i = 0; i < parameters.size(); ++i )
+        {
+            settle( sub.arguments[i], parameters[i].type );
+            auto type = expr( sub.arguments[i] );
+            expect( parameters[i].type, type, "argument of " + sub.functionName );
+            if ( parameters[i].mode != Variable::MODE::VAR ){
+                continue;
+            }
+
+            // Variables and elements of arrays that aren't packed have an address
+            auto root = addressable( sub.arguments[i] );
+            if ( root == nullptr ){
+                fail( "Argument of " + sub.functionName + " has to be a variable" );
+            }
+            if ( auto va = std::get_if<VariableAccess>( &sub.arguments[i] ) ){
+                assigned( va->identifier );
+            }
+            modifiable( root->value(), sub.functionName );
+        }
+
+        distinct( sub, parameters );
+
+        sub.symbol = symbol;
+        return symbol.type;
+    }
+
+    Symbol Analyzer::assigned ( const Identifier& name )
+    {
+        auto symbol = resolve( name );
+        if ( symbol.scope != Symbol::SCOPE::LOCAL
+            && ( symbol.scope == Symbol::SCOPE::BUILTIN
+                || signature( symbol ) != nullptr
+                || std::holds_alternative<NamedConstant>( m_Program.globals[symbol.index] ) ) ){
+            fail( "Assignment to " + name + ", which isn't a variable" );
+        }
+        modifiable( symbol, name );
+        return symbol;
+    }
+
+    void Analyzer::modifiable ( const Symbol& symbol, const Identifier& name ) const
+    {
+        auto r = m_References.find( symbol.index );
+        if ( symbol.scope == Symbol::SCOPE::LOCAL && r != m_References.end() && r->second == Variable::MODE::CONST ){
+            fail( "Modification of " + name + ", which is a const parameter" );
+        }
+        for ( const auto& iterator : m_Iterators ){
+            if ( iterator.scope == symbol.scope && iterator.index == symbol.index ){
+                fail( "Modification of " + name + ", which is the variable of a parallel for" );
+            }
+        }
+    }
+
+    bool Analyzer::reference ( const Symbol& symbol ) const
+    {
+        return symbol.scope == Symbol::SCOPE::LOCAL && m_References.count( symbol.index ) > 0;
+    }
+
+    void Analyzer::distinct ( const SubprogramCall& sub, const Many<Parameter>& parameters ) const
+    {
+        // Var and const parameters of the caller may refer to any of its global variables
+        auto overlap = [this]( const Symbol& a, const Symbol& b ){
+            if ( a.scope == b.scope && a.index == b.index ){
+                return true;
+            }
+            return ( reference( a ) && b.scope == Symbol::SCOPE::GLOBAL )
+                || ( reference( b ) && a.scope == Symbol::SCOPE::GLOBAL );
+        };
+
+        // Elements of the same array at constant indexes differing in some dimension
+        auto elements = [this]( const Expression& a, const Expression& b ){
+            auto arra = std::get_if<ptr<ArrayAccess>>( &a );
+            auto arrb = std::get_if<ptr<ArrayAccess>>( &b );
+            if ( arra == nullptr || arrb == nullptr 
+                || (*arra)->symbol->scope != (*arrb)->symbol->scope || (*arra)->symbol->index != (*arrb)->symbol->index ){
+                return false;
+            }
+            for ( size_t k = 0; k < (*arra)->indexes.size() && k < (*arrb)->indexes.size(); ++k ){
+                auto ia = constant_value( m_Program, (*arra)->indexes[k] );
+                auto ib = constant_value( m_Program, (*arrb)->indexes[k] );
+                if ( ia.has_value() && ib.has_value() && ia != ib ){
+                    return true;
+                }
+            }
+            return false;
+        };
+
+        for ( size_t i = 0; i < parameters.size(); ++i ){
+            if ( parameters[i].mode != Variable::MODE::VAR ){
+                continue;
+            }
+
+            const auto& modified = addressable( sub.arguments[i] )->value();
+            for ( size_t j = 0; j < parameters.size(); ++j ){
+                auto other = addressable( sub.arguments[j] );
+                if ( j == i || parameters[j].mode == Variable::MODE::VALUE || other == nullptr ){
+                    continue;
+                }
+                if ( overlap( modified, other->value() ) && ! elements( sub.arguments[i], sub.arguments[j] ) ){
+                    fail( "Arguments " + std::to_string( i + 1 ) + " and " + std::to_string( j + 1 )
+                        + " of " + sub.functionName + " may refer to the same variable" );
+                }
+            }
+        }
+    }
+
+    void Analyzer::increment ( Statement& statement )
+    {
+        auto sub = std::get_if<SubprogramCall>( &statement );
+        if ( sub == nullptr || ( sub->functionName != "inc" && sub->functionName != "dec" )
+            || m_Symbols.find( symbols::key( sub->functionName ) ).has_value() ){
+            return;
+        }
+
+        if ( sub->arguments.size() != 1 ){
+            fail( "Wrong number of arguments in call of " + sub->functionName );
+        }
+        auto va = std::get_if<VariableAccess>( &sub->arguments.front() );
+        if ( va == nullptr ){
+            fail( "Argument of " + sub->functionName + " has to be a variable" );
+        }
+
+        auto op = sub->functionName == "inc" ? BinaryOperator::OPERATOR::PLUS : BinaryOperator::OPERATOR::MINUS;
+        auto step = make_ptr<BinaryOperator>( op, *va, ConstantExpression{ IntegerConstant{ 1 } } );
+        statement = Assignment{ va->identifier, step, sub->location };
+    }
+
+    void Analyzer::set_length ( Statement& statement )
+    {
+        auto sub = std::get_if<SubprogramCall>( &statement );
+        if ( sub == nullptr || sub->functionName != "setlength"
+            || m_Symbols.find( symbols::key( sub->functionName ) ).has_value() ){
+            return;
+        }
+
+        if ( sub->arguments.size() != 2 ){
+            fail( "Wrong number of arguments in call of " + sub->functionName );
+        }
+        auto va = std::get_if<VariableAccess>( &sub->arguments.front() );
+        if ( va == nullptr ){
+            fail( "Argument of " + sub->functionName + " has to be a variable" );
+        }
+
+        statement = SetLength{ *va, sub->arguments.back(), sub->location };
+    }
+
+    Type Analyzer::expr ( Expression& expression )
+    {
+        reduction( expression );
+
+        return std::visit( overloaded {
+            [this]( VariableAccess& va ) -> Type {
+                auto symbol = resolve( va.identifier );
+                if ( symbol.scope == Symbol::SCOPE::BUILTIN || signature( symbol ) != nullptr ){
+                    fail( "Subprogram " + va.identifier + " used as a variable" );
+                }
+
+                va.symbol = symbol;
+                return symbol.type.value();
+            },
+            []( ConstantExpression& c ) -> Type {
+                if ( std::holds_alternative<BooleanConstant>( c.value ) ){
+                    return SimpleType::BOOLEAN;
+                }
+                return SimpleType::INTEGER;
+            },
+            [this]( ptr<ArrayAccess>& arr ) -> Type {
+                auto symbol = resolve( arr->array );
+                auto type = element( symbol, arr->array, arr->indexes );
+                arr->symbol = symbol;
+                return type;
+            },
+            [this]( ptr<ArraySlice>& sl ) -> Type {
+                fail( "Slice of " + sl->array + " used as a value" );
+            },
+            [this]( ptr<ArrayReduction>& red ) -> Type {
+                auto type = array_value( red->array );
+                if ( ! type.has_value() ){
+                    fail( "Type mismatch in reduction: expected array, got " + type_name( expr( red->array ) ) );
+                }
+
+                if ( red->op == ArrayReduction::OPERATOR::LENGTH ){
+                    return SimpleType::INTEGER;
+                }
+                if ( packed( type.value() ) || ! same( element_type( type.value() ), SimpleType::INTEGER ) ){
+                    fail( "Type mismatch in reduction: expected array of integer, got " + type_name( type.value() ) );
+                }
+                return SimpleType::INTEGER;
+            },
+            [this]( ptr<SubprogramCall>& sub ) -> Type {
+                auto type = call( *sub );
+                if ( ! type.has_value() ){
+                    fail( "Procedure " + sub->functionName + " used as a value" );
+                }
+                return type.value();
+            },
+            [this]( ptr<SetConstructor>& set ) -> Type {
+                // Without a context the set covers the constant elements and at least 0..255
+                long long low = 0;
+                long long high = DEFAULT_SET_HIGH;
+                for ( auto& e : set->elements ){
+                    expect( SimpleType::INTEGER, expr( e.first ), "set element" );
+                    if ( e.last.has_value() ){
+                        expect( SimpleType::INTEGER, expr( e.last.value() ), "set element" );
+                    }
+
+                    for ( const auto& bound : { &e.first, e.last.has_value() ? &e.last.value() : &e.first } ){
+                        if ( auto v = constant_value( m_Program, *bound ); v.has_value() ){
+                            low = std::min( low, v.value() );
+                            high = std::max( high, v.value() );
+                        }
+                    }
+                }
+
+                if ( ! set->type.has_value() ){
+                    set->type = make_ptr<Set>( ConstantExpression{ IntegerConstant{ low } }, ConstantExpression{ IntegerConstant{ high } } );
+                    check_type( set->type.value() );
+                }
+                return set->type.value();
+            },
+            [this]( ptr<UnaryOperator>& un ) -> Type {
+                auto type = expr( un->expression );
+                if ( un->op == UnaryOperator::OPERATOR::CARD ){
+                    if ( ! std::holds_alternative<ptr<Set>>( type ) ){
+                        fail( "Type mismatch in operand of card: expected set, got " + type_name( type ) );
+                    }
+                    return SimpleType::INTEGER;
+                }
+
+                if ( un->op == UnaryOperator::OPERATOR::NOT ){
+                    if ( ! same( type, SimpleType::BOOLEAN ) ){
+                        expect( SimpleType::INTEGER, type, "operand of not" );
+                    }
+                    return type;
+                }
+
+                expect( SimpleType::INTEGER, type, "operand of unary sign" );
+                return type;
+            },
+            [this]( ptr<BinaryOperator>& bin ) -> Type {
+                // A set constructor takes the type of the other operand
+                auto open = []( const Expression& e ){
+                    auto set = std::get_if<ptr<SetConstructor>>( &e );
+                    return set != nullptr && ! (*set)->type.has_value();
+                };
+
+                Type left, right;
+                if ( open( bin->left ) && ! open( bin->right ) ){
+                    right = expr( bin->right );
+                    settle( bin->left, right );
+                    left = expr( bin->left );
+                }
+                else {
+                    left = expr( bin->left );
+                    settle( bin->right, left );
+                    right = expr( bin->right );
+                }
+
+                bool sets = std::holds_alternative<ptr<Set>>( left );
+                switch ( bin->op ) {
+                case BinaryOperator::OPERATOR::LESS:
+                case BinaryOperator::OPERATOR::MORE:
+                    if ( sets ){
+                        fail( "Sets can't be compared by < and >" );
+                    }
+                    [[fallthrough]];
+                case BinaryOperator::OPERATOR::EQ:
+                case BinaryOperator::OPERATOR::NOT_EQ:
+                case BinaryOperator::OPERATOR::LESS_EQ:
+                case BinaryOperator::OPERATOR::MORE_EQ:
+                    // Sets are compared as sets, <= is a subset and >= a superset
+                    if ( array_type( left ) ){
+                        fail( "Comparison of " + type_name( left ) );
+                    }
+                    expect( left, right, "comparison" );
+                    return SimpleType::BOOLEAN;
+
+                case BinaryOperator::OPERATOR::IN:
+                    expect( SimpleType::INTEGER, left, "set membership" );
+                    if ( ! std::holds_alternative<ptr<Set>>( right ) ){
+                        fail( "Type mismatch in set membership: expected set, got " + type_name( right ) );
+                    }
+                    return SimpleType::BOOLEAN;
+
+                case BinaryOperator::OPERATOR::PLUS:
+                case BinaryOperator::OPERATOR::MINUS:
+                case BinaryOperator::OPERATOR::TIMES:
+                    // Union, difference and intersection
+                    if ( sets ){
+                        expect( left, right, "set operator" );
+                        return left;
+                    }
+                    expect( SimpleType::INTEGER, left, "arithmetic" );
+                    expect( SimpleType::INTEGER, right, "arithmetic" );
+                    return SimpleType::INTEGER;
+
+                case BinaryOperator::OPERATOR::AND:
+                case BinaryOperator::OPERATOR::OR:
+                case BinaryOperator::OPERATOR::XOR:
+                    if ( ! same( left, SimpleType::BOOLEAN ) ){
+                        expect( SimpleType::INTEGER, left, "logical operator" );
+                    }
+                    expect( left, right, "logical operator" );
+                    return left;
+
+                default:
+                    expect( SimpleType::INTEGER, left, "arithmetic" );
+                    expect( SimpleType::INTEGER, right, "arithmetic" );
+                    return SimpleType::INTEGER;
+                }
+            }
+        }, expression );
+    }
+
+    void Analyzer::stat ( Statement& statement )
+    {
+        if ( auto loc = location( statement ); loc.has_value() ){
+            m_Location = loc.value();
+        }
+        increment( statement );
+        set_length( statement );
+
+        std::visit( overloaded {
+            [this]( SubprogramCall& sub ){
+                call( sub );
+            },
+            [this]( Assignment& as ){
+                auto symbol = assigned( as.variable );
+                as.symbol = symbol;
+                if ( array_type( symbol.type.value() ) ){
+                    assign_array( symbol.type.value(), length( VariableAccess{ as.variable, symbol } ), as.value,
+                        "assignment to " + as.variable );
+                    return;
+                }
+
+                settle( as.value, symbol.type.value() );
+                expect( symbol.type.value(), expr( as.value ), "assignment to " + as.variable );
+            },
+            [this]( ArrayAssignment& as ){
+                auto symbol = resolve( as.array );
+                auto type = element( symbol, as.array, as.indexes );
+                modifiable( symbol, as.array );
+                settle( as.value, type );
+                expect( type, expr( as.value ), "assignment to " + as.array );
+                as.symbol = symbol;
+            },
+            [this]( SliceAssignment& as ){
+                assigned( as.slice.array );
+                auto type = slice( as.slice );
+                assign_array( type, length( make_ptr<ArraySlice>( as.slice ) ), as.value, "assignment to " + as.slice.array );
+            },
+            [this]( SetLength& sl ){
+                // Iterations indexing the array would race with the reallocation
+                if ( m_Parallel > 0 ){
+                    fail( "Setlength used inside of parallel for" );
+                }
+                auto symbol = assigned( sl.array.identifier );
+                if ( ! std::holds_alternative<ptr<DynamicArray>>( symbol.type.value() ) ){
+                    fail( "Type mismatch in setlength: expected dynamic array, got " + type_name( symbol.type.value() ) );
+                }
+                sl.array.symbol = symbol;
+                expect( SimpleType::INTEGER, expr( sl.length ), "length of " + sl.array.identifier );
+            },
+            [this]( ExitStatement& ){
+                if ( m_Parallel > 0 ){
+                    fail( "Exit used inside of parallel for" );
+                }
+            },
+            [this]( BreakStatement& ){
+                if ( m_Loops == 0 ){
+                    fail( "Break used outside of loop" );
+                }
+            },
+            []( EmptyStatement& ){},
+            [this]( Spawn& sp ){
+                // Outlined bodies of parallel loops have no frame to sync
+                if ( m_Parallel > 0 ){
+                    fail( "Spawn used inside of parallel for" );
+                }
+
+                auto type = call( sp.call );
+                if ( sp.call.symbol->scope == Symbol::SCOPE::BUILTIN ){
+                    fail( "Builtin " + sp.call.functionName + " can't be spawned" );
+                }
+
+                // The call runs later, it needs the address of a variable rather than of a temporary
+                const auto& parameters = signature( sp.call.symbol.value() )->parameters;
+                for ( size_t i = 0; i < parameters.size(); ++i ){
+                    if ( parameters[i].mode == Variable::MODE::CONST && addressable( sp.call.arguments[i] ) == nullptr ){
+                        fail( "Argument of spawned " + sp.call.functionName + " has to be a variable" );
+                    }
+                }
+
+                if ( sp.variable.has_value() ){
+                    if ( ! type.has_value() ){
+                        fail( "Procedure " + sp.call.functionName + " used as a value" );
+                    }
+
+                    auto symbol = assigned( sp.variable.value() );
+                    expect( symbol.type.value(), type.value(), "assignment to " + sp.variable.value() );
+                    sp.symbol = symbol;
+                }
+            },
+            [this]( SyncStatement& ){
+                if ( m_Parallel > 0 ){
+                    fail( "Sync used inside of parallel for" );
+                }
+            },
+            [this]( ptr<Block>& bl ){
+                for ( auto& st : bl->statements ){
+                    stat( st );
+                }
+            },
+            [this]( ptr<If>& if_ ){
+                auto loc = m_Location;
+                expect( SimpleType::BOOLEAN, expr( if_->condition ), "if condition" );
+                stat( if_->trueCode );
+                if ( if_->elseCode.has_value() ){
+                    m_Location = loc;
+                    stat( if_->elseCode.value() );
+                }
+            },
+            [this]( ptr<While>& wh ){
+                expect( SimpleType::BOOLEAN, expr( wh->condition ), "while condition" );
+                m_Loops++;
+                stat( wh->code );
+                m_Loops--;
+            },
+            [this]( ptr<For>& fo ){
+                auto symbol = resolve( fo->loopVariable );
+                if ( symbol.scope == Symbol::SCOPE::BUILTIN
+                    || ( symbol.scope == Symbol::SCOPE::GLOBAL
+                        && ! std::holds_alternative<Variable>( m_Program.globals[symbol.index] ) ) ){
+                    fail( "Loop variable " + fo->loopVariable + " isn't a variable" );
+                }
+
+                expect( SimpleType::INTEGER, symbol.type.value(), "loop variable" );
+                modifiable( symbol, fo->loopVariable );
+                expect( SimpleType::INTEGER, expr( fo->initialization ), "loop start" );
+                expect( SimpleType::INTEGER, expr( fo->target ), "loop bound" );
+                fo->symbol = symbol;
+
+                if ( ! fo->parallel.has_value() ){
+                    m_Loops++;
+                    stat( fo->code );
+                    m_Loops--;
+
+                    std::set<size_t> references {};
+                    for ( const auto& [slot, mode] : m_References ){
+                        references.insert( slot );
+                    }
+                    fo->written = modifies( m_Program, symbol, references, fo->code );
+                    return;
+                }
+
+                for ( auto& r : fo->parallel->reductions ){
+                    reduction( r, *fo );
+                }
+
+                // Iterations run on other threads, they can't leave the loop
+                auto loops = m_Loops;
+                m_Loops = 0;
+                m_Parallel++;
+                m_Iterators.push_back( symbol );
+                stat( fo->code );
+                m_Iterators.pop_back();
+                m_Parallel--;
+                m_Loops = loops;
+            }
+        }, statement );
+    }
+
+    void Analyzer::reduction ( Reduction& reduction, const For& loop )
+    {
+        auto symbol = resolve( reduction.variable );
+        if ( symbol.scope == Symbol::SCOPE::BUILTIN
+            || ( symbol.scope == Symbol::SCOPE::GLOBAL
+                && ! std::holds_alternative<Variable>( m_Program.globals[symbol.index] ) ) ){
+            fail( "Reduction of " + reduction.variable + ", which isn't a variable" );
+        }
+
+        expect( SimpleType::INTEGER, symbol.type.value(), "reduction of " + reduction.variable );
+        modifiable( symbol, reduction.variable );
+
+        if ( symbol.scope == loop.symbol->scope && symbol.index == loop.symbol->index ){
+            fail( "Reduction of the loop variable " + reduction.variable );
+        }
+
+        for ( const auto& r : loop.parallel->reductions ){
+            if ( &r != &reduction && r.symbol.has_value()
+                && r.symbol->scope == symbol.scope && r.symbol->index == symbol.index ){
+                fail( "Variable " + reduction.variable + " is reduced twice" );
+            }
+        }
+
+        reduction.symbol = symbol;
+    }
+
+    symbols::Stats Analyzer::stats () const
+    {
+        return m_Symbols.stats();
+    }
+
+/******************************************************************/
+
+    symbols::Stats analyze ( Program& program )
+    {
+        Analyzer analyzer { program };
+        analyzer.analyze();
+        return analyzer.stats();
+    }
+}
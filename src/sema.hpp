@@ -0,0 +1,86 @@
+#ifndef SEMA_HPP
+#define SEMA_HPP
+
+#include "ast.hpp"
+#include "symbols.hpp"
+#include <optional>
+#include <set>
+#include <string>
+
+/// Semantic analysis between parsing and code generation
+namespace sema
+{
+    using namespace ast;
+
+    /// Parameter of a subprogram
+    struct Parameter
+    {
+        Type type;
+
+        /// VAR and CONST are passed as an address
+        Variable::MODE mode;
+    };
+
+    /// Subprogram provided by the runtime
+    struct Builtin
+    {
+        Identifier name;
+        Many<Parameter> parameters;
+
+        /// Builtins are used as procedures when nullopt
+        std::optional<Type> returnType;
+    };
+
+    /// Largest number of values of a set type
+    constexpr long long MAX_SET_SIZE = 4096;
+
+    /// Highest value of the set of a constructor whose type isn't given by its context
+    constexpr long long DEFAULT_SET_HIGH = 255;
+
+    /// Runtime subprograms, indexed by the BUILTIN symbols
+    const Many<Builtin>& builtins ();
+
+    /// Parameters of the subprogram or builtin an analyzed call refers to
+    Many<Parameter> parameters ( const Program& program, const SubprogramCall& sub );
+
+    /// Readable name of a type for error messages
+    std::string type_name ( const Type& type );
+
+    /**
+     * @brief Resolve identifiers and check types of the program
+     *
+     * Every variable access, assignment, call and loop variable gets the
+     * symbol it refers to, so the code generator does no name lookups.
+     * Forward declarations are checked against their definitions. Throws
+     * std::runtime_error on the first error.
+     *
+     * @param program Program to annotate in place
+     * @return Statistics of the symbol table lookups
+     */
+    symbols::Stats analyze ( Program& program );
+
+    /**
+     * Value of an analyzed constant expression, named constants are
+     * followed through their symbols, nullopt if it isn't constant
+     */
+    std::optional<long long> constant_value ( const Program& program, const Expression& expr );
+
+    /**
+     * Bytes of an array with constant bounds as the code generation lays it
+     * out: packed elements are bits of 64-bit words, a set is a vector of
+     * them aligned to its power of two size and a dynamic array is its
+     * descriptor
+     */
+    uint64_t array_size ( const Program& program, const Type& array );
+
+    /**
+     * Whether an analyzed statement may change the variable: by an
+     * assignment, as a var argument or in a called subprogram of the
+     * program when it is global. The references are the slots of the var
+     * and const parameters of the enclosing subprogram, which may refer to
+     * the globals
+     */
+    bool modifies ( const Program& program, const Symbol& variable, const std::set<size_t>& references, const Statement& code );
+}
+
+#endif // SEMA_HPP
@@ -0,0 +1,202 @@
+#include "symbols.hpp"
+#include <algorithm>
+#include <cstring>
+#include <sstream>
+#include <stdexcept>
+
+namespace symbols
+{
+    Key key ( std::string_view name )
+    {
+        // FNV-1a
+        std::uint64_t hash = 14695981039346656037ull;
+        for ( unsigned char c : name ){
+            hash ^= c;
+            hash *= 1099511628211ull;
+        }
+
+        return Key{ name, hash };
+    }
+
+    std::string to_string ( const Stats& stats )
+    {
+        std::stringstream out {};
+        out << "Symbol lookups: " << stats.lookups
+            << ", hits: " << stats.hits
+            << ", insertions: " << stats.insertions
+            << ", probes: " << stats.probes
+            << ", longest probe: " << stats.longestProbe
+            << ", scopes: " << stats.scopes
+            << ", arena: " << stats.arenaBytes << " B";
+        return out.str();
+    }
+
+/******************************************************************/
+
+    std::string_view Arena::copy ( std::string_view text )
+    {
+        // Move on to the first block the text fits to, allocating one if needed
+        while ( m_Block < m_Blocks.size() && m_Offset + text.size() > m_Sizes[m_Block] ){
+            m_Block++;
+            m_Offset = 0;
+        }
+
+        if ( m_Block == m_Blocks.size() ){
+            auto size = std::max( BLOCK_SIZE, text.size() );
+            m_Blocks.push_back( std::make_unique<char[]>( size ) );
+            m_Sizes.push_back( size );
+            m_Offset = 0;
+        }
+
+        char* dest = m_Blocks[m_Block].get() + m_Offset;
+        std::memcpy( dest, text.data(), text.size() );
+        m_Offset += text.size();
+        return std::string_view( dest, text.size() );
+    }
+
+    Arena::Mark Arena::mark () const
+    {
+        return Mark{ m_Block, m_Offset };
+    }
+
+    void Arena::rewind ( const Mark& mark )
+    {
+        m_Block = mark.block;
+        m_Offset = mark.offset;
+    }
+
+    size_t Arena::capacity () const
+    {
+        size_t acc = 0;
+        for ( auto size : m_Sizes ){
+            acc += size;
+        }
+        return acc;
+    }
+
+/******************************************************************/
+
+    size_t SymbolTable::probe ( const Scope& scope, const Key& key ) const
+    {
+        size_t mask = scope.slots.size() - 1;
+        size_t i = key.hash & mask;
+        size_t length = 1;
+
+        while ( true )
+        {
+            const auto& slot = scope.slots[i];
+            if ( slot.generation != scope.generation
+                || ( slot.hash == key.hash && slot.name == key.name ) ){
+                break;
+            }
+
+            i = ( i + 1 ) & mask;
+            length++;
+        }
+
+        m_Stats.probes += length;
+        m_Stats.longestProbe = std::max( m_Stats.longestProbe, length );
+        return i;
+    }
+
+    void SymbolTable::grow ( Scope& scope )
+    {
+        std::vector<Slot> old ( scope.slots.size() * 2 );
+        std::swap( old, scope.slots );
+
+        for ( auto& slot : old ){
+            if ( slot.generation == scope.generation ){
+                auto i = probe( scope, Key{ slot.name, slot.hash } );
+                scope.slots[i] = std::move( slot );
+            }
+        }
+    }
+
+    void SymbolTable::push ()
+    {
+        if ( m_Depth == m_Scopes.size() ){
+            m_Scopes.push_back( Scope{ std::vector<Slot>( INITIAL_SLOTS ), 0, 0, {} } );
+        }
+
+        // Slots left by the previous user of the scope are from an older generation
+        auto& scope = m_Scopes[m_Depth++];
+        scope.size = 0;
+        scope.generation = ++m_Generation;
+        scope.mark = m_Arena.mark();
+
+        m_Stats.scopes++;
+    }
+
+    void SymbolTable::pop ()
+    {
+        if ( m_Depth == 0 ){
+            throw std::runtime_error( "Pop of an empty symbol table" );
+        }
+
+        m_Arena.rewind( m_Scopes[--m_Depth].mark );
+    }
+
+    size_t SymbolTable::depth () const
+    {
+        return m_Depth;
+    }
+
+    void SymbolTable::add ( const Key& key, const Symbol& symbol )
+    {
+        if ( m_Depth == 0 ){
+            throw std::runtime_error( "No scope to add " + std::string( key.name ) + " to" );
+        }
+
+        auto& scope = m_Scopes[m_Depth - 1];
+
+        // Kept at most three quarters full, so the probes stay short
+        if ( ( scope.size + 1 ) * 4 > scope.slots.size() * 3 ){
+            grow( scope );
+        }
+
+        auto i = probe( scope, key );
+        auto& slot = scope.slots[i];
+        if ( slot.generation == scope.generation ){
+            throw std::runtime_error( "Redefinition of " + std::string( key.name ) );
+        }
+
+        slot = Slot{ key.hash, m_Arena.copy( key.name ), symbol, scope.generation };
+        scope.size++;
+        m_Stats.insertions++;
+    }
+
+    std::optional<Symbol> SymbolTable::find ( const Key& key ) const
+    {
+        for ( size_t d = m_Depth; d > 0; --d ){
+            if ( auto s = find_in( d - 1, key ); s.has_value() ){
+                return s;
+            }
+        }
+
+        return std::nullopt;
+    }
+
+    std::optional<Symbol> SymbolTable::find_in ( size_t scope, const Key& key ) const
+    {
+        if ( scope >= m_Depth ){
+            return std::nullopt;
+        }
+
+        m_Stats.lookups++;
+        const auto& s = m_Scopes[scope];
+        const auto& slot = s.slots[probe( s, key )];
+        if ( slot.generation != s.generation ){
+            return std::nullopt;
+        }
+
+        m_Stats.hits++;
+        return slot.symbol;
+    }
+
+    Stats SymbolTable::stats () const
+    {
+        auto stats = m_Stats;
+        stats.arenaBytes = m_Arena.capacity();
+        return stats;
+    }
+}
@@ -0,0 +1,169 @@
+#ifndef SYMBOLS_HPP
+#define SYMBOLS_HPP
+
+#include "ast.hpp"
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/// Symbol tables used by the semantic analysis
+namespace symbols
+{
+    using namespace ast;
+
+    /// Identifier with its hash computed once, so it can be looked up in all scopes
+    struct Key
+    {
+        std::string_view name;
+        std::uint64_t hash;
+    };
+
+    /// Hash an identifier
+    Key key ( std::string_view name );
+
+    /// Counters of the symbol table usage, for profiling the analysis
+    struct Stats
+    {
+        /// Lookups of a key in a single scope
+        size_t lookups = 0;
+
+        /// Lookups that found the key
+        size_t hits = 0;
+
+        /// Slots compared over all lookups and insertions
+        size_t probes = 0;
+
+        /// Most slots compared by a single lookup or insertion
+        size_t longestProbe = 0;
+
+        size_t insertions = 0;
+
+        /// Number of scopes pushed
+        size_t scopes = 0;
+
+        /// Bytes the arena holds for the identifiers
+        size_t arenaBytes = 0;
+    };
+
+    /// Return a human readable summary of the statistics
+    std::string to_string ( const Stats& stats );
+
+    /**
+     * @brief Bump allocator for the identifiers of the scopes
+     *
+     * Memory is released only by rewinding to a mark, the blocks are kept
+     * and reused by the following scopes
+     */
+    class Arena
+    {
+    private:
+        static constexpr size_t BLOCK_SIZE = 4096;
+
+        std::vector<std::unique_ptr<char[]>> m_Blocks;
+
+        /// Size of each block, identifiers longer than a block get their own
+        std::vector<size_t> m_Sizes;
+
+        /// Block being allocated from and the offset in it
+        size_t m_Block = 0;
+        size_t m_Offset = 0;
+
+    public:
+        /// Position of the arena to rewind to
+        struct Mark
+        {
+            size_t block;
+            size_t offset;
+        };
+
+        /// Copy the text into the arena
+        std::string_view copy ( std::string_view text );
+
+        Mark mark () const;
+
+        /// Release everything allocated after the mark
+        void rewind ( const Mark& mark );
+
+        /// Bytes held by the arena, used or not
+        size_t capacity () const;
+    };
+
+    /**
+     * @brief Stack of scopes mapping identifiers to symbols
+     *
+     * Every scope is an open addressing hash table with linear probing,
+     * holding the hashes next to the names so most mismatches are decided
+     * without comparing strings. Scopes are kept allocated after being popped,
+     * pushing a new one only bumps a generation counter that invalidates the
+     * slots of the previous user.
+     */
+    class SymbolTable
+    {
+    private:
+        struct Slot
+        {
+            std::uint64_t hash;
+            std::string_view name;
+            Symbol symbol;
+
+            /// The slot is used only when it matches the generation of its scope
+            std::uint32_t generation;
+        };
+
+        struct Scope
+        {
+            /// Power of two number of slots
+            std::vector<Slot> slots;
+            size_t size;
+            std::uint32_t generation;
+
+            /// Arena position at the push of the scope
+            Arena::Mark mark;
+        };
+
+        static constexpr size_t INITIAL_SLOTS = 16;
+
+        std::vector<Scope> m_Scopes;
+
+        /// Number of scopes in use, the rest is kept for reuse
+        size_t m_Depth = 0;
+
+        std::uint32_t m_Generation = 0;
+
+        Arena m_Arena;
+
+        mutable Stats m_Stats;
+
+        /// Index of the slot holding the key in the scope, or of the empty slot it would go to
+        size_t probe ( const Scope& scope, const Key& key ) const;
+
+        /// Double the number of slots of the scope
+        void grow ( Scope& scope );
+
+    public:
+        /// Open a new innermost scope
+        void push ();
+
+        /// Close the innermost scope, releasing its identifiers
+        void pop ();
+
+        /// Number of open scopes
+        size_t depth () const;
+
+        /// Add a symbol to the innermost scope, throwing if it is a redefinition
+        void add ( const Key& key, const Symbol& symbol );
+
+        /// Find a symbol, the innermost scope first
+        std::optional<Symbol> find ( const Key& key ) const;
+
+        /// Find a symbol in a single scope, scopes are numbered from 0, the outermost
+        std::optional<Symbol> find_in ( size_t scope, const Key& key ) const;
+
+        Stats stats () const;
+    };
+}
+
+#endif // SYMBOLS_HPP
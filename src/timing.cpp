@@ -0,0 +1,124 @@
+#include "timing.hpp"
+#include <iomanip>
+#include <sstream>
+#include <sys/resource.h>
+
+namespace timing
+{
+    long peak_rss ()
+    {
+        rusage usage {};
+        if ( getrusage( RUSAGE_SELF, &usage ) != 0 ){
+            return 0;
+        }
+
+        // Linux reports the maximum resident set size in KiB
+        return usage.ru_maxrss;
+    }
+
+    void Report::count ( const std::string& unit, size_t value )
+    {
+        if ( ! m_Phases.empty() ){
+            m_Phases.back().count = { unit, value };
+        }
+    }
+
+    void Report::pass_timers ( const std::string& text )
+    {
+        m_PassTimers = text;
+    }
+
+    std::string Report::to_table () const
+    {
+        std::ostringstream out {};
+        std::chrono::microseconds total { 0 };
+
+        out << std::left << std::setw( 12 ) << "Phase"
+            << std::right << std::setw( 12 ) << "Time (ms)"
+            << std::setw( 16 ) << "Peak RSS (KiB)"
+            << "  Count\n";
+
+        for ( const auto& phase : m_Phases )
+        {
+            total += phase.time;
+
+            out << std::left << std::setw( 12 ) << phase.name
+                << std::right << std::setw( 12 ) << std::fixed << std::setprecision( 3 ) << phase.time.count() / 1000.0
+                << std::setw( 16 ) << phase.peakRss;
+
+            if ( phase.count.has_value() ){
+                out << "  " << phase.count->second << ' ' << phase.count->first;
+            }
+            out << '\n';
+        }
+
+        out << std::left << std::setw( 12 ) << "total"
+            << std::right << std::setw( 12 ) << std::fixed << std::setprecision( 3 ) << total.count() / 1000.0
+            << '\n';
+
+        if ( ! m_PassTimers.empty() ){
+            out << '\n' << m_PassTimers;
+        }
+
+        return out.str();
+    }
+
+    /// Quote and escape a string for JSON
+    std::string json_string ( const std::string& str )
+    {
+        std::ostringstream out {};
+        out << '"';
+
+        for ( char ch : str ){
+            switch ( ch ) {
+            case '"':
+                out << "\\\"";
+                break;
+            case '\\':
+                out << "\\\\";
+                break;
+            case '\n':
+                out << "\\n";
+                break;
+            case '\t':
+                out << "\\t";
+                break;
+            default:
+                if ( static_cast<unsigned char>( ch ) < 0x20 ){
+                    out << "\\u" << std::hex << std::setw( 4 ) << std::setfill( '0' ) << int( ch )
+                        << std::dec << std::setfill( ' ' );
+                }
+                else {
+                    out << ch;
+                }
+            }
+        }
+
+        out << '"';
+        return out.str();
+    }
+
+    std::string Report::to_json () const
+    {
+        std::ostringstream out {};
+        out << "{\n  \"phases\": [";
+
+        for ( size_t i = 0; i < m_Phases.size(); ++i )
+        {
+            const auto& phase = m_Phases[i];
+
+            out << ( i == 0 ? "\n" : ",\n" )
+                << "    { \"name\": " << json_string( phase.name )
+                << ", \"time_us\": " << phase.time.count()
+                << ", \"peak_rss_kib\": " << phase.peakRss;
+
+            if ( phase.count.has_value() ){
+                out << ", " << json_string( phase.count->first ) << ": " << phase.count->second;
+            }
+            out << " }";
+        }
+
+        out << "\n  ],\n  \"pass_timers\": " << json_string( m_PassTimers ) << "\n}\n";
+        return out.str();
+    }
+}
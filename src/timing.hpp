@@ -0,0 +1,95 @@
+#ifndef TIMING_HPP
+#define TIMING_HPP
+
+#include <chrono>
+#include <optional>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+/// Compile time instrumentation
+namespace timing
+{
+    /// Measurement of a single compiler phase
+    struct Phase
+    {
+        std::string name;
+        std::chrono::microseconds time { 0 };
+
+        /// Number of items the phase produced (tokens, nodes, instructions), if counted
+        std::optional<std::pair<std::string, size_t>> count = std::nullopt;
+
+        /// Peak resident set size of the process at the end of the phase, in KiB
+        long peakRss = 0;
+    };
+
+    /// Peak resident set size of the process so far, in KiB
+    long peak_rss ();
+
+    /**
+     * @brief Per-phase compile time report
+     *
+     * Phases are recorded in the order they finished, the LLVM pass timers
+     * are kept as the text LLVM printed them in
+     */
+    class Report
+    {
+    private:
+        std::vector<Phase> m_Phases;
+
+        /// LLVM's own timers of the optimization passes
+        std::string m_PassTimers;
+
+    public:
+        /// Run the function as the given phase, returning its result
+        template <typename F>
+        auto measure ( const std::string& name, F&& f )
+        {
+            auto start = std::chrono::steady_clock::now();
+            auto finish = [&](){
+                m_Phases.push_back( Phase {
+                    name,
+                    std::chrono::duration_cast<std::chrono::microseconds>( std::chrono::steady_clock::now() - start ),
+                    std::nullopt,
+                    peak_rss()
+                } );
+            };
+
+            if constexpr ( std::is_void_v<decltype( f() )> ){
+                f();
+                finish();
+            }
+            else {
+                auto result = f();
+                finish();
+                return result;
+            }
+        }
+
+        /// Attach a count of produced items to the last measured phase
+        void count ( const std::string& unit, size_t value );
+
+        /// Set the text of the LLVM pass timers
+        void pass_timers ( const std::string& text );
+
+        /// Format the report as a human readable table
+        std::string to_table () const;
+
+        /// Format the report as a JSON object
+        std::string to_json () const;
+    };
+
+    /// Run the function as a phase of the report, or just run it if there is no report
+    template <typename F>
+    auto measure ( Report* report, const std::string& name, F&& f )
+    {
+        if ( report == nullptr ){
+            return f();
+        }
+
+        return report->measure( name, std::forward<F>( f ) );
+    }
+}
+
+#endif // TIMING_HPP
@@ -67,12 +67,15 @@ namespace token
         BEGIN, END,
         WHILE, DO,
         FOR, TO, DOWNTO,
+        PARALLEL, REDUCE,
+        SPAWN, SYNC,
         IF, THEN, ELSE,
-        ARRAY, OF,
+        ARRAY, OF, PACKED, SET,
         INTEGER, BOOLEAN,
         EXIT, BREAK,
         DIV, MOD,
-        NOT, AND, OR, XOR
+        NOT, AND, OR, XOR,
+        IN, CARD
     };
 
     /// Keyword - the string of the keyword map
@@ -91,11 +94,17 @@ namespace token
         {KEYWORD::FOR,          "for"},
         {KEYWORD::TO,           "to"},
         {KEYWORD::DOWNTO,       "downto"},
+        {KEYWORD::PARALLEL,     "parallel"},
+        {KEYWORD::REDUCE,       "reduce"},
+        {KEYWORD::SPAWN,        "spawn"},
+        {KEYWORD::SYNC,         "sync"},
         {KEYWORD::IF,           "if"},
         {KEYWORD::THEN,         "then"},
         {KEYWORD::ELSE,         "else"},
         {KEYWORD::ARRAY,        "array"},
         {KEYWORD::OF,           "of"},
+        {KEYWORD::PACKED,       "packed"},
+        {KEYWORD::SET,          "set"},
         {KEYWORD::INTEGER,      "integer"},
         {KEYWORD::BOOLEAN,      "boolean"},
         {KEYWORD::EXIT,         "exit"},
@@ -105,7 +114,9 @@ namespace token
         {KEYWORD::NOT,          "not"},
         {KEYWORD::AND,          "and"},
         {KEYWORD::OR,           "or"},
-        {KEYWORD::XOR,          "xor"}
+        {KEYWORD::XOR,          "xor"},
+        {KEYWORD::IN,           "in"},
+        {KEYWORD::CARD,         "card"}
     };
 
     /// Wrapper around std::string